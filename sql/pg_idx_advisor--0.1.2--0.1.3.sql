@@ -0,0 +1,217 @@
+-- cost saved over the bind value samples, see index_adviser.param_samples
+alter table index_advisory add column cost_saved_min real,
+	add column cost_saved_p50 real,
+	add column cost_saved_p90 real,
+	add column cost_saved_max real;
+
+-- aggregated advisory: one row per recommended index, see index_adviser.aggregate
+create table index_advisory_queries( fingerprint bigint primary key,
+	query		text,
+	first_seen	timestamptz,
+	last_seen	timestamptz,
+	cost_saved_min	real,	-- cost saved over the bind value samples, see index_adviser.param_samples
+	cost_saved_p50	real,
+	cost_saved_p90	real,
+	cost_saved_max	real);
+
+create table index_advisory_summary( reloid oid,
+	attrs		integer[],
+	indcollation int[],
+	indclass	int[],
+	indexprs	text,
+	indpred		text,
+	hits		bigint,
+	benefit_total double precision,
+	benefit_max	real,
+	index_size	integer,
+	first_seen	timestamptz,
+	last_seen	timestamptz,
+	fingerprint	bigint references index_advisory_queries( fingerprint ),
+	recommendation text);
+
+-- the expressions and predicates can be too long for a btree, so index their md5
+create unique index IAS_key on index_advisory_summary( reloid, attrs, indclass, md5(indexprs), md5(indpred) );
+
+-- called by the adviser with one array element per advice
+create or replace function index_advisory_upsert( p_reloid oid[],
+	p_attrs		text[],
+	p_benefit	real[],
+	p_index_size integer[],
+	p_backend_pid integer[],
+	p_timestamp	timestamptz[],
+	p_indcollation text[],
+	p_indclass	text[],
+	p_indexprs	text[],
+	p_indpred	text[],
+	p_query		text[],
+	p_recommendation text[],
+	p_fingerprint bigint[],
+	p_cost_saved_min real[],
+	p_cost_saved_p50 real[],
+	p_cost_saved_p90 real[],
+	p_cost_saved_max real[] ) returns void as $body$
+declare
+	i integer;
+begin
+	for i in 1 .. coalesce( array_length( p_reloid, 1 ), 0 ) loop
+		loop
+			update index_advisory_queries
+				set last_seen = greatest( last_seen, p_timestamp[i] ),
+					cost_saved_min = coalesce( p_cost_saved_min[i], cost_saved_min ),
+					cost_saved_p50 = coalesce( p_cost_saved_p50[i], cost_saved_p50 ),
+					cost_saved_p90 = coalesce( p_cost_saved_p90[i], cost_saved_p90 ),
+					cost_saved_max = coalesce( p_cost_saved_max[i], cost_saved_max )
+				where fingerprint = p_fingerprint[i];
+			exit when found;
+			begin
+				insert into index_advisory_queries( fingerprint, query, first_seen, last_seen,
+						cost_saved_min, cost_saved_p50, cost_saved_p90, cost_saved_max )
+					values( p_fingerprint[i], p_query[i], p_timestamp[i], p_timestamp[i],
+						p_cost_saved_min[i], p_cost_saved_p50[i], p_cost_saved_p90[i],
+						p_cost_saved_max[i] );
+				exit;
+			exception when unique_violation then
+				-- somebody else just inserted it; update it instead
+			end;
+		end loop;
+
+		loop
+			update index_advisory_summary
+				set hits = hits + 1,
+					benefit_total = benefit_total + p_benefit[i],
+					benefit_max = greatest( benefit_max, p_benefit[i] ),
+					index_size = p_index_size[i],
+					last_seen = greatest( last_seen, p_timestamp[i] ),
+					fingerprint = p_fingerprint[i]
+				where reloid = p_reloid[i]
+					and attrs = p_attrs[i]::integer[]
+					and indclass = p_indclass[i]::integer[]
+					and md5(indexprs) = md5(p_indexprs[i])
+					and md5(indpred) = md5(p_indpred[i]);
+			exit when found;
+			begin
+				insert into index_advisory_summary( reloid, attrs, indcollation, indclass,
+						indexprs, indpred, hits, benefit_total, benefit_max, index_size,
+						first_seen, last_seen, fingerprint, recommendation )
+					values( p_reloid[i], p_attrs[i]::integer[], p_indcollation[i]::integer[],
+						p_indclass[i]::integer[], p_indexprs[i], p_indpred[i], 1, p_benefit[i],
+						p_benefit[i], p_index_size[i], p_timestamp[i], p_timestamp[i],
+						p_fingerprint[i], p_recommendation[i] );
+				exit;
+			exception when unique_violation then
+				-- somebody else just inserted it; update it instead
+			end;
+		end loop;
+	end loop;
+end;
+$body$ language plpgsql set search_path from current;
+
+-- picks, from all the advice gathered so far, the indexes worth creating within
+-- budget_kb KBs of disk (null for no limit). Every write to a table costs each of
+-- its indexes write_penalty cost units. The indexes are picked greedily by their
+-- net benefit per KB; an index made redundant by a picked index with more columns
+-- is skipped, and one extending a picked index only counts its extra benefit.
+create or replace function index_advisory_select( budget_kb bigint default null,
+	write_penalty double precision default 0 )
+	returns table( recommendation text,
+		reloid		oid,
+		index_size	integer,
+		benefit		double precision,
+		penalty		double precision ) as $body$
+declare
+	c			record;
+	used_kb		bigint := 0;
+	p_rel		oid[] := '{}';
+	p_key		text[] := '{}';
+	p_attrs		text[] := '{}';
+	p_class		text[] := '{}';
+	p_benefit	double precision[] := '{}';
+	net			double precision;
+	picked		integer[];
+	picked_cls	integer[];
+	redundant	boolean;
+	j			integer;
+begin
+	for c in
+		with advice as (
+			select a.reloid, a.attrs, a.indclass, a.indexprs, a.indpred,
+					sum( a.benefit ) as benefit, max( a.index_size ) as index_size,
+					max( a.recommendation ) as recommendation
+				from index_advisory a
+				group by a.reloid, a.attrs, a.indclass, a.indexprs, a.indpred
+			union all
+			select s.reloid, s.attrs, s.indclass, s.indexprs, s.indpred,
+					s.benefit_total, s.index_size, s.recommendation
+				from index_advisory_summary s
+		)
+		select a.reloid, a.attrs, a.indclass,
+				md5( coalesce( a.indexprs, '' ) || coalesce( a.indpred, '' ) ) as key,
+				sum( a.benefit ) as benefit, greatest( max( a.index_size ), 1 ) as index_size,
+				max( a.recommendation ) as recommendation,
+				write_penalty * coalesce( max( t.n_tup_ins + t.n_tup_upd + t.n_tup_del ), 0 ) as penalty
+			from advice a
+				left join pg_stat_all_tables t on t.relid = a.reloid
+			group by a.reloid, a.attrs, a.indclass, a.indexprs, a.indpred
+			order by ( sum( a.benefit ) - write_penalty
+						* coalesce( max( t.n_tup_ins + t.n_tup_upd + t.n_tup_del ), 0 ) )
+					/ greatest( max( a.index_size ), 1 ) desc
+	loop
+		if budget_kb is not null and used_kb + c.index_size > budget_kb then
+			continue;
+		end if;
+
+		net := c.benefit - c.penalty;
+		redundant := false;
+
+		for j in 1 .. coalesce( array_length( p_rel, 1 ), 0 ) loop
+			-- an index only covers another of the same op classes (and so access method)
+			if p_rel[j] = c.reloid and p_key[j] = c.key then
+				picked := p_attrs[j]::integer[];
+				picked_cls := p_class[j]::integer[];
+				if c.attrs = picked[1:array_length( c.attrs, 1 )]
+					and c.indclass = picked_cls[1:array_length( c.indclass, 1 )] then
+					redundant := true;
+					exit;
+				elsif picked = c.attrs[1:array_length( picked, 1 )]
+					and picked_cls = c.indclass[1:array_length( picked_cls, 1 )] then
+					net := net - p_benefit[j];
+				end if;
+			end if;
+		end loop;
+
+		if redundant or net <= 0 then
+			continue;
+		end if;
+
+		used_kb := used_kb + c.index_size;
+		p_rel := p_rel || c.reloid;
+		p_key := p_key || c.key;
+		p_attrs := p_attrs || c.attrs::text;
+		p_class := p_class || c.indclass::text;
+		p_benefit := p_benefit || c.benefit;
+
+		recommendation := c.recommendation;
+		reloid := c.reloid;
+		index_size := c.index_size;
+		benefit := net;
+		penalty := c.penalty;
+		return next;
+	end loop;
+end;
+$body$ language plpgsql stable set search_path from current;
+
+-- GIN cost estimation of the virtual GIN indexes; the planner calls it as the amcostestimate
+create function index_adviser_gincostestimate( internal, internal, internal, internal,
+	internal, internal, internal )
+returns void as 'MODULE_PATHNAME' language C strict;
+
+-- advises on a workload of statements in one call, with one pool of candidates:
+-- a row per statement (recommendation is null) with the cost it saves, a row per
+-- index a statement uses with its share, and a row per index with its benefit
+-- over the whole workload (query_no is null). Nothing is stored.
+create function index_advise_workload( queries text[],
+	out query_no integer,
+	out recommendation text,
+	out index_size integer,
+	out benefit double precision )
+returns setof record as 'MODULE_PATHNAME' language C strict;
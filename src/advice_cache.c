@@ -0,0 +1,399 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file advice_cache.c
+ * \brief per-backend cache of the advice given for a query fingerprint.
+ *
+ * The planner hook sees the same (parameterized) statements over and over.
+ * This cache remembers when a statement - identified by a jumbled fingerprint
+ * of its query tree - was last advised on, so repeats within
+ * index_adviser.cache_ttl seconds skip the whole advisement. With
+ * index_adviser.plan_cache the advice of a parameterized statement doesn't
+ * expire: every plan of a prepared statement shares the query tree, and so the
+ * advice of its first one.
+ *
+ * The fingerprint is a 32-bit hash, so two different statements may collide;
+ * the second one is then not advised on while the advice of the first is
+ * cached - for good, with plan_cache.
+ *
+ * Entries are dropped when a relation they depend on gets a relcache
+ * invalidation (DDL, ANALYZE updating relpages/reltuples, ...), and the whole
+ * cache is flushed when pg_statistic changes.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * includes (ordered alphabetically)
+ * ------------------------------------------------------------------------
+ */
+#include "advice_cache.h"
+
+#include "access/hash.h"
+#include "nodes/nodeFuncs.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
+
+typedef struct {
+	uint32	hash;			/**< the fingerprint computed so far */
+	List*	relids;			/**< relations referenced by the query */
+	bool	externParams;	/**< the query has PARAM_EXTERN Params */
+	bool	withConsts;		/**< hash the values of the constants too */
+} FingerprintContext;
+
+/*! the cache itself; created on first use */
+static HTAB* adviceCache = NULL;
+
+/*! invalidation callbacks can't be unregistered, so only do it once */
+static bool adviceCacheCallbacksRegistered = false;
+
+static bool fingerprint_walker( Node* node, FingerprintContext* context );
+static void advice_cache_relcache_callback( Datum arg, Oid relid );
+static void advice_cache_syscache_callback( Datum arg, int cacheid,
+											uint32 hashvalue );
+static void advice_cache_flush( void );
+
+static void fingerprint_add( FingerprintContext* context, uint32 value )
+{
+	context->hash = DatumGetUInt32( hash_uint32( context->hash ^ value ) );
+}
+
+/**
+ * fingerprint_walker
+ *    jumbles the query tree into a hash, in the spirit of pg_stat_statements:
+ * the structure, relations, columns, operators and functions are hashed, the
+ * values of constants only if asked for. The expression nodes are hashed with
+ * the fields that tell them apart besides their arguments; the walker goes on
+ * into the arguments of the others.
+ */
+static bool fingerprint_walker( Node* node, FingerprintContext* context )
+{
+	if( node == NULL )
+		return false;
+
+	fingerprint_add( context, (uint32) nodeTag( node ) );
+
+	switch( nodeTag( node ) )
+	{
+		case T_Query:
+		{
+			const Query* const query = (const Query*)node;
+			ListCell* cell;
+
+			fingerprint_add( context, (uint32) query->commandType );
+
+			/* the walker doesn't visit GROUP BY and ORDER BY */
+			foreach( cell, query->groupClause )
+				fingerprint_add( context,
+						((SortGroupClause*)lfirst( cell ))->tleSortGroupRef );
+			foreach( cell, query->sortClause )
+				fingerprint_add( context,
+						((SortGroupClause*)lfirst( cell ))->tleSortGroupRef );
+
+			return query_tree_walker( (Query*)query, fingerprint_walker,
+									  (void*) context, QTW_EXAMINE_RTES );
+		}
+
+		case T_RangeTblEntry:
+		{
+			const RangeTblEntry* const rte = (const RangeTblEntry*)node;
+
+			fingerprint_add( context, (uint32) rte->rtekind );
+			if( rte->rtekind == RTE_RELATION )
+			{
+				fingerprint_add( context, rte->relid );
+				context->relids = list_append_unique_oid( context->relids,
+														  rte->relid );
+			}
+			/* range_table_walker() goes on into sub-queries, functions etc. */
+			return false;
+		}
+
+		case T_Var:
+		{
+			const Var* const var = (const Var*)node;
+
+			fingerprint_add( context, var->varno );
+			fingerprint_add( context, (uint32) var->varattno );
+			fingerprint_add( context, var->varlevelsup );
+			return false;
+		}
+
+		case T_Const:
+		{
+			const Const* const c = (const Const*)node;
+
+			fingerprint_add( context, c->consttype );
+
+			/* otherwise ignore the value, just like pg_stat_statements */
+			if( context->withConsts )
+			{
+				if( c->constisnull )
+					fingerprint_add( context, 0 );
+				else if( c->constbyval )
+					fingerprint_add( context,
+						DatumGetUInt32( hash_any( (const unsigned char*) &c->constvalue,
+												  sizeof(Datum) ) ) );
+				else
+					fingerprint_add( context,
+						DatumGetUInt32( hash_any( (const unsigned char*) DatumGetPointer( c->constvalue ),
+												  (int) datumGetSize( c->constvalue, false, c->constlen ) ) ) );
+			}
+			return false;
+		}
+
+		case T_Param:
+			if( ((const Param*)node)->paramkind == PARAM_EXTERN )
+				context->externParams = true;
+			fingerprint_add( context, (uint32) ((const Param*)node)->paramkind );
+			fingerprint_add( context, (uint32) ((const Param*)node)->paramid );
+			return false;
+
+		case T_OpExpr:
+		case T_DistinctExpr:
+		case T_NullIfExpr:
+			fingerprint_add( context, ((const OpExpr*)node)->opno );
+			break;
+
+		case T_ScalarArrayOpExpr:
+			fingerprint_add( context, ((const ScalarArrayOpExpr*)node)->opno );
+			fingerprint_add( context, (uint32) ((const ScalarArrayOpExpr*)node)->useOr );
+			break;
+
+		case T_NullTest:
+			fingerprint_add( context, (uint32) ((const NullTest*)node)->nulltesttype );
+			break;
+
+		case T_BooleanTest:
+			fingerprint_add( context, (uint32) ((const BooleanTest*)node)->booltesttype );
+			break;
+
+		case T_SubLink:
+			fingerprint_add( context, (uint32) ((const SubLink*)node)->subLinkType );
+			break;
+
+		case T_RowCompareExpr:
+			fingerprint_add( context, (uint32) ((const RowCompareExpr*)node)->rctype );
+			break;
+
+		case T_MinMaxExpr:
+			fingerprint_add( context, (uint32) ((const MinMaxExpr*)node)->op );
+			break;
+
+		case T_RelabelType:
+			fingerprint_add( context, ((const RelabelType*)node)->resulttype );
+			break;
+
+		case T_CoerceViaIO:
+			fingerprint_add( context, ((const CoerceViaIO*)node)->resulttype );
+			break;
+
+		case T_FieldSelect:
+			fingerprint_add( context, (uint32) ((const FieldSelect*)node)->fieldnum );
+			break;
+
+		case T_WindowFunc:
+			fingerprint_add( context, ((const WindowFunc*)node)->winfnoid );
+			break;
+
+		case T_FuncExpr:
+			fingerprint_add( context, ((const FuncExpr*)node)->funcid );
+			break;
+
+		case T_Aggref:
+			fingerprint_add( context, ((const Aggref*)node)->aggfnoid );
+			break;
+
+		case T_BoolExpr:
+			fingerprint_add( context, (uint32) ((const BoolExpr*)node)->boolop );
+			break;
+
+		default:
+			break;
+	}
+
+	return expression_tree_walker( node, fingerprint_walker, (void*) context );
+}
+
+/**
+ * query_fingerprint
+ *    returns the fingerprint of the query, and the list of relations it reads
+ * in relids (unless relids is NULL). externParams (unless NULL) tells whether
+ * the query has parameters ($1...) - the statement may be a prepared one.
+ *
+ * withConsts hashes the values of the constants as well: the advice for
+ * "a = 1" and for "a = 100" differs (partial index predicates, selectivities),
+ * so the advice cache and the bind value samples tell them apart. Without it,
+ * if pg_stat_statements (or anybody else) already computed a queryId we use
+ * that one.
+ */
+uint32 query_fingerprint( const Query* query, bool withConsts, List** relids,
+						  bool* externParams )
+{
+	FingerprintContext context;
+
+	context.hash = 0;
+	context.relids = NIL;
+	context.externParams = false;
+	context.withConsts = withConsts;
+
+	fingerprint_walker( (Node*)query, &context );
+
+	if( relids != NULL )
+		*relids = context.relids;
+	else
+		list_free( context.relids );
+
+	if( externParams != NULL )
+		*externParams = context.externParams;
+
+	return query->queryId != 0 && !withConsts ? query->queryId : context.hash;
+}
+
+/**
+ * advice_cache_lookup
+ *    returns the cached advice for the fingerprint if it was computed less
+ * than ttl seconds ago, NULL otherwise. ADVICE_CACHE_NO_EXPIRY returns it
+ * for as long as it is cached.
+ */
+AdviceCacheEntry* advice_cache_lookup( uint32 fingerprint, int ttl )
+{
+	AdviceCacheEntry* entry;
+
+	if( adviceCache == NULL || ttl == 0 )
+		return NULL;
+
+	entry = (AdviceCacheEntry*) hash_search( adviceCache, &fingerprint,
+											HASH_FIND, NULL );
+	if( entry == NULL )
+		return NULL;
+
+	if( ttl != ADVICE_CACHE_NO_EXPIRY &&
+		TimestampDifferenceExceeds( entry->computed, GetCurrentTimestamp(),
+									ttl * 1000 ) )
+	{
+		elog( DEBUG2, "IND ADV: advice_cache_lookup: %u is stale", fingerprint );
+		return NULL;
+	}
+
+	elog( DEBUG2, "IND ADV: advice_cache_lookup: hit for %u", fingerprint );
+	return entry;
+}
+
+/**
+ * advice_cache_store
+ *    remembers the advice just computed for the fingerprint; sampled tells
+ * whether it was made on the sampled bind values of the statement.
+ */
+void advice_cache_store( uint32 fingerprint, List* relids,
+						 int nadvice, Cost costSaved, bool sampled )
+{
+	AdviceCacheEntry*	entry;
+	ListCell*			cell;
+	int					i = 0;
+
+	/* too many relations to track for invalidation - don't cache */
+	if( list_length( relids ) > ADVICE_CACHE_MAX_RELS )
+		return;
+
+	if( adviceCache == NULL )
+	{
+		HASHCTL ctl;
+
+		memset( &ctl, 0, sizeof( ctl ) );
+		ctl.keysize = sizeof( uint32 );
+		ctl.entrysize = sizeof( AdviceCacheEntry );
+		ctl.hash = oid_hash;
+
+		adviceCache = hash_create( "index_adviser advice cache",
+									ADVICE_CACHE_SIZE, &ctl,
+									HASH_ELEM | HASH_FUNCTION );
+
+		if( !adviceCacheCallbacksRegistered )
+		{
+			CacheRegisterRelcacheCallback( advice_cache_relcache_callback,
+										   (Datum) 0 );
+			CacheRegisterSyscacheCallback( STATRELATTINH,
+										   advice_cache_syscache_callback,
+										   (Datum) 0 );
+			adviceCacheCallbacksRegistered = true;
+		}
+	}
+	else if( hash_get_num_entries( adviceCache ) >= ADVICE_CACHE_SIZE )
+	{
+		/* keep it simple: start over */
+		advice_cache_flush();
+		advice_cache_store( fingerprint, relids, nadvice, costSaved, sampled );
+		return;
+	}
+
+	entry = (AdviceCacheEntry*) hash_search( adviceCache, &fingerprint,
+											HASH_ENTER, NULL );
+	entry->computed = GetCurrentTimestamp();
+	entry->nadvice = nadvice;
+	entry->costSaved = costSaved;
+	entry->sampled = sampled;
+	entry->nrels = list_length( relids );
+	foreach( cell, relids )
+		entry->relids[i++] = lfirst_oid( cell );
+}
+
+/**
+ * advice_cache_flush
+ *    forgets all cached advice.
+ */
+static void advice_cache_flush( void )
+{
+	if( adviceCache == NULL )
+		return;
+
+	hash_destroy( adviceCache );
+	adviceCache = NULL;
+}
+
+/**
+ * advice_cache_relcache_callback
+ *    drops the advice depending on an invalidated relation.
+ */
+static void advice_cache_relcache_callback( Datum arg, Oid relid )
+{
+	HASH_SEQ_STATUS		status;
+	AdviceCacheEntry*	entry;
+
+	if( adviceCache == NULL )
+		return;
+
+	/* InvalidOid means all relations */
+	if( relid == InvalidOid )
+	{
+		advice_cache_flush();
+		return;
+	}
+
+	hash_seq_init( &status, adviceCache );
+	while( (entry = (AdviceCacheEntry*) hash_seq_search( &status )) != NULL )
+	{
+		int i;
+
+		for( i = 0; i < entry->nrels; ++i )
+		{
+			if( entry->relids[i] == relid )
+			{
+				hash_search( adviceCache, &entry->fingerprint, HASH_REMOVE, NULL );
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * advice_cache_syscache_callback
+ *    new statistics may change the advice; we can't tell which relation the
+ * pg_statistic hash value belongs to, so forget everything.
+ */
+static void advice_cache_syscache_callback( Datum arg, int cacheid,
+											uint32 hashvalue )
+{
+	advice_cache_flush();
+}
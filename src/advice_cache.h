@@ -0,0 +1,46 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file advice_cache.h
+ * \brief     Prototypes for advice_cache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ADVICE_CACHE_H
+#define ADVICE_CACHE_H 1
+
+#include "postgres.h"
+
+#include "nodes/parsenodes.h"
+#include "optimizer/cost.h"
+#include "utils/timestamp.h"
+
+/* max number of relations an advice can depend on and still be cached */
+#define ADVICE_CACHE_MAX_RELS	16
+
+/* max number of cached advices per backend; the cache is flushed when full */
+#define ADVICE_CACHE_SIZE		1024
+
+/* a ttl for advice_cache_lookup(): the advice is kept until invalidated */
+#define ADVICE_CACHE_NO_EXPIRY	(-1)
+
+/*! \struct AdviceCacheEntry
+ * \brief the last advice given for a query fingerprint.
+ */
+typedef struct {
+	uint32		fingerprint;				/**< hash key - the query fingerprint */
+	TimestampTz	computed;					/**< when the advice was computed */
+	int			nadvice;					/**< number of indexes advised */
+	Cost		costSaved;					/**< total cost saved by the advice */
+	bool		sampled;					/**< advised on sampled bind values */
+	int			nrels;						/**< number of relations in relids */
+	Oid			relids[ADVICE_CACHE_MAX_RELS];	/**< relations the advice depends on */
+} AdviceCacheEntry;
+
+extern uint32 query_fingerprint( const Query* query, bool withConsts, List** relids,
+								 bool* externParams );
+extern AdviceCacheEntry* advice_cache_lookup( uint32 fingerprint, int ttl );
+extern void advice_cache_store( uint32 fingerprint, List* relids,
+								int nadvice, Cost costSaved, bool sampled );
+
+#endif   /* ADVICE_CACHE_H */
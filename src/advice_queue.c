@@ -0,0 +1,500 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file advice_queue.c
+ * \brief shared-memory queue of advice, drained by a background worker.
+ *
+ * With index_adviser.async on, the backends don't insert their advice into the
+ * advisory table themselves: they copy each advised index into a slot of a
+ * ring buffer in shared memory and carry on. A background worker connected to
+ * index_adviser.database drains the ring and inserts the advice in batches, in
+ * its own transactions. The advised query therefore doesn't pay for the insert,
+ * and advice is kept for read-only transactions too.
+ *
+ * Producers only hold the spinlock to reserve a slot; the slot is filled
+ * outside the lock and published with its ready flag. The worker is the only
+ * consumer.
+ *
+ * The queue needs the library in shared_preload_libraries (and PostgreSQL 9.3
+ * or later, for the background worker). When it's not there, when the queue
+ * is full or when the advised database is not the worker's, the advice is
+ * stored synchronously as before.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * includes (ordered alphabetically)
+ * ------------------------------------------------------------------------
+ */
+#include "advice_queue.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#if PG_VERSION_NUM >= 90300
+#include "postmaster/bgworker.h"
+#endif
+#include "storage/barrier.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+
+/* how long the worker sleeps when nobody wakes it up, in ms */
+#define ADVICE_QUEUE_NAPTIME	10000L
+
+/*! \struct AdviceQueueSlot
+ * \brief one queued advice.
+ */
+typedef struct {
+	volatile bool	ready;						/**< filled in by the producer */
+	AdviceRecord	record;						/**< the advice; the text pointers are not used */
+	char			text[ADVICE_QUEUE_TEXT_SIZE];	/**< indexprs, indpred, query and
+												 recommendation, each NUL terminated */
+} AdviceQueueSlot;
+
+/*! \struct AdviceQueue
+ * \brief the ring buffer, in shared memory.
+ */
+typedef struct {
+	slock_t			mutex;						/**< protects head, tail, dboid and latch */
+	uint64			head;						/**< next slot to reserve */
+	uint64			tail;						/**< next slot to drain */
+	uint64			dropped;					/**< advices not queued since the ring was full */
+	Oid				dboid;						/**< database of the worker, InvalidOid if not running */
+	Latch*			latch;						/**< the worker's latch */
+	int				nslots;						/**< number of slots */
+	AdviceQueueSlot	slots[FLEXIBLE_ARRAY_MEMBER];
+} AdviceQueue;
+
+/* GUCs */
+int		advice_queue_size = 256;
+char	*advice_queue_database = NULL;
+
+/*! the queue; NULL unless loaded with shared_preload_libraries */
+static AdviceQueue* adviceQueue = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size advice_queue_shmem_size( void );
+static void advice_queue_shmem_startup( void );
+
+#if PG_VERSION_NUM >= 90300
+void advice_queue_worker_main( Datum main_arg );
+
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+static void advice_queue_sighup( SIGNAL_ARGS );
+static void advice_queue_sigterm( SIGNAL_ARGS );
+static void advice_queue_detach( int code, Datum arg );
+static int advice_queue_peek( AdviceRecord* records, int max );
+static void advice_queue_release( int n );
+static void advice_queue_drain( void );
+#endif
+
+/**
+ * advice_queue_init
+ *    define the queue settings; when preloading, also reserve the shared memory
+ * and register the worker. Called from _PG_init().
+ */
+void advice_queue_init( void )
+{
+#if PG_VERSION_NUM >= 90300
+	BackgroundWorker	worker;
+#endif
+
+	DefineCustomIntVariable("index_adviser.queue_size",
+	   "number of advices the asynchronous advice queue can hold",
+							NULL,
+							&advice_queue_size,
+							256,
+							16,
+							65536,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomStringVariable("index_adviser.database",
+	   "database the advice writer connects to; only its advice is queued",
+							NULL,
+							&advice_queue_database,
+							"postgres",
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+#if PG_VERSION_NUM >= 90300
+	if( !process_shared_preload_libraries_in_progress )
+		return;
+
+	RequestAddinShmemSpace( advice_queue_shmem_size() );
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = advice_queue_shmem_startup;
+
+	memset( &worker, 0, sizeof(worker) );
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+#if PG_VERSION_NUM >= 90400
+	snprintf( worker.bgw_library_name, BGW_MAXLEN, "pg_idx_advisor" );
+	snprintf( worker.bgw_function_name, BGW_MAXLEN, "advice_queue_worker_main" );
+#else
+	worker.bgw_main = advice_queue_worker_main;
+#endif
+	snprintf( worker.bgw_name, BGW_MAXLEN, "pg_idx_advisor advice writer" );
+
+	RegisterBackgroundWorker( &worker );
+#endif
+}
+
+static Size advice_queue_shmem_size( void )
+{
+	return add_size( offsetof(AdviceQueue, slots),
+					 mul_size( advice_queue_size, sizeof(AdviceQueueSlot) ) );
+}
+
+static void advice_queue_shmem_startup( void )
+{
+	bool	found;
+
+	if( prev_shmem_startup_hook )
+		prev_shmem_startup_hook();
+
+	LWLockAcquire( AddinShmemInitLock, LW_EXCLUSIVE );
+
+	adviceQueue = ShmemInitStruct( "pg_idx_advisor advice queue",
+								   advice_queue_shmem_size(), &found );
+	if( !found )
+	{
+		int i;
+
+		SpinLockInit( &adviceQueue->mutex );
+		adviceQueue->head = 0;
+		adviceQueue->tail = 0;
+		adviceQueue->dropped = 0;
+		adviceQueue->dboid = InvalidOid;
+		adviceQueue->latch = NULL;
+		adviceQueue->nslots = advice_queue_size;
+
+		for( i = 0; i < adviceQueue->nslots; ++i )
+			adviceQueue->slots[i].ready = false;
+	}
+
+	LWLockRelease( AddinShmemInitLock );
+}
+
+/**
+ * advice_queue_available
+ *    can the advice of this backend be queued?
+ */
+bool advice_queue_available( void )
+{
+	return adviceQueue != NULL
+		&& OidIsValid( MyDatabaseId )
+		&& adviceQueue->dboid == MyDatabaseId;
+}
+
+/**
+ * advice_queue_push
+ *    queue an advice for the worker.
+ *
+ * Returns false if it could not be queued - the ring is full or the texts don't
+ * fit in a slot - and the caller has to store it by itself.
+ */
+bool advice_queue_push( const AdviceRecord* record )
+{
+	volatile AdviceQueue	*queue = adviceQueue;
+	AdviceQueueSlot			*slot;
+	Latch					*latch;
+	const char				*texts[4];
+	Size					lens[4];
+	Size					total = 0;
+	char					*p;
+	int						i;
+
+	if( queue == NULL )
+		return false;
+
+	texts[0] = record->indexprs;
+	texts[1] = record->indpred;
+	texts[2] = record->query;
+	texts[3] = record->recommendation;
+
+	for( i = 0; i < 4; ++i )
+	{
+		if( texts[i] == NULL )
+			texts[i] = "";
+		lens[i] = strlen( texts[i] ) + 1;
+		total += lens[i];
+	}
+
+	if( total > ADVICE_QUEUE_TEXT_SIZE )
+		return false;
+
+	/* reserve a slot */
+	SpinLockAcquire( &queue->mutex );
+
+	if( queue->head - queue->tail >= (uint64) queue->nslots )
+	{
+		++queue->dropped;
+		SpinLockRelease( &queue->mutex );
+		return false;
+	}
+
+	slot = (AdviceQueueSlot*) &queue->slots[ queue->head % queue->nslots ];
+	++queue->head;
+	latch = queue->latch;
+
+	SpinLockRelease( &queue->mutex );
+
+	/* fill it in and publish it */
+	memcpy( &slot->record, record, sizeof(AdviceRecord) );
+	slot->record.indexprs = slot->record.indpred = NULL;
+	slot->record.query = slot->record.recommendation = NULL;
+
+	p = slot->text;
+	for( i = 0; i < 4; ++i )
+	{
+		memcpy( p, texts[i], lens[i] );
+		p += lens[i];
+	}
+
+	pg_write_barrier();
+	slot->ready = true;
+
+	if( latch != NULL )
+		SetLatch( latch );
+
+	return true;
+}
+
+#if PG_VERSION_NUM >= 90300
+
+static void advice_queue_sighup( SIGNAL_ARGS )
+{
+	int	save_errno = errno;
+
+	got_sighup = true;
+	if( MyProc )
+		SetLatch( &MyProc->procLatch );
+
+	errno = save_errno;
+}
+
+static void advice_queue_sigterm( SIGNAL_ARGS )
+{
+	int	save_errno = errno;
+
+	got_sigterm = true;
+	if( MyProc )
+		SetLatch( &MyProc->procLatch );
+
+	errno = save_errno;
+}
+
+/* stop the backends from queueing advice nobody will drain */
+static void advice_queue_detach( int code, Datum arg )
+{
+	volatile AdviceQueue *queue = adviceQueue;
+
+	SpinLockAcquire( &queue->mutex );
+	queue->dboid = InvalidOid;
+	queue->latch = NULL;
+	SpinLockRelease( &queue->mutex );
+}
+
+/**
+ * advice_queue_peek
+ *    copy up to max ready advices from the ring, in order; they stay queued
+ * until advice_queue_release().
+ *
+ * The texts are copied into the current memory context.
+ */
+static int advice_queue_peek( AdviceRecord* records, int max )
+{
+	volatile AdviceQueue	*queue = adviceQueue;
+	uint64					tail, head;
+	int						n = 0;
+
+	SpinLockAcquire( &queue->mutex );
+	tail = queue->tail;
+	head = queue->head;
+	SpinLockRelease( &queue->mutex );
+
+	while( tail < head && n < max )
+	{
+		AdviceQueueSlot	*slot = (AdviceQueueSlot*) &queue->slots[ tail % queue->nslots ];
+		AdviceRecord	*rec = &records[n];
+		char			*p;
+
+		/* reserved, but not filled in yet */
+		if( !slot->ready )
+			break;
+
+		pg_read_barrier();
+
+		memcpy( rec, &slot->record, sizeof(AdviceRecord) );
+
+		p = slot->text;
+		rec->indexprs = pstrdup( p );
+		p += strlen( p ) + 1;
+		rec->indpred = pstrdup( p );
+		p += strlen( p ) + 1;
+		rec->query = pstrdup( p );
+		p += strlen( p ) + 1;
+		rec->recommendation = pstrdup( p );
+
+		++tail;
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * advice_queue_release
+ *    free the first n slots of the ring, once their advice was stored (or
+ * given up on).
+ */
+static void advice_queue_release( int n )
+{
+	volatile AdviceQueue	*queue = adviceQueue;
+	uint64					tail;
+	int						i;
+
+	/* we are the only consumer, nobody else moves the tail */
+	tail = queue->tail;
+
+	for( i = 0; i < n; ++i )
+		queue->slots[ (tail + i) % queue->nslots ].ready = false;
+
+	pg_write_barrier();
+
+	SpinLockAcquire( &queue->mutex );
+	queue->tail = tail + n;
+	SpinLockRelease( &queue->mutex );
+}
+
+/**
+ * advice_queue_drain
+ *    insert all the queued advice, a batch per transaction.
+ *
+ * A batch leaves the ring only once its transaction committed. If storing it
+ * fails (say the advisory table was dropped) the batch is logged and skipped,
+ * rather than letting the worker die and retry the same batch forever.
+ */
+static void advice_queue_drain( void )
+{
+	for(;;)
+	{
+		AdviceRecord	*records;
+		volatile int	n = 0;
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+
+		PG_TRY();
+		{
+			PushActiveSnapshot( GetTransactionSnapshot() );
+			pgstat_report_activity( STATE_RUNNING, "storing index advice" );
+
+			records = (AdviceRecord*) palloc( ADVICE_QUEUE_BATCH_SIZE * sizeof(AdviceRecord) );
+			n = advice_queue_peek( records, ADVICE_QUEUE_BATCH_SIZE );
+
+			if( n > 0 )
+				insert_advice_records( records, n );
+
+			PopActiveSnapshot();
+			CommitTransactionCommand();
+		}
+		PG_CATCH();
+		{
+			EmitErrorReport();
+			FlushErrorState();
+			AbortCurrentTransaction();
+
+			elog( LOG, "IND ADV: could not store %d queued advices; skipping them", n );
+		}
+		PG_END_TRY();
+
+		advice_queue_release( n );
+		pgstat_report_activity( STATE_IDLE, NULL );
+
+		if( n < ADVICE_QUEUE_BATCH_SIZE )
+			break;
+	}
+}
+
+/**
+ * advice_queue_worker_main
+ *    the advice writer: sleep until some advice is queued, then store it.
+ */
+void advice_queue_worker_main( Datum main_arg )
+{
+	volatile AdviceQueue *queue = adviceQueue;
+
+	pqsignal( SIGHUP, advice_queue_sighup );
+	pqsignal( SIGTERM, advice_queue_sigterm );
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection( advice_queue_database, NULL );
+
+	on_shmem_exit( advice_queue_detach, (Datum) 0 );
+
+	SpinLockAcquire( &queue->mutex );
+	queue->dboid = MyDatabaseId;
+	queue->latch = &MyProc->procLatch;
+	SpinLockRelease( &queue->mutex );
+
+	elog( LOG, "IND ADV: advice writer started on database \"%s\"", advice_queue_database );
+
+	while( !got_sigterm )
+	{
+		int rc;
+
+		rc = WaitLatch( &MyProc->procLatch,
+						WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						ADVICE_QUEUE_NAPTIME );
+		ResetLatch( &MyProc->procLatch );
+
+		if( rc & WL_POSTMASTER_DEATH )
+			proc_exit( 1 );
+
+		if( got_sighup )
+		{
+			got_sighup = false;
+			ProcessConfigFile( PGC_SIGHUP );
+		}
+
+		advice_queue_drain();
+
+		if( queue->dropped > 0 )
+		{
+			uint64 dropped;
+
+			SpinLockAcquire( &queue->mutex );
+			dropped = queue->dropped;
+			queue->dropped = 0;
+			SpinLockRelease( &queue->mutex );
+
+			elog( LOG, "IND ADV: advice queue was full " UINT64_FORMAT " times; consider raising index_adviser.queue_size",
+				  dropped );
+		}
+	}
+
+	/* don't lose what was queued before the shutdown */
+	advice_queue_drain();
+
+	proc_exit( 0 );
+}
+
+#endif   /* PG_VERSION_NUM >= 90300 */
@@ -0,0 +1,58 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file advice_queue.h
+ * \brief     Prototypes for advice_queue.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ADVICE_QUEUE_H
+#define ADVICE_QUEUE_H 1
+
+#include "postgres.h"
+
+#include "utils/timestamp.h"
+
+/* room for the texts (indexprs, indpred, query, recommendation) of a queued advice */
+#define ADVICE_QUEUE_TEXT_SIZE	4096
+
+/* max number of queued advices the worker inserts in one transaction */
+#define ADVICE_QUEUE_BATCH_SIZE	256
+
+/* the cost saved over the bind value samples: min, p50, p90 and max */
+#define ADVICE_SAMPLE_PERCENTILES	4
+
+/*! \struct AdviceRecord
+ * \brief one row of the advisory table.
+ */
+typedef struct {
+	Oid			reloid;							/**< the table oid */
+	int			ncols;							/**< number of index columns */
+	AttrNumber	attrs[INDEX_MAX_KEYS];			/**< attribute numbers, 0 for expressions */
+	Oid			indcollation[INDEX_MAX_KEYS];	/**< collation of the columns */
+	Oid			indclass[INDEX_MAX_KEYS];		/**< op class of the columns */
+	float4		benefit;						/**< share of the cost saved */
+	int32		index_size;						/**< estimated size, in KBs */
+	int32		backend_pid;					/**< the advised backend */
+	TimestampTz	timestamp;						/**< when the advice was given */
+	uint32		fingerprint;					/**< fingerprint of the advised query */
+	bool		sampled;						/**< advised on bind value samples */
+	float4		sampleCostSaved[ADVICE_SAMPLE_PERCENTILES];	/**< cost saved over the samples, if sampled */
+	char*		indexprs;						/**< nodeToString() of the expressions */
+	char*		indpred;						/**< nodeToString() of the predicate */
+	char*		query;							/**< the advised query */
+	char*		recommendation;					/**< the CREATE INDEX statement */
+} AdviceRecord;
+
+/* GUCs */
+extern int	advice_queue_size;
+extern char	*advice_queue_database;
+
+extern void advice_queue_init( void );
+extern bool advice_queue_available( void );
+extern bool advice_queue_push( const AdviceRecord* record );
+
+/* provided by idx_adviser.c; inserts the records into the advisory table */
+extern void insert_advice_records( const AdviceRecord* records, int nrecords );
+
+#endif   /* ADVICE_QUEUE_H */
@@ -0,0 +1,414 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file gin_cost.c
+ * \brief GIN cost estimation for the virtual GIN indexes.
+ *
+ * gincostestimate() takes the size of the entry tree, of the posting trees and
+ * the number of distinct keys from the index metapage (ginGetStats()), which a
+ * virtual index doesn't have. index_adviser_gincostestimate() is the same cost
+ * model, fed with the statistics estimate_index_pages() has made up for the
+ * candidate from pg_statistic instead.
+ *
+ * The planner calls an amcostestimate by its pg_proc oid, so the function must
+ * be created in the database (it is part of the extension). Where it's not,
+ * the adviser costs GIN candidates as GiST ones, as before.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * includes (ordered alphabetically)
+ * ------------------------------------------------------------------------
+ */
+#include "gin_cost.h"
+
+#include <math.h>
+
+#include "access/gin.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "nodes/relation.h"
+#include "nodes/value.h"
+#include "optimizer/clauses.h"
+#include "optimizer/cost.h"
+#include "optimizer/paths.h"
+#include "optimizer/predtest.h"
+#include "parser/parse_func.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/spccache.h"
+
+/*! \struct GinCostCounts
+ * \brief the entries the index quals search for, see gincostestimate().
+ */
+typedef struct {
+	bool		haveFullScan;		/**< a qual needs the whole index */
+	double		partialEntries;		/**< entries matched partially (prefixes) */
+	double		exactEntries;		/**< entries matched exactly */
+	double		searchEntries;		/**< entries looked up in the entry tree */
+	double		arrayScans;			/**< index scans made for = ANY(array) quals */
+} GinCostCounts;
+
+static bool gin_cost_pattern( IndexOptInfo* index, int indexcol, Oid clause_op,
+				Datum query, GinCostCounts* counts );
+static bool gin_cost_opexpr( IndexOptInfo* index, OpExpr* clause, int indexcol,
+				GinCostCounts* counts );
+static bool gin_cost_scalararrayopexpr( IndexOptInfo* index, ScalarArrayOpExpr* clause,
+				int indexcol, double numIndexEntries, GinCostCounts* counts );
+
+PG_FUNCTION_INFO_V1( index_adviser_gincostestimate );
+
+/**
+ * gin_cost_estimate_oid
+ *    the oid of index_adviser_gincostestimate(), in the extension's schema;
+ * InvalidOid if the extension isn't created in this database.
+ */
+Oid gin_cost_estimate_oid( void )
+{
+	Oid		extoid = get_extension_oid( "pg_idx_advisor", true );
+	Oid		argtypes[ 7 ];
+	char	*schema;
+	int		i;
+
+	if( !OidIsValid( extoid ) )
+		return InvalidOid;
+
+	schema = get_namespace_name( get_extension_schema( extoid ) );
+	if( schema == NULL )
+		return InvalidOid;
+
+	for( i = 0; i < 7; ++i )
+		argtypes[ i ] = INTERNALOID;
+
+	return LookupFuncName( list_make2( makeString( schema ), makeString( GIN_COST_FUNCTION ) ),
+						   7, argtypes, true );
+}
+
+/**
+ * gin_cost_pattern
+ *    counts the entries the opclass' extractQuery() makes of the query value.
+ * Returns false if the qual can't match anything.
+ */
+static bool gin_cost_pattern( IndexOptInfo* index, int indexcol, Oid clause_op,
+				Datum query, GinCostCounts* counts )
+{
+	Oid			extractProcOid;
+	Oid			collation;
+	int			strategy_op;
+	Oid			lefttype,
+				righttype;
+	int32		nentries = 0;
+	bool		*partial_matches = NULL;
+	Pointer		*extra_data = NULL;
+	bool		*nullFlags = NULL;
+	int32		searchMode = GIN_SEARCH_MODE_DEFAULT;
+	int32		i;
+
+	get_op_opfamily_properties( clause_op, index->opfamily[ indexcol ], false,
+								&strategy_op, &lefttype, &righttype );
+
+	extractProcOid = get_opfamily_proc( index->opfamily[ indexcol ],
+										index->opcintype[ indexcol ],
+										index->opcintype[ indexcol ],
+										GIN_EXTRACTQUERY_PROC );
+	if( !OidIsValid( extractProcOid ) )
+		elog( ERROR, "missing support function %d for attribute %d of index \"%u\"",
+			  GIN_EXTRACTQUERY_PROC, indexcol + 1, index->indexoid );
+
+	collation = OidIsValid( index->indexcollations[ indexcol ] )
+					? index->indexcollations[ indexcol ] : DEFAULT_COLLATION_OID;
+
+	OidFunctionCall7Coll( extractProcOid, collation, query,
+						  PointerGetDatum( &nentries ),
+						  UInt16GetDatum( strategy_op ),
+						  PointerGetDatum( &extra_data ),
+						  PointerGetDatum( &partial_matches ),
+						  PointerGetDatum( &nullFlags ),
+						  PointerGetDatum( &searchMode ) );
+
+	if( nentries <= 0 && searchMode == GIN_SEARCH_MODE_DEFAULT )
+		return false;
+
+	for( i = 0; i < nentries; ++i )
+	{
+		if( partial_matches && partial_matches[ i ] )
+			counts->partialEntries++;
+		else
+			counts->exactEntries++;
+
+		counts->searchEntries++;
+	}
+
+	if( searchMode == GIN_SEARCH_MODE_INCLUDE_EMPTY )
+	{
+		/* the empty-item entry is searched too */
+		counts->exactEntries++;
+		counts->searchEntries++;
+	}
+	else if( searchMode != GIN_SEARCH_MODE_DEFAULT )
+		counts->haveFullScan = true;
+
+	return true;
+}
+
+/**
+ * gin_cost_opexpr
+ *    counts the entries of an "indexkey op value" qual.
+ */
+static bool gin_cost_opexpr( IndexOptInfo* index, OpExpr* clause, int indexcol,
+				GinCostCounts* counts )
+{
+	Node	*leftop = get_leftop( (Expr*) clause );
+	Node	*rightop = get_rightop( (Expr*) clause );
+	Oid		clause_op = clause->opno;
+	Node	*operand;
+
+	if( match_index_to_operand( leftop, indexcol, index ) )
+		operand = rightop;
+	else if( match_index_to_operand( rightop, indexcol, index ) )
+	{
+		operand = leftop;
+		clause_op = get_commutator( clause_op );
+	}
+	else
+		elog( ERROR, "could not match index to operand" );
+
+	if( IsA( operand, RelabelType ) )
+		operand = (Node*) ((RelabelType*) operand)->arg;
+
+	/* not a constant: assume one exact entry */
+	if( !IsA( operand, Const ) )
+	{
+		counts->exactEntries++;
+		counts->searchEntries++;
+		return true;
+	}
+
+	if( ((Const*) operand)->constisnull )
+		return false;
+
+	return gin_cost_pattern( index, indexcol, clause_op,
+							 ((Const*) operand)->constvalue, counts );
+}
+
+/**
+ * gin_cost_scalararrayopexpr
+ *    counts the entries of an "indexkey op ANY (array)" qual: one index scan
+ * per array element, each with the average entries of the elements.
+ */
+static bool gin_cost_scalararrayopexpr( IndexOptInfo* index, ScalarArrayOpExpr* clause,
+				int indexcol, double numIndexEntries, GinCostCounts* counts )
+{
+	Node		*rightop = (Node*) lsecond( clause->args );
+	ArrayType	*arrayval;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	int			numElems;
+	Datum		*elemValues;
+	bool		*elemNulls;
+	GinCostCounts arraycounts;
+	int			numPossible = 0;
+	int			i;
+
+	if( IsA( rightop, RelabelType ) )
+		rightop = (Node*) ((RelabelType*) rightop)->arg;
+
+	/* not a constant: assume one exact entry */
+	if( !IsA( rightop, Const ) )
+	{
+		counts->exactEntries++;
+		counts->searchEntries++;
+		return true;
+	}
+
+	if( ((Const*) rightop)->constisnull )
+		return false;
+
+	arrayval = DatumGetArrayTypeP( ((Const*) rightop)->constvalue );
+	get_typlenbyvalalign( ARR_ELEMTYPE( arrayval ), &elmlen, &elmbyval, &elmalign );
+	deconstruct_array( arrayval, ARR_ELEMTYPE( arrayval ), elmlen, elmbyval, elmalign,
+					   &elemValues, &elemNulls, &numElems );
+
+	memset( &arraycounts, 0, sizeof(arraycounts) );
+
+	for( i = 0; i < numElems; ++i )
+	{
+		GinCostCounts elemcounts;
+
+		if( elemNulls[ i ] )
+			continue;
+
+		memset( &elemcounts, 0, sizeof(elemcounts) );
+		if( !gin_cost_pattern( index, indexcol, clause->opno, elemValues[ i ], &elemcounts ) )
+			continue;
+
+		/* a full scan finds everything, so it costs as one over all entries */
+		if( elemcounts.haveFullScan )
+		{
+			elemcounts.partialEntries = 0;
+			elemcounts.exactEntries = numIndexEntries;
+			elemcounts.searchEntries = numIndexEntries;
+		}
+
+		arraycounts.partialEntries += elemcounts.partialEntries;
+		arraycounts.exactEntries += elemcounts.exactEntries;
+		arraycounts.searchEntries += elemcounts.searchEntries;
+		++numPossible;
+	}
+
+	if( numPossible == 0 )
+		return false;
+
+	counts->partialEntries += arraycounts.partialEntries / numPossible;
+	counts->exactEntries += arraycounts.exactEntries / numPossible;
+	counts->searchEntries += arraycounts.searchEntries / numPossible;
+	counts->arrayScans *= numPossible;
+
+	return true;
+}
+
+/**
+ * index_adviser_gincostestimate
+ *    the amcostestimate of the virtual GIN indexes; gincostestimate() with
+ * VirtualGinStats in place of the metapage statistics.
+ */
+Datum index_adviser_gincostestimate( PG_FUNCTION_ARGS )
+{
+	PlannerInfo	*root = (PlannerInfo*) PG_GETARG_POINTER( 0 );
+	IndexPath	*path = (IndexPath*) PG_GETARG_POINTER( 1 );
+	double		loop_count = PG_GETARG_FLOAT8( 2 );
+	Cost		*indexStartupCost = (Cost*) PG_GETARG_POINTER( 3 );
+	Cost		*indexTotalCost = (Cost*) PG_GETARG_POINTER( 4 );
+	Selectivity	*indexSelectivity = (Selectivity*) PG_GETARG_POINTER( 5 );
+	double		*indexCorrelation = (double*) PG_GETARG_POINTER( 6 );
+	IndexOptInfo *index = path->indexinfo;
+	List		*indexQuals = path->indexquals;
+	List		*indexOrderBys = path->indexorderbys;
+	List		*selectivityQuals;
+	ListCell	*l;
+	ListCell	*l2;
+	VirtualGinStats	stats;
+	GinCostCounts	counts;
+	bool		matchPossible = true;
+	double		numTuples = index->rel->tuples;
+	double		numEntryPages,
+				numDataPages,
+				numEntries,
+				numPages = index->pages;
+	double		partialScale,
+				entryPagesFetched,
+				dataPagesFetched,
+				dataPagesFetchedBySel;
+	double		qual_op_cost;
+	double		spc_random_page_cost;
+	double		outer_scans;
+
+	/* a real index: the real thing */
+	if( !virtual_gin_stats( index->indexoid, &stats ) )
+		return gincostestimate( fcinfo );
+
+	numEntryPages = Max( stats.nEntryPages, 1 );
+	numDataPages = stats.nDataPages;
+	numEntries = Max( stats.nEntries, 1 );
+
+	/* the partial index predicate counts, as in genericcostestimate() */
+	selectivityQuals = NIL;
+	foreach( l, index->indpred )
+	{
+		List *oneQual = list_make1( lfirst( l ) );
+
+		if( !predicate_implied_by( oneQual, indexQuals ) )
+			selectivityQuals = list_concat( selectivityQuals, oneQual );
+	}
+	selectivityQuals = list_concat( selectivityQuals, list_copy( indexQuals ) );
+
+	*indexSelectivity = clauselist_selectivity( root, selectivityQuals,
+												index->rel->relid, JOIN_INNER, NULL );
+	*indexCorrelation = 0;
+
+	/* the entries the quals search for */
+	memset( &counts, 0, sizeof(counts) );
+	counts.arrayScans = 1;
+
+	forboth( l, indexQuals, l2, path->indexqualcols )
+	{
+		RestrictInfo	*rinfo = (RestrictInfo*) lfirst( l );
+		Expr			*clause = rinfo->clause;
+		int				indexcol = lfirst_int( l2 );
+
+		if( IsA( clause, OpExpr ) )
+			matchPossible = gin_cost_opexpr( index, (OpExpr*) clause, indexcol, &counts );
+		else if( IsA( clause, ScalarArrayOpExpr ) )
+			matchPossible = gin_cost_scalararrayopexpr( index, (ScalarArrayOpExpr*) clause,
+														indexcol, numEntries, &counts );
+		else
+			elog( ERROR, "unsupported GIN indexqual type: %d", (int) nodeTag( clause ) );
+
+		if( !matchPossible )
+			break;
+	}
+
+	/* no match possible: the scan is free */
+	if( !matchPossible )
+	{
+		*indexStartupCost = 0;
+		*indexTotalCost = 0;
+		*indexSelectivity = 0;
+		PG_RETURN_VOID();
+	}
+
+	if( counts.haveFullScan || indexQuals == NIL )
+	{
+		counts.partialEntries = 0;
+		counts.exactEntries = numEntries;
+		counts.searchEntries = numEntries;
+	}
+
+	get_tablespace_page_costs( index->reltablespace, &spc_random_page_cost, NULL );
+
+	outer_scans = loop_count * counts.arrayScans;
+
+	/* the partial matches read their share of both trees up front */
+	partialScale = Min( counts.partialEntries / numEntries, 1.0 );
+	entryPagesFetched = ceil( numEntryPages * partialScale );
+	dataPagesFetched = ceil( numDataPages * partialScale );
+
+	/* every searched entry descends the entry tree */
+	entryPagesFetched += ceil( counts.searchEntries * rint( pow( numEntryPages, 0.15 ) ) );
+
+	if( outer_scans > 1 )
+	{
+		entryPagesFetched = index_pages_fetched( entryPagesFetched * outer_scans,
+												 (BlockNumber) numPages,
+												 numPages, root ) / outer_scans;
+		dataPagesFetched = index_pages_fetched( dataPagesFetched * outer_scans,
+												(BlockNumber) numPages,
+												numPages, root ) / outer_scans;
+	}
+
+	*indexStartupCost = ( entryPagesFetched + dataPagesFetched ) * spc_random_page_cost;
+
+	/* the posting lists of the exact entries; at least as many as selected */
+	dataPagesFetched = ceil( numDataPages * counts.exactEntries / numEntries );
+	dataPagesFetchedBySel = ceil( *indexSelectivity * ( numTuples / ( BLCKSZ / 3 ) ) );
+	if( dataPagesFetchedBySel > dataPagesFetched )
+		dataPagesFetched = dataPagesFetchedBySel;
+
+	if( outer_scans > 1 )
+		dataPagesFetched = index_pages_fetched( dataPagesFetched * outer_scans,
+												(BlockNumber) numPages,
+												numPages, root ) / outer_scans;
+
+	*indexTotalCost = *indexStartupCost + dataPagesFetched * spc_random_page_cost;
+
+	/* the quals are checked for each tuple, as in genericcostestimate() */
+	qual_op_cost = cpu_operator_cost
+					* ( list_length( indexQuals ) + list_length( indexOrderBys ) );
+	*indexTotalCost += ( numTuples * *indexSelectivity )
+						* ( cpu_index_tuple_cost + qual_op_cost );
+
+	PG_RETURN_VOID();
+}
@@ -0,0 +1,34 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file gin_cost.h
+ * \brief     Prototypes for gin_cost.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef GIN_COST_H
+#define GIN_COST_H 1
+
+#include "postgres.h"
+
+#include "fmgr.h"
+
+/* the SQL name of index_adviser_gincostestimate(), see gin_cost_estimate_oid() */
+#define GIN_COST_FUNCTION	"index_adviser_gincostestimate"
+
+/*! \struct VirtualGinStats
+ * \brief what ginGetStats() would read from the metapage of a virtual GIN index.
+ */
+typedef struct {
+	double		nEntryPages;		/**< pages of the entry tree */
+	double		nDataPages;			/**< pages of the posting lists/trees */
+	double		nEntries;			/**< distinct keys */
+} VirtualGinStats;
+
+extern Datum index_adviser_gincostestimate( PG_FUNCTION_ARGS );
+extern Oid gin_cost_estimate_oid( void );
+
+/* provided by idx_adviser.c; the synthetic statistics of a virtual GIN index */
+extern bool virtual_gin_stats( Oid indexoid, VirtualGinStats* stats );
+
+#endif   /* GIN_COST_H */
@@ -29,26 +29,47 @@
 
 #include "postgres.h"
 
+#include <math.h>
+
 #include "access/genam.h"
+#include "access/gin_private.h"
+#include "access/gist_private.h"
+#include "access/hash.h"
 #include "access/heapam.h"
 #include "access/itup.h"
 #include "access/nbtree.h"
+#include "access/sysattr.h"
+#include "access/transam.h"
 #include "access/xact.h"
+#include "access/xlog.h"
+#if PG_VERSION_NUM >= 90500
+#include "access/brin.h"
+#include "access/brin_page.h"
+#endif
+#include "advice_cache.h"
+#include "advice_queue.h"
 #include "idx_adviser.h"
+#include "param_sample.h"
 #include "catalog/catalog.h"
 #include "catalog/index.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
 #include "executor/execdesc.h"
 #include "executor/spi.h"
 #include "fmgr.h"									   /* for PG_MODULE_MAGIC */
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/pg_list.h"
 #include "nodes/print.h"
 #include "optimizer/planner.h"
 #include "optimizer/plancat.h"
+#include "optimizer/var.h"
 #include "parser/parse_coerce.h"
 #include "parser/parsetree.h"
 #include "storage/lmgr.h"
@@ -56,16 +77,26 @@
 #include "tcop/dest.h"
 #include "tcop/tcopprot.h"
 #include "utils.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/relcache.h"
 #include "utils/syscache.h"
 #include "utils/selfuncs.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 
 /* mark this dynamic library to be compatible with PG as of PG 8.2 */
 PG_MODULE_MAGIC;
 
+PG_FUNCTION_INFO_V1( index_advise_workload );
+
 /* *****************************************************************************
  * Function Declarations
  * ****************************************************************************/
@@ -89,27 +120,44 @@ static List* scan_targetList(   List* const targetList,
                                 List* const rangeTableStack );
 
 
-static List* build_composite_candidates( List* l1, List* l2 );
+static List* build_composite_candidates( List* columns );
+#if PG_VERSION_NUM >= 90200
+static List* build_covering_candidates( const Query* query, List* candidates );
+#endif
+static bool clause_is_equality( const Node* clause );
+static bool get_column_stats( Oid relid, AttrNumber attno, ColumnStats* stats );
+static double column_n_distinct( Oid relid, AttrNumber attno );
+static int composite_column_cmp( const void* a, const void* b );
+#if PG_VERSION_NUM >= 90500
+static bool is_range_operator( Oid opno );
+static float4 column_correlation( Oid relid, AttrNumber attno );
+static List* build_brin_candidates( List* candidates );
+#endif
+static int composite_ordering_cmp( const void* a, const void* b );
 
 static List* remove_irrelevant_candidates( List* candidates );
 static void tag_and_remove_candidates(Cost startupCostSaved,
 				  Cost totalCostSaved,
 				  PlannedStmt *new_plan,
-				  const Node* const head,
 				  List* const candidates);
-static void mark_used_candidates(	const Node* const plan,
+static void mark_used_candidates(	const PlannedStmt* const stmt,
 					List* const candidates );
+static void collect_used_indexes(	const Plan* const plan,
+					Bitmapset** used );
 
 static int compare_candidates(	const IndexCandidate* c1,
 				const IndexCandidate* c2 );
 
 static List* merge_candidates( List* l1, List* l2 );
+static List* unique_candidates( List* candidates );
+static IndexCandidateCols* make_candidate_cols( int ncols );
+static void candidate_key( const IndexCandidate* cand, CandidateKey* key );
+static int candidate_qsort_cmp( const void* a, const void* b );
 static List* expand_inherited_candidates(List* list1);
 static void expand_inherited_rel_clauses();
 
 
 static List* create_virtual_indexes( List* candidates );
-static void drop_virtual_indexes( List* candidates );
 
 static List* get_rel_clauses(List* table_clauses, Oid reloid, char* erefAlias);
 static ListCell* get_rel_clausesCell(List* table_clauses, Oid reloid, char* erefAlias);
@@ -117,12 +165,33 @@ static Expr* makePredicateClause(OpExpr* root,Const* constArg, Var* VarArg);
 static List *build_index_tlist(PlannerInfo *root, IndexOptInfo *index,
                                   Relation heapRelation);
 
-static void store_idx_advice( List* candidates, ExplainState * 	es );
+static PlannedStmt* plan_candidates( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, List* candidates );
+static PlannedStmt* greedy_candidate_search( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, Cost actualTotalCost, List* candidates );
+static int candidate_seed_cmp( const void* a, const void* b );
+static void measure_marginal_benefits( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, Cost newTotalCost, List* candidates );
+static void store_idx_advice( List* candidates, ExplainState * 	es, uint32 fingerprint );
+static char* index_recommendation( const IndexCandidate* idxcd, List** rel_clauses );
+static int32 index_size_kb( const IndexCandidate* idxcd );
+static void free_advice_record( AdviceRecord* rec );
+static void workload_result_row( Tuplestorestate* tupstore, TupleDesc tupdesc,
+				int queryNo, const IndexCandidate* cand, double benefit );
+static SPIPlanPtr prepare_advice_insert( void );
+static Datum int_list_text( const Oid* values, int n );
 
 static void log_candidates( const char* text, List* candidates );
 
 /* function used for estimating the size of virtual indexes */
-static BlockNumber estimate_index_pages(Oid rel_oid, Oid ind_oid );
+static BlockNumber estimate_index_pages( const RelOptInfo* rel, IndexCandidate* cand,
+				double tuples, int* tree_height );
+#if PG_VERSION_NUM >= 90200
+static double gin_column_keys( Oid relid, AttrNumber attno, double tuples, double* items );
+#endif
+static bool set_varno_walker( Node *node, Index *varno );
+static Selectivity predicate_selectivity( PlannerInfo* root, RelOptInfo* rel,
+				const IndexCandidate* cand, List* indpred );
 
 static PlannedStmt* planner_callback(	Query*			query,
 					int				cursorOptions,
@@ -148,7 +217,19 @@ static PlannedStmt* index_adviser(	Query*			query,
 					bool			doingExplain);
 
 static void resetSecondaryHooks(void);
+static OpnosContext* get_supported_operators(void);
+static void operator_cache_callback(Datum arg, int cacheid, uint32 hashvalue);
+static bool check_partial_columns(char **newval, void **extra, GucSource source);
+static void assign_partial_columns(const char *newval, void *extra);
+static bool is_partial_column(Oid relid, AttrNumber attno);
+static void partial_columns_relcache_callback(Datum arg, Oid relid);
+static void partial_columns_reset(void);
+static bool sample_statement(void);
+static void advise_on_param_samples( const Query* query, int cursorOptions,
+					ParamListInfo* samples, int nsamples );
+static int sample_cost_cmp( const void* a, const void* b );
 static bool is_virtual_index( Oid oid, IndexCandidate** cand_out );
+static void free_index_candidates( void );
 
 /* ------------------------------------------------------------------------
  * Global Parameters
@@ -157,9 +238,29 @@ static bool is_virtual_index( Oid oid, IndexCandidate** cand_out );
 
 /*! global list of index candidates. */
 static List* index_candidates;
+
+/*! virtual index oid -> IndexCandidate, for the members of index_candidates */
+static HTAB* virtual_indexes = NULL;
 /* Need this to store the predicate for the partial indexes. */
 //static QueryContext* context;
 
+/*! The operators the index advisor supports, looked up once per backend */
+static char *SupportedOps[] = { "=", "<", ">", "<=", ">=", "~~", }; /* Added support for LIKE ~~ */
+static char *SupportedGistOps[] = { "<<", "&<", "&>", ">>", "<<|", "&<|", "|&>", "|>>", "@>", "<@", "~=", "&&", };
+static char *SupportedGinOps[] = { "<@", "@>", "=", "&&", };
+
+static OpnosContext* supportedOpnos = NULL;
+static bool supportedOpnosValid = false;
+
+/*! index_adviser.cols, parsed by check_partial_columns() */
+static PartialColumns* partialColumns = NULL;
+
+/*! index_adviser.cols resolved to attnums, per relation */
+static HTAB* partialColumnsByRel = NULL;
+
+/*! holds partialColumnsByRel and its attnum bitmaps */
+static MemoryContext partialColumnsContext = NULL;
+
 /*! Need this to store table clauses until they are filled in the candidates*/
 static List* table_clauses;
 
@@ -169,10 +270,51 @@ static bool idxadv_text_pattern_ops;
 static char *idxadv_columns;
 static char *idxadv_schema;
 static int	idxadv_composit_max_cols;
+static int	idxadv_composite_orderings;
+static double idxadv_brin_correlation;
+static int	idxadv_covering_max_cols;
+static int	idxadv_sample_rate;
+static int	idxadv_max_per_second;
+static int	idxadv_cache_ttl;
+static bool	idxadv_plan_cache;
+static int	idxadv_param_samples;
+static bool	idxadv_async;
+static bool	idxadv_aggregate;
+static bool	idxadv_marginal_benefit;
+static int	idxadv_search;
+static int	idxadv_max_replans;
+
+/*! index_adviser.search values */
+#define IDXADV_SEARCH_ALL		0
+#define IDXADV_SEARCH_GREEDY	1
+
+static const struct config_enum_entry search_options[] = {
+	{ "all", IDXADV_SEARCH_ALL, false },
+	{ "greedy", IDXADV_SEARCH_GREEDY, false },
+	{ NULL, 0, false }
+};
+
+/*! index_adviser_gincostestimate(), looked up once per advisement */
+static Oid	ginCostEstimateOid = InvalidOid;
+static bool	ginCostEstimateChecked = false;
+
+/*! State of the planner_callback() sampling gate */
+static uint64		sampleStatementCount = 0;
+static TimestampTz	sampleWindowStart = 0;
+static int			sampleWindowCount = 0;
+
+/*! Summary of the last advisement, kept in the advice cache */
+static int	lastAdviceCount;
+static Cost	lastAdviceCostSaved;
+
+/*! advise_on_param_samples() only measures the cost saved; nothing is stored */
+static bool	adviceMeasureOnly = false;
+
+/*! the cost saved over the bind value samples, stored with their advice */
+static bool		adviceSampled = false;
+static float4	adviceSampleCostSaved[ ADVICE_SAMPLE_PERCENTILES ];
 
 
-/*! Global variable to hold a value across calls to mark_used_candidates() */
-static PlannedStmt* plannedStmtGlobal;
 //static char *envVar;
 
 
@@ -197,9 +339,9 @@ void _PG_init(void)
 							&idxadv_columns,
 							"entity_type_id,is_deleted",
 							PGC_SUSET,
-							0,
-							NULL,
-							NULL,
+							GUC_LIST_INPUT,
+							check_partial_columns,
+							assign_partial_columns,
 							NULL);
 	DefineCustomStringVariable("index_adviser.schema",
 		"index advisory recommendation schema",
@@ -222,6 +364,85 @@ void _PG_init(void)
 							NULL,
 							NULL,
 							NULL);
+	DefineCustomIntVariable("index_adviser.sample_rate",
+	   "advise on one in every N planned statements (0 disables the planner hook advice)",
+							NULL,
+							&idxadv_sample_rate,
+							1,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.max_per_second",
+	   "max number of planner hook advisements per second per backend (0 is unlimited)",
+							NULL,
+							&idxadv_max_per_second,
+							0,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.cache_ttl",
+	   "seconds the planner hook skips re-advising an identical statement (0 disables the cache)",
+							NULL,
+							&idxadv_cache_ttl,
+							0,
+							0,
+							INT_MAX / 1000,
+							PGC_SUSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomBoolVariable("index_adviser.plan_cache",
+	   "advise once per prepared statement (query tree), until a relation it reads changes",
+							NULL,
+							&idxadv_plan_cache,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.param_samples",
+	   "bind values kept per parameterized statement to advise its generic plan on (0 disables)",
+							NULL,
+							&idxadv_param_samples,
+							0,
+							0,
+							PARAM_SAMPLE_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomBoolVariable("index_adviser.async",
+	   "queue the advice for the advice writer worker instead of inserting it in the advised query",
+							NULL,
+							&idxadv_async,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomBoolVariable("index_adviser.aggregate",
+	   "store the advice aggregated per recommended index instead of a row per advice",
+							NULL,
+							&idxadv_aggregate,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	advice_queue_init();
 	elog(DEBUG1,"IND ADV: load parameters");
 	DefineCustomBoolVariable("index_adviser.text_pattern_ops",
 	   "allows creation of text indexes with text_pattern_ops",
@@ -245,6 +466,75 @@ void _PG_init(void)
 							NULL,
 							NULL,
 							NULL);
+	DefineCustomEnumVariable("index_adviser.search",
+	   "how the candidates are offered to the planner: all at once, or greedily a few at a time",
+							NULL,
+							&idxadv_search,
+							IDXADV_SEARCH_ALL,
+							search_options,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.max_replans",
+	   "max number of re-plans of a statement when index_adviser.search = greedy",
+							NULL,
+							&idxadv_max_replans,
+							32,
+							1,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomBoolVariable("index_adviser.marginal_benefit",
+	   "credit each used index with the cost its removal adds, instead of a share of the saving by size",
+							NULL,
+							&idxadv_marginal_benefit,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomRealVariable("index_adviser.brin_correlation",
+	   "min correlation of a range predicate column's values with the physical row order for a BRIN candidate (0 disables BRIN candidates).",
+							NULL,
+							&idxadv_brin_correlation,
+							0.9,
+							0.0,
+							1.0,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.covering_max_cols",
+							"max number of columns of a candidate extended by the other columns the query reads, for index-only scans (0 disables them).",
+							NULL,
+							&idxadv_covering_max_cols,
+							4,
+							0,
+							INDEX_MAX_KEYS,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+	DefineCustomIntVariable("index_adviser.composite_orderings",
+							"max number of composite index column orderings tried per table and AND clause (0 disables composite indexes).",
+							NULL,
+							&idxadv_composite_orderings,
+							3,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
 
 	elog(DEBUG1,"IND ADV: loaded parameters");
 	/* Install hookds. */
@@ -310,7 +600,7 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	int			i;
 	ListCell	*cell;
 	List*		candidates = NIL;	/* the resulting candidates */
-        OpnosContext *context;			/* contains all valid operator-ids */
+	OpnosContext *context;			/* contains all valid operator-ids */
 
 	Cost		actualStartupCost;
 	Cost		actualTotalCost;
@@ -321,15 +611,12 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	float4		startupGainPerc;	/* in percentages */
 	float4		totalGainPerc;
 
-	ResourceOwner	oldResourceOwner;
 	PlannedStmt		*new_plan;
 	MemoryContext	outerContext;
+	MemoryContext	planContext;
+	uint32			fingerprint = 0;
 
 
-	char *SupportedOps[] = { "=", "<", ">", "<=", ">=", "~~", }; /* Added support for LIKE ~~ */
-	char *SupportedGistOps[] = { "<<", "&<", "&>", ">>", "<<|", "&<|", "|&>", "|>>", "@>", "<@", "~=", "&&", }; 
-	char *SupportedGinOps[] = { "<@", "@>", "=", "&&", }; 
-
 	elog( DEBUG3, "IND ADV: Entering" );
 
 
@@ -347,7 +634,11 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 
 	/* reset these globals; since an ERROR might have left them unclean */
 	index_candidates = NIL;
+	virtual_indexes = NULL;
 	table_clauses = NIL;
+	lastAdviceCount = 0;
+	lastAdviceCostSaved = 0;
+	ginCostEstimateChecked = false;
 
 
 	/* get the costs without any virtual index */
@@ -355,24 +646,19 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	actualTotalCost		= actual_plan->planTree->total_cost;
 	elog( DEBUG2 , "IND ADV: actual plan costs: %lf .. %lf",actualStartupCost,actualTotalCost);
 
-	/* create list containing all operators supported by the index advisor */
-        context = (OpnosContext*)palloc(sizeof(OpnosContext));
-        context->opnos = NIL;    
-        context->ginopnos = NIL; 
-        context->gistopnos = NIL;
-	context->opnos = create_operator_list(SupportedOps, lengthof(SupportedOps)) ;
-	context->ginopnos = create_operator_list(SupportedGinOps, lengthof(SupportedGinOps)) ;
-	context->gistopnos = create_operator_list(SupportedGistOps, lengthof(SupportedGistOps)) ;
+	/* the aggregated advisory refers to the query by its fingerprint */
+	if( idxadv_aggregate )
+		fingerprint = query_fingerprint( queryCopy, false, NULL, NULL );
+
+	/* get the operators supported by the index advisor */
+	context = get_supported_operators();
 
 	elog( DEBUG3, "IND ADV: Generate index candidates" );
 	/* Generate index candidates */
 	candidates = scan_query( queryCopy, context, NULL );
 
-	/* the list of operator oids isn't needed anymore */
-	list_free( context->opnos );
-	list_free( context->ginopnos );
-	list_free( context->gistopnos );
-        pfree(context);
+	/* drop the duplicates, and sort the candidates by relation */
+	candidates = unique_candidates( candidates );
 
 	if (list_length(candidates) == 0)
 		goto DoneCleanly;
@@ -386,52 +672,34 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 		goto DoneCleanly;
 
 	log_candidates( "Relevant candidates", candidates );
-	/*
-	 * We need to restore the resource-owner after RARCST(), only if we are
-	 * called from the executor; but we do it all the time because,
-	 * (1) Its difficult to determine if we are being called by the executor.
-	 * (2) It is harmless.
-	 * (3) It is not much of an overhead!
-	 */
-	oldResourceOwner = CurrentResourceOwner;
-
-	/*
-	 * Setup an SPI frame around the BeginInternalSubTransaction() and
-	 * RollbackAndReleaseCurrentSubTransaction(), since xact.c assumes that
-	 * BIST()/RARCST() infrastructure is used only by PL/ interpreters (like
-	 * pl/pgsql), and hence it calls AtEOSubXact_SPI(), and that in turn frees
-	 * all the execution context memory of the SPI (which _may_ have invoked the
-	 * adviser). By setting up our own SPI frame here, we make sure that
-	 * AtEOSubXact_SPI() frees this frame's memory.
-	 */
-	elog( DEBUG1, "About to call SPI connect - push SPI first");
-        //SPI_push();
-        if (SPI_push_conditional())
-        {
-            elog( DEBUG1, "pushed SPI" );
-        }
-	elog( DEBUG1, "SPI connection start - TODO FIX THIS!!");
-	if( SPI_connect() != SPI_OK_CONNECT )
-	{
-		elog( WARNING, "IND ADV: SPI_connect() call failed - pre virtual index creation." );
-	//	goto DoneCleanly;
-	}
 
 	/*
-	 * DO NOT access any data-structure allocated between BEGIN/ROLLBACK
-	 * transaction, after the ROLLBACK! All the memory allocated after BEGIN is
-	 * freed in ROLLBACK.
+	 * Register the hypothetical indexes. They only live in our private
+	 * candidate list - nothing is written to pg_class/pg_index, so no
+	 * subtransaction, XID or relcache invalidation is needed, and we can run
+	 * on a hot standby as well.
 	 */
-	 elog( DEBUG1, "Start internal sub transaction");
-	BeginInternalSubTransaction( "index_adviser" );
-
 	elog( DEBUG1, "now create the virtual indexes ");
-	/* now create the virtual indexes */
 	candidates = create_virtual_indexes( candidates );
 
 	/* update the global var */
 	index_candidates = candidates;
 
+	if (list_length(candidates) == 0)
+		goto DoneCleanly;
+
+	/*
+	 * The re-planning garbage (the new plan, the IndexOptInfos built by
+	 * get_relation_info_callback() etc.) goes into a private context which is
+	 * deleted once we are done with the new plan.
+	 */
+	planContext = AllocSetContextCreate( outerContext,
+										"index_adviser",
+										ALLOCSET_DEFAULT_MINSIZE,
+										ALLOCSET_DEFAULT_INITSIZE,
+										ALLOCSET_DEFAULT_MAXSIZE );
+	MemoryContextSwitchTo( planContext );
+
 	/*
 	 * Setup the hook in the planner that injects information into base-tables
 	 * as they are prepared
@@ -440,18 +708,22 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 
 	elog( DEBUG1, "IDX ADV: do re-planning using virtual indexes" );
 	/* do re-planning using virtual indexes */
-	/* TODO: is the plan ever freed? */
+	if( idxadv_search == IDXADV_SEARCH_GREEDY )
+	{
+		new_plan = greedy_candidate_search( queryCopy, cursorOptions, boundParams,
+											actualTotalCost, candidates );
 
-	new_plan = standard_planner(queryCopy, cursorOptions, boundParams);
+		/* no subset of the candidates beat the actual plan */
+		if( new_plan == NULL )
+			new_plan = actual_plan;
+	}
+	else
+		new_plan = standard_planner(queryCopy, cursorOptions, boundParams);
 
 	elog( DEBUG1, "IND ADV: release the hook" );
 	/* reset the hook */
 	get_relation_info_hook = NULL;
 
-	elog( DEBUG1, "IND ADV: remove the virtual-indexes" );
-	/* remove the virtual-indexes */
-	drop_virtual_indexes( candidates );
-
 	newStartupCost	= new_plan->planTree->startup_cost;
 	newTotalCost	= new_plan->planTree->total_cost;
     elog( DEBUG1 , "IND ADV: new plan costs: %lf .. %lf ",newStartupCost,newTotalCost);
@@ -471,18 +743,16 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	totalCostSaved = actualTotalCost - newTotalCost;
 
 
-	tag_and_remove_candidates(startupCostSaved, totalCostSaved, new_plan, (Node*)new_plan->planTree, candidates);
+	/* the greedy search has marked the candidates of its final plan already */
+	if( idxadv_search != IDXADV_SEARCH_GREEDY )
+		tag_and_remove_candidates(startupCostSaved, totalCostSaved, new_plan, candidates);
 /*
 	if( startupCostSaved >0 || totalCostSaved > 0 )
 	{
 
-		plannedStmtGlobal = new_plan;
-
 		//elog_node_display( DEBUG4, "plan (using Index Adviser)",(Node*)new_plan->planTree, true );
 
-		mark_used_candidates(, candidates );
-
-		plannedStmtGlobal = NULL;
+		mark_used_candidates( new_plan, candidates );
 	}
 */
 
@@ -497,10 +767,13 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	if( list_length( candidates ) > 0 )
 		saveCandidates = true;
 
-	/* calculate the share of cost saved by each index */
+	/*
+	 * calculate the share of cost saved by each index; the greedy search has
+	 * measured the marginal benefit of its candidates already
+	 */
 	if( saveCandidates )
 	{
-		int8 totalSize = 0;
+		double totalSize = 0;
 		IndexCandidate *cand;
 
 		foreach( cell, candidates )
@@ -510,10 +783,25 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 		{
 			cand = (IndexCandidate*)lfirst( cell );
 
-			elog( DEBUG2, "IND ADV: benefit: saved: %f, pages: %d, size: %d", totalCostSaved,cand->pages,totalSize);
-			cand->benefit = (float4)totalCostSaved
-							* ((float4)cand->pages/totalSize);
+			elog( DEBUG2, "IND ADV: benefit: saved: %f, pages: %u, size: %.0f", totalCostSaved,cand->pages,totalSize);
+			if( idxadv_search != IDXADV_SEARCH_GREEDY )
+				cand->benefit = (float4)totalCostSaved
+								* ((float4)cand->pages/totalSize);
+
+			if( cand->idxused )
+				++lastAdviceCount;
+		}
+
+		/* re-plan without each used index to measure what it really saves */
+		if( idxadv_marginal_benefit && idxadv_search != IDXADV_SEARCH_GREEDY )
+		{
+			get_relation_info_hook = get_relation_info_callback;
+			measure_marginal_benefits( queryCopy, cursorOptions, boundParams,
+									   newTotalCost, candidates );
+			get_relation_info_hook = NULL;
 		}
+
+		lastAdviceCostSaved = totalCostSaved;
 	}
 
 	elog( DEBUG2, "IND ADV: Print the new plan if debugging" );
@@ -523,7 +811,7 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 							new_plan, Debug_pretty_print );
 
 	/* If called from the EXPLAIN hook, make a copy of the plan to be passed back */
-	if( saveCandidates && doingExplain )
+	if( saveCandidates && doingExplain && new_plan != actual_plan )
 	{
 		MemoryContext oldContext = MemoryContextSwitchTo( outerContext );
 
@@ -536,32 +824,19 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 		/* TODO: try to free the new plan node */
 		new_plan = NULL;
 	}
-	/*
-	 * Undo the metadata changes; for eg. pg_depends entries will be removed
-	 * (from our MVCC view).
-	 *
-	 * Again: DO NOT access any data-structure allocated between BEGIN/ROLLBACK
-	 * transaction, after the ROLLBACK! All the memory allocated after BEGIN is
-	 * freed in ROLLBACK.
-	 */
-	RollbackAndReleaseCurrentSubTransaction();
-
-	/* restore the resource-owner */
-	CurrentResourceOwner = oldResourceOwner;
-
-	elog( DEBUG1, "SPI connection finish");
-	if( SPI_finish() != SPI_OK_FINISH )
-		elog( WARNING, "IND ADV: SPI_finish failed." );
+	/* the re-planning memory is not needed anymore */
+	MemoryContextSwitchTo( outerContext );
+	MemoryContextDelete( planContext );
 
 	elog( DEBUG1, "IDX_ADV: save the advice into the table" );
 	/* save the advise into the table */
-	if( saveCandidates )
+	if( saveCandidates && !adviceMeasureOnly )
 	{
 		/* catch any ERROR */
 		PG_TRY();
 		{
 			elog( DEBUG1, "IND ADV: pre-save the advise into the table" );
-			store_idx_advice(candidates, es);
+			store_idx_advice(candidates, es, fingerprint);
 			elog( DEBUG1, "IND ADV: post-save the advise into the table" );
 		}
 		PG_CATCH();
@@ -587,19 +862,7 @@ static PlannedStmt* index_adviser(	Query*			queryCopy,
 	/* free the candidate-list */
 	elog( DEBUG3, "IND ADV: Deleting candidate list." );
 	if( !saveCandidates || !doingExplain )
-	{
-		foreach( cell, index_candidates )
-			pfree( (IndexCandidate*)lfirst( cell ) );
-
-		list_free( index_candidates );
-		index_candidates = NIL;
-
-		foreach( cell, table_clauses )
-            pfree( (RelClause*)lfirst( cell ) );
-
-        list_free( table_clauses );
-        table_clauses = NIL;
-	}
+		free_index_candidates();
 
 	elog( DEBUG3, "IND ADV: Done." );
 
@@ -637,14 +900,69 @@ static PlannedStmt* planner_callback(	Query*			query,
 	Query	*queryCopy;
 	PlannedStmt *actual_plan;
 	PlannedStmt *new_plan;
+	MemoryContext oldcontext;
+	uint32	fingerprint = 0;
+	List	*relids = NIL;
+	int		ttl = idxadv_cache_ttl;
+	bool	externParams = false;
+	bool	haveValues = boundParams != NULL && boundParams->numParams > 0;
+	ParamListInfo	*samples = NULL;
+	int		nsamples = 0;
+	AdviceCacheEntry	*cached;
 
 	resetSecondaryHooks();
 
-	/* TODO : try to avoid making a copy if the index_adviser() is not going
-	 * to use it; Index Adviser may not use the query copy at all if we are
-	 * running in BootProcessing mode, or if the Index Adviser is being called
-	 * recursively.
+	/*
+	 * Don't pay for the query copy and the second planning if the
+	 * index_adviser() is not going to use it; that is if we are running in
+	 * BootProcessing mode, if the Index Adviser is being called recursively or
+	 * if this statement is not sampled.
+	 */
+	if( IsBootstrapProcessingMode() || SuppressRecursion > 0 )
+		return standard_planner( query, cursorOptions, boundParams );
+
+	if( !sample_statement() )
+		return standard_planner( query, cursorOptions, boundParams );
+
+	if( idxadv_cache_ttl != 0 || idxadv_plan_cache || idxadv_param_samples > 0 )
+		fingerprint = query_fingerprint( query, true, &relids, &externParams );
+
+	/*
+	 * the bind values are sampled from the sampled plans built with them (the
+	 * first custom plans of a prepared statement), advised on or not
+	 */
+	if( idxadv_param_samples > 0 && haveValues )
+		param_sample_add( fingerprint, boundParams, idxadv_param_samples );
+
+	/* the plans of a parameterized statement share its advice for good */
+	if( idxadv_plan_cache && (boundParams != NULL || externParams) )
+		ttl = ADVICE_CACHE_NO_EXPIRY;
+
+	/* a generic plan: advise on the bind values sampled from the custom plans */
+	if( idxadv_param_samples > 0 && !haveValues )
+		nsamples = param_sample_get( fingerprint, &samples );
+
+	/* that takes an advice per sample; keep it until invalidated */
+	if( nsamples > 0 )
+		ttl = ADVICE_CACHE_NO_EXPIRY;
+
+	/*
+	 * ... or if we advised on the very same statement a moment ago. With
+	 * index_adviser.plan_cache the custom and generic plans of a prepared
+	 * statement - which all share its query tree - reuse the advice of the
+	 * first one, until a relation it reads is invalidated; statements without
+	 * parameters keep to index_adviser.cache_ttl. The advice of a generic plan
+	 * with samples replaces that of the custom plans the samples came from,
+	 * once: it is cached as sampled advice in turn.
 	 */
+	if( ttl != 0 && (cached = advice_cache_lookup( fingerprint, ttl )) != NULL
+		&& (nsamples == 0 || cached->sampled) )
+	{
+		if( samples != NULL )
+			pfree( samples );
+		list_free( relids );
+		return standard_planner( query, cursorOptions, boundParams );
+	}
 
 	elog( DEBUG3 , "planner_callback: enter");
 	/* planner() scribbles on it's input, so make a copy of the query-tree */
@@ -654,30 +972,175 @@ static PlannedStmt* planner_callback(	Query*			query,
 	elog( DEBUG3 , "planner_callback: standard planner");
 	actual_plan = standard_planner( query, cursorOptions, boundParams );
 
+	oldcontext = CurrentMemoryContext;
+
 	PG_TRY();
 	{
+		if( nsamples > 0 )
+			advise_on_param_samples( queryCopy, cursorOptions, samples, nsamples );
+		else
+		{
+			/* let the candidates and the estimates see the bound values */
+			if( idxadv_param_samples > 0 && haveValues )
+				queryCopy = bind_param_values( queryCopy, boundParams );
+
+			/* send the actual plan for comparison with a hypothetical plan */
+			elog( DEBUG3 , "planner_callback: index_adviser");
+			new_plan = index_adviser( queryCopy, cursorOptions, boundParams,
+										actual_plan,NULL, false );
+		}
 
-
-		/* send the actual plan for comparison with a hypothetical plan */
-		elog( DEBUG3 , "planner_callback: index_adviser");
-		new_plan = index_adviser( queryCopy, cursorOptions, boundParams,
-									actual_plan,NULL, false );
+		if( ttl != 0 )
+			advice_cache_store( fingerprint, relids,
+								lastAdviceCount, lastAdviceCostSaved, nsamples > 0 );
 	}
 	PG_CATCH();
 	{
+		/* the adviser may have left us in its private memory context */
+		MemoryContextSwitchTo( oldcontext );
+		FlushErrorState();
+
 		elog(WARNING, "Failed to create index advice for: %s",debug_query_string);
 		/* reset our 'running' state... */
 		SuppressRecursion=0;
+		adviceMeasureOnly = false;
+		adviceSampled = false;
 
 	}
 	PG_END_TRY();
 
+	list_free( relids );
+
 	/* TODO: try to free the redundant new_plan */
 	elog( DEBUG3 , "planner_callback: Done");
 
 	return actual_plan;
 }
 
+/**
+ * advise_on_param_samples
+ *    advises on a parameterized statement planned without values (a generic
+ * plan) by binding each sample of its bind values in turn. The advice stored
+ * is the one for the sample with the median saving, along with the cost saved
+ * over the samples by percentile.
+ */
+static void advise_on_param_samples( const Query* query, int cursorOptions,
+					ParamListInfo* samples, int nsamples )
+{
+	SampleCost		*costs = (SampleCost*) palloc( nsamples * sizeof(SampleCost) );
+	MemoryContext	sampleContext;
+	MemoryContext	oldcontext;
+	Query			*bound;
+	PlannedStmt		*actual_plan;
+	int				median;
+	int				i;
+
+	sampleContext = AllocSetContextCreate( CurrentMemoryContext,
+										"index_adviser param sample",
+										ALLOCSET_DEFAULT_MINSIZE,
+										ALLOCSET_DEFAULT_INITSIZE,
+										ALLOCSET_DEFAULT_MAXSIZE );
+
+	/* measure the cost saved for every sample, storing nothing */
+	adviceMeasureOnly = true;
+
+	for( i = 0; i < nsamples; ++i )
+	{
+		oldcontext = MemoryContextSwitchTo( sampleContext );
+
+		bound = bind_param_values( query, samples[i] );
+		actual_plan = standard_planner( (Query*)copyObject( bound ), cursorOptions,
+										samples[i] );
+		index_adviser( bound, cursorOptions, samples[i], actual_plan, NULL, false );
+
+		costs[i].sample = i;
+		costs[i].costSaved = lastAdviceCostSaved;
+
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( sampleContext );
+	}
+
+	adviceMeasureOnly = false;
+	MemoryContextDelete( sampleContext );
+
+	qsort( costs, nsamples, sizeof(SampleCost), sample_cost_cmp );
+
+	adviceSampleCostSaved[0] = costs[0].costSaved;
+	adviceSampleCostSaved[1] = costs[(nsamples - 1) / 2].costSaved;
+	adviceSampleCostSaved[2] = costs[(nsamples - 1) * 9 / 10].costSaved;
+	adviceSampleCostSaved[3] = costs[nsamples - 1].costSaved;
+
+	elog( DEBUG1, "IND ADV: cost saved over %d bind value samples: min %.2f, p50 %.2f, p90 %.2f, max %.2f",
+		  nsamples,
+		  adviceSampleCostSaved[0], adviceSampleCostSaved[1],
+		  adviceSampleCostSaved[2], adviceSampleCostSaved[3] );
+
+	/* the median sample is the representative one */
+	median = costs[(nsamples - 1) / 2].sample;
+
+	bound = bind_param_values( query, samples[median] );
+	actual_plan = standard_planner( (Query*)copyObject( bound ), cursorOptions,
+									samples[median] );
+
+	adviceSampled = true;
+	index_adviser( bound, cursorOptions, samples[median], actual_plan, NULL, false );
+	adviceSampled = false;
+
+	pfree( costs );
+}
+
+/**
+ * sample_cost_cmp
+ *    qsort() comparator ordering the samples by the cost saved, ascending.
+ */
+static int sample_cost_cmp( const void* a, const void* b )
+{
+	const SampleCost* const sa = (const SampleCost*)a;
+	const SampleCost* const sb = (const SampleCost*)b;
+
+	if( sa->costSaved < sb->costSaved )
+		return -1;
+	if( sa->costSaved > sb->costSaved )
+		return 1;
+	return sa->sample - sb->sample;
+}
+
+/*
+ * sample_statement
+ *    decides whether planner_callback() advises on the current statement.
+ *
+ * Every index_adviser.sample_rate'th statement is sampled, and no more than
+ * index_adviser.max_per_second of those in any one second. The clock is only
+ * read for statements that passed the 1-in-N test.
+ */
+static bool sample_statement(void)
+{
+	TimestampTz now;
+
+	if( idxadv_sample_rate <= 0 )
+		return false;
+
+	if( ++sampleStatementCount % idxadv_sample_rate != 0 )
+		return false;
+
+	if( idxadv_max_per_second <= 0 )
+		return true;
+
+	now = GetCurrentTimestamp();
+	if( TimestampDifferenceExceeds( sampleWindowStart, now, 1000 ) )
+	{
+		/* start a new one second window */
+		sampleWindowStart = now;
+		sampleWindowCount = 0;
+	}
+
+	if( sampleWindowCount >= idxadv_max_per_second )
+		return false;
+
+	++sampleWindowCount;
+	return true;
+}
+
 /*
  * This callback is registered immediately upon loading this plugin. It is
  * responsible for taking over control from the ExplainOneQuery() function.
@@ -699,7 +1162,7 @@ ExplainOneQuery_callback(Query	*query,  IntoClause *into,
 	Query		*queryCopy;
 	PlannedStmt	*actual_plan;
 	PlannedStmt	*new_plan;
-	ListCell	*cell;
+	MemoryContext oldcontext;
 	instr_time planduration; // TODO: consider printing this as well
 
 	resetSecondaryHooks();
@@ -720,6 +1183,8 @@ ExplainOneQuery_callback(Query	*query,  IntoClause *into,
 
 	elog( DEBUG1 , "IND ADV: re-plan the query");
 
+	oldcontext = CurrentMemoryContext;
+
 	PG_TRY();
 	{
 
@@ -753,6 +1218,10 @@ ExplainOneQuery_callback(Query	*query,  IntoClause *into,
 	}
 	PG_CATCH();
 	{
+		/* the adviser may have left us in its private memory context */
+		MemoryContextSwitchTo( oldcontext );
+		FlushErrorState();
+
 		elog(WARNING, "Failed to create index advice for: %s",debug_query_string);
 		/* reset our 'running' state... */
 		SuppressRecursion=0;
@@ -762,155 +1231,426 @@ ExplainOneQuery_callback(Query	*query,  IntoClause *into,
 
 	/* The candidates might not have been destroyed by the Index Adviser, do it
 	 * now. FIXME: this block belongs inside the 'if ( new_plan )' block above. */
-	foreach( cell, index_candidates )
-		pfree( (IndexCandidate*)lfirst( cell ) );
-
-	list_free( index_candidates );
-
-	index_candidates = NIL;
-
-	foreach( cell, table_clauses )
-        pfree( (RelClause*)lfirst( cell ) );
-
-    list_free( table_clauses );
-    table_clauses = NIL;
+	free_index_candidates();
 
 	/* TODO: try to free the now-redundant new_plan */
 }
 
-/*
- * get_relation_info() calls this callback after it has prepared a RelOptInfo
- * for a relation.
- *
- *     The Job of this callback is to fill in the information about the virtual
- * index, that get_rel_info() could not load from the catalogs. As of now, the
- * number of disk-pages that might be occupied by the virtual index (if created
- * on-disk), is the only information that needs to be updated.
- *
- * selectivity computations are basaed on "clause_selectivity" in src/backend/optimizer/path/clausesel.c:484
- *
- * Given the Oid of the relation, return the following info into fields
- * of the RelOptInfo struct:
- *  indexlist   list of IndexOptInfos for relation's indexes
- *  pages       number of pages
- *  tuples      number of tuples
+/**
+ * index_advise_workload
+ *    SQL callable; advises on a workload of statements in one go. The
+ * candidates of all the statements form a single pool whose virtual indexes
+ * are created once, and every statement is planned with the whole pool.
  *
- * BUG: this fails if we have actual data in the table - must fix.
+ * Returns a row per statement with the cost it saves (recommendation is null),
+ * a row per index a statement uses with its share of that saving, and a row
+ * per index with its benefit summed over the workload (query_no is null).
+ * Nothing is stored in the advisory tables, so a hot standby can be advised
+ * on as well. Partial indexes (index_adviser.cols) are not advised on: their
+ * predicates belong to a single statement.
  */
-static void get_relation_info_callback(	PlannerInfo	*root,
-				Oid		relationObjectId,
-				bool		inhparent,
-				RelOptInfo	*rel)
+Datum index_advise_workload( PG_FUNCTION_ARGS )
 {
-	//ListCell *cell1;
-	List       *indexoidlist;
-    ListCell   *l;
-    LOCKMODE    lmode;
-	IndexCandidate *cand;
-	Index       varno = rel->relid;
-    Relation    relation;
-    //bool        hasindex;
-    List       *indexinfos = NIL;
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo*) fcinfo->resultinfo;
+	ArrayType		*queries = PG_GETARG_ARRAYTYPE_P( 0 );
+	TupleDesc		tupdesc;
+	Tuplestorestate	*tupstore;
+	MemoryContext	oldcontext;
+	Datum			*texts;
+	bool			*textnulls;
+	int				ntexts;
+	List			*workload = NIL;	/* of WorkloadQuery */
+	List			*candidates = NIL;
+	OpnosContext	*context;
+	HTAB			*advised;
+	HASHCTL			ctl;
+	HASH_SEQ_STATUS	status;
+	AdvisedIndexEntry	*entry;
+	ListCell		*cell;
+	ListCell		*qcell;
+	int				i;
+
+	if( rsinfo == NULL || !IsA( rsinfo, ReturnSetInfo ) )
+		ereport( ERROR,
+				(errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				 errmsg( "set-valued function called in context that cannot accept a set" )));
+	if( !(rsinfo->allowedModes & SFRM_Materialize) )
+		ereport( ERROR,
+				(errcode( ERRCODE_FEATURE_NOT_SUPPORTED ),
+				 errmsg( "materialize mode required, but it is not allowed in this context" )));
+	if( get_call_result_type( fcinfo, NULL, &tupdesc ) != TYPEFUNC_COMPOSITE )
+		elog( ERROR, "return type must be a row type" );
+
+	oldcontext = MemoryContextSwitchTo( rsinfo->econtext->ecxt_per_query_memory );
+	tupdesc = CreateTupleDescCopy( tupdesc );
+	tupstore = tuplestore_begin_heap( true, false, work_mem );
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo( oldcontext );
 
-	elog( DEBUG1, "IND ADV: get_relation_info_callback: ENTER." );
-	relation = heap_open( relationObjectId, NoLock);
+	resetSecondaryHooks();
 
-    indexoidlist = RelationGetIndexList(relation);
+	/* reset these globals; since an ERROR might have left them unclean */
+	index_candidates = NIL;
+	virtual_indexes = NULL;
+	table_clauses = NIL;
+	ginCostEstimateChecked = false;
 
-	elog( DEBUG3, "IND ADV: get_relation_info_callback: index list length %d",list_length(indexoidlist));
-	lmode = AccessShareLock;
-	foreach( l, indexoidlist)
-	{
-		Oid         indexoid = lfirst_oid(l);
-		Relation    indexRelation;
-		Form_pg_index index;
-		IndexOptInfo *info;
-		int         ncolumns;
-		int         i;
-		int			simpleColumns = 0;
+	/* get the operators supported by the index advisor */
+	context = get_supported_operators();
 
-		if( !is_virtual_index( indexoid, NULL ) ) { elog( DEBUG1, "IND ADV: get_relation_info_callback: real index - skipping "); continue; }// skip actual indexes
+	deconstruct_array( queries, TEXTOID, -1, false, 'i',
+					   &texts, &textnulls, &ntexts );
 
-		elog( DEBUG1, "IND ADV: get_relation_info_callback: index list loop");
-		indexRelation = index_open(indexoid, lmode);
-  		index = indexRelation->rd_index;
+	/* parse, analyze and plan the statements; pool their candidates */
+	for( i = 0; i < ntexts; ++i )
+	{
+		char		*sql;
+		ListCell	*pcell;
 
-		info = makeNode(IndexOptInfo);
+		if( textnulls[i] )
+			continue;
 
-		info->indexoid = index->indexrelid;
-		info->reltablespace = RelationGetForm(indexRelation)->reltablespace;
+		sql = TextDatumGetCString( texts[i] );
+
+		foreach( pcell, pg_parse_query( sql ) )
+		{
+			foreach( qcell, pg_analyze_and_rewrite( (Node*)lfirst( pcell ), sql,
+													NULL, 0 ) )
+			{
+				Query			*query = (Query*)lfirst( qcell );
+				WorkloadQuery	*wq;
+				PlannedStmt		*plan;
+
+				if( query->commandType == CMD_UTILITY )
+					continue;
+
+				/* planner() scribbles on it's input */
+				plan = standard_planner( (Query*)copyObject( query ), 0, NULL );
+
+				wq = (WorkloadQuery*) palloc( sizeof(WorkloadQuery) );
+				wq->queryNo		= i + 1;
+				wq->query		= query;
+				wq->actualCost	= plan->planTree->total_cost;
+				workload = lappend( workload, wq );
+
+				candidates = list_concat( candidates,
+										  scan_query( query, context, NULL ) );
+
+				/* the predicates of partial indexes are statement specific */
+				foreach( cell, table_clauses )
+					pfree( (RelClause*)lfirst( cell ) );
+				list_free( table_clauses );
+				table_clauses = NIL;
+			}
+		}
+	}
+
+	/* one pool of candidates and one pass creating the virtual indexes */
+	candidates = unique_candidates( candidates );
+	if( candidates != NIL )
+		candidates = remove_irrelevant_candidates( candidates );
+	if( candidates != NIL )
+		candidates = create_virtual_indexes( candidates );
+
+	index_candidates = candidates;
+
+	log_candidates( "Workload candidates", candidates );
+
+	foreach( cell, candidates )
+		((IndexCandidate*)lfirst( cell ))->benefit = 0;
+
+	PG_TRY();
+	{
+		get_relation_info_hook = get_relation_info_callback;
+
+		foreach( qcell, workload )
+		{
+			WorkloadQuery* const wq = (WorkloadQuery*)lfirst( qcell );
+			PlannedStmt	*plan;
+			Cost		costSaved = 0;
+			double		totalSize = 0;
+
+			if( candidates != NIL )
+			{
+				plan = plan_candidates( wq->query, 0, NULL, candidates );
+				costSaved = wq->actualCost - plan->planTree->total_cost;
+			}
+
+			workload_result_row( tupstore, tupdesc, wq->queryNo, NULL, costSaved );
+
+			if( costSaved <= 0 )
+				continue;
+
+			/* split the saving among the used indexes by their size */
+			foreach( cell, candidates )
+			{
+				const IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+
+				if( cand->idxused )
+					totalSize += cand->pages;
+			}
+
+			foreach( cell, candidates )
+			{
+				IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+				Cost		benefit;
+
+				if( !cand->idxused )
+					continue;
+
+				benefit = totalSize > 0 ? costSaved * ((double)cand->pages / totalSize)
+										: costSaved;
+				cand->benefit += (float4)benefit;
+
+				workload_result_row( tupstore, tupdesc, wq->queryNo, cand, benefit );
+			}
+		}
+
+		get_relation_info_hook = NULL;
+	}
+	PG_CATCH();
+	{
+		get_relation_info_hook = NULL;
+		free_index_candidates();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/*
+	 * Candidates are told apart by the alias of their relation too, so the
+	 * statements aliasing a table differently have their own candidates for
+	 * the same index; credit the first of them with the benefit of all. The
+	 * expressions and the predicate are compared as deparsed, which does not
+	 * depend on the alias.
+	 */
+	memset( &ctl, 0, sizeof(ctl) );
+	ctl.keysize = sizeof(AdvisedIndexKey);
+	ctl.entrysize = sizeof(AdvisedIndexEntry);
+	ctl.hash = tag_hash;
+	ctl.hcxt = CurrentMemoryContext;
+	advised = hash_create( "index_adviser advised indexes",
+						   Max( list_length( candidates ), 1 ),
+						   &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+
+	foreach( cell, candidates )
+	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+		AdvisedIndexKey	key;
+		List			*rel_clauses;
+		char			*recommendation;
+		bool			found;
+
+		if( cand->benefit <= 0 )
+			continue;
+
+		recommendation = index_recommendation( cand, &rel_clauses );
+
+		/* the key is hashed as raw bytes - clear the padding too */
+		memset( &key, 0, sizeof(key) );
+		key.reloid = cand->reloid;
+		key.amOid = cand->amOid;
+		key.textHash = DatumGetUInt32( hash_any( (const unsigned char*) recommendation,
+												 strlen( recommendation ) ) );
+		key.ncols = cand->cols->ncols;
+		memcpy( key.attnos, cand->cols->varattno, cand->cols->ncols * sizeof(AttrNumber) );
+		memcpy( key.opclasses, cand->cols->op_class, cand->cols->ncols * sizeof(Oid) );
+
+		entry = (AdvisedIndexEntry*) hash_search( advised, &key, HASH_ENTER, &found );
+
+		if( !found )
+		{
+			entry->cand = cand;
+			entry->recommendation = recommendation;
+			continue;
+		}
+
+		/* a collision of the statement hashes is no duplicate */
+		if( strcmp( entry->recommendation, recommendation ) == 0 )
+		{
+			entry->cand->benefit += cand->benefit;
+			cand->benefit = 0;
+		}
+
+		pfree( recommendation );
+	}
+
+	hash_seq_init( &status, advised );
+	while( (entry = (AdvisedIndexEntry*) hash_seq_search( &status )) != NULL )
+		pfree( entry->recommendation );
+	hash_destroy( advised );
+
+	/* the aggregate benefit of every index used by the workload */
+	foreach( cell, candidates )
+	{
+		const IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+
+		if( cand->benefit > 0 )
+			workload_result_row( tupstore, tupdesc, 0, cand, cand->benefit );
+	}
+
+	free_index_candidates();
+
+	tuplestore_donestoring( tupstore );
+
+	return (Datum) 0;
+}
+
+/**
+ * workload_result_row
+ *    adds a row to the result of index_advise_workload(); a queryNo of 0 and a
+ * NULL cand are returned as nulls.
+ */
+static void workload_result_row( Tuplestorestate* tupstore, TupleDesc tupdesc,
+				int queryNo, const IndexCandidate* cand, double benefit )
+{
+	Datum	values[ IDX_ADV_WORKLOAD_COLS ];
+	bool	nulls[ IDX_ADV_WORKLOAD_COLS ];
+	List	*rel_clauses;
+	char	*recommendation;
+
+	memset( nulls, 0, sizeof( nulls ) );
+
+	values[0] = Int32GetDatum( queryNo );
+	nulls[0] = queryNo == 0;
+
+	if( cand != NULL )
+	{
+		recommendation = index_recommendation( cand, &rel_clauses );
+		values[1] = CStringGetTextDatum( recommendation );
+		values[2] = Int32GetDatum( index_size_kb( cand ) );
+		pfree( recommendation );
+	}
+	else
+		nulls[1] = nulls[2] = true;
+
+	values[3] = Float8GetDatum( benefit );
+
+	tuplestore_putvalues( tupstore, tupdesc, values, nulls );
+
+	if( cand != NULL )
+		pfree( DatumGetPointer( values[1] ) );
+}
+
+/*
+ * get_relation_info() calls this callback after it has prepared a RelOptInfo
+ * for a relation.
+ *
+ *     The Job of this callback is to add the virtual indexes of the relation to
+ * its index list. The virtual indexes are never created in the catalogs, so
+ * the IndexOptInfo is synthesized from the IndexCandidate alone, together with
+ * the number of disk-pages that might be occupied by the virtual index (if
+ * created on-disk).
+ *
+ * selectivity computations are basaed on "clause_selectivity" in src/backend/optimizer/path/clausesel.c:484
+ *
+ * Given the Oid of the relation, add the following info into fields
+ * of the RelOptInfo struct:
+ *  indexlist   list of IndexOptInfos for relation's indexes
+ */
+static void get_relation_info_callback(	PlannerInfo	*root,
+				Oid		relationObjectId,
+				bool		inhparent,
+				RelOptInfo	*rel)
+{
+	ListCell   *l;
+	Index       varno = rel->relid;
+	Relation    relation;
+
+	elog( DEBUG1, "IND ADV: get_relation_info_callback: ENTER." );
+
+	/* just like get_relation_info(), ignore the indexes of an inheritance parent */
+	if( inhparent )
+		return;
+
+	relation = heap_open( relationObjectId, NoLock);
+
+	foreach( l, index_candidates )
+	{
+		IndexCandidate *cand = (IndexCandidate*)lfirst( l );
+		IndexOptInfo *info;
+		HeapTuple	amtuple;
+		Form_pg_am	amform;
+		int         ncolumns;
+		int         i;
+		int			exprColumns = 0;
+
+		/* index_adviser.search = greedy offers a few candidates at a time */
+		if( cand->reloid != relationObjectId || !cand->active )
+			continue;
+
+		elog( DEBUG1, "IND ADV: get_relation_info_callback: index list loop");
+
+		amtuple = SearchSysCache1( AMOID, ObjectIdGetDatum( cand->amOid ) );
+		if( !HeapTupleIsValid( amtuple ) )
+			elog( ERROR, "cache lookup failed for access method %u", cand->amOid );
+		amform = (Form_pg_am) GETSTRUCT( amtuple );
+
+		info = makeNode(IndexOptInfo);
+
+		info->indexoid = cand->idxoid;
+		info->reltablespace = InvalidOid; /* the default tablespace, as index_create() would use */
 		info->rel = rel;
-		info->ncolumns = ncolumns = index->indnatts;
-		info->indexkeys = (int *) palloc(sizeof(int) * INDEX_MAX_KEYS);
+		info->ncolumns = ncolumns = cand->cols->ncols;
+		info->indexkeys = (int *) palloc(sizeof(int) * ncolumns);
 		info->indexcollations = (Oid *) palloc(sizeof(Oid) * ncolumns);
 		info->opfamily = (Oid *) palloc(sizeof(Oid) * ncolumns);
 		info->opcintype = (Oid *) palloc(sizeof(Oid) * ncolumns);
-                info->canreturn = (bool *) palloc(sizeof(bool) * ncolumns);
-		elog( DEBUG3, "IND ADV: get_relation_info_callback: index oid: %d, ncols: %d",indexoid,ncolumns);
+#if PG_VERSION_NUM >= 90500
+		info->canreturn = (bool *) palloc(sizeof(bool) * ncolumns);
+#endif
+		elog( DEBUG3, "IND ADV: get_relation_info_callback: index oid: %d, ncols: %d",cand->idxoid,ncolumns);
 
 		for (i = 0; i < ncolumns; i++)
 		{
-                        elog( DEBUG3, "IDX_ADV: column %d  ",i);
-			info->indexkeys[i] = index->indkey.values[i];
-			if(info->indexkeys[i] != 0)
-				simpleColumns +=1;
-			info->indexcollations[i] = indexRelation->rd_indcollation[i]; //InvalidOid;
-			info->opfamily[i] = indexRelation->rd_opfamily[i];
-			info->opcintype[i] = indexRelation->rd_opcintype[i];
+			info->indexkeys[i] = cand->cols->varattno[i];
+			if(info->indexkeys[i] == 0)
+				exprColumns +=1;
+			info->indexcollations[i] = cand->cols->collationObjectId[i];
+			info->opfamily[i] = get_opclass_family( cand->cols->op_class[i] );
+			info->opcintype[i] = get_opclass_input_type( cand->cols->op_class[i] );
 #if PG_VERSION_NUM >= 90500
-			info->canreturn[i] = index_can_return(indexRelation, i + 1);
+			/* only btree can hand back the indexed values */
+			info->canreturn[i] = (cand->amOid == BTREE_AM_OID);
 #endif
 		}
-                elog( DEBUG3, "IDX_ADV: done with per column  ");
-		for (; i < INDEX_MAX_KEYS; i++)
-		{
-			info->indexkeys[i] = 0;
-		}
 
-		info->relam = indexRelation->rd_rel->relam;
+		info->relam = cand->amOid;
+		info->amcostestimate = amform->amcostestimate;
 
-		elog( DEBUG4 ,"IND ADV: amcostestimate=%d",info->amcostestimate);
-		if(info->amcostestimate == InvalidOid)
+		switch (info->relam)
 		{
-			elog( DEBUG4 ,"IND ADV: need to figure out the right valuse for amcostestimate");
-			info->amcostestimate=(RegProcedure)1268; //btcostestimate
-                        // TODO: consider using: (*indexRelation->rd_am)->amcostestimate
-                        switch (info->relam)
-			{
-				case BTREE_AM_OID:
-					info->amcostestimate=(RegProcedure)1268; //btcostestimate
-					break;
-				case GIN_AM_OID:
-					info->amcostestimate=(RegProcedure)772; //gistcostestimate
-					//info->amcostestimate=(RegProcedure)2741; //gincostestimate
-					//TODO: ginGetStats (called by gistcostestimate) fails as it reads the index directly - find workaround.
-					break;
-				case GIST_AM_OID:
+			case GIN_AM_OID:
+				/*
+				 * gincostestimate() reads the metapage of the index; ours
+				 * is fed with made up statistics instead (see gin_cost.c).
+				 */
+				if( !ginCostEstimateChecked )
+				{
+					ginCostEstimateOid = gin_cost_estimate_oid();
+					ginCostEstimateChecked = true;
+				}
+
+				if( OidIsValid( ginCostEstimateOid ) )
+					info->amcostestimate = ginCostEstimateOid;
+				else
 					info->amcostestimate=(RegProcedure)772; //gistcostestimate
-					break;
-#if PG_VERSION_NUM >= 90500
-				case BRIN_AM_OID:
-					info->amcostestimate=(RegProcedure)3800; //brincostestimate
-					break;
-#endif
-			}
+				break;
 		}
 #if PG_VERSION_NUM < 90500
-		info->canreturn = index_can_return(indexRelation);
+		info->canreturn = (cand->amOid == BTREE_AM_OID);
 #endif
-		info->amcanorderbyop = indexRelation->rd_am->amcanorderbyop;
-		info->amoptionalkey = indexRelation->rd_am->amoptionalkey;
-		info->amsearcharray = indexRelation->rd_am->amsearcharray;
-		info->amsearchnulls = indexRelation->rd_am->amsearchnulls;
-		info->amhasgettuple = OidIsValid(indexRelation->rd_am->amgettuple);
-		info->amhasgetbitmap = OidIsValid(indexRelation->rd_am->amgetbitmap);
-
-                //info->amoptionalkey = false;
-                //info->amsearchnulls = false;
+		info->amcanorderbyop = amform->amcanorderbyop;
+		info->amoptionalkey = amform->amoptionalkey;
+		info->amsearcharray = amform->amsearcharray;
+		info->amsearchnulls = amform->amsearchnulls;
+		info->amhasgettuple = OidIsValid(amform->amgettuple);
+		info->amhasgetbitmap = OidIsValid(amform->amgetbitmap);
 
 		/*
-		* v9.4 introduced a concept of tree height for btree, we'll use unkonown for now
-		* loot at _bt_getrootheight on how to estimate this.
+		* v9.3 introduced a concept of tree height for btree; it's set along
+		* with the size below (see estimate_index_pages()).
 		*/
 #if PG_VERSION_NUM >= 90300
 		info->tree_height = -1;
@@ -920,26 +1660,18 @@ static void get_relation_info_callback(	PlannerInfo	*root,
 		*/
                 // TODO: how to handle non BTREE ops (support other index types, see: get_relation_info: plancat.c:88)
 		if (info->relam == BTREE_AM_OID)
-		//if ( 1 == 1)
 		{
 			elog( DEBUG3 , "IND ADV: in BTREE_AM_OID");
 			/*
 			* If it's a btree index, we can use its opfamily OIDs
 			* directly as the sort ordering opfamily OIDs.
 			*/
-			Assert(indexRelation->rd_am->amcanorder);
+			Assert(amform->amcanorder);
 
 			info->sortopfamily = info->opfamily;
-			info->reverse_sort = (bool *) palloc(sizeof(bool) * ncolumns);
-			info->nulls_first = (bool *) palloc(sizeof(bool) * ncolumns);
-
-			for (i = 0; i < ncolumns; i++)
-			{
-				int16       opt = indexRelation->rd_indoption[i];
-
-				info->reverse_sort[i] = (opt & INDOPTION_DESC) != 0;
-				info->nulls_first[i] = (opt & INDOPTION_NULLS_FIRST) != 0;
-			}
+			/* virtual indexes are always ASC NULLS LAST */
+			info->reverse_sort = (bool *) palloc0(sizeof(bool) * ncolumns);
+			info->nulls_first = (bool *) palloc0(sizeof(bool) * ncolumns);
 		}
 		else
 		{
@@ -948,27 +1680,32 @@ static void get_relation_info_callback(	PlannerInfo	*root,
 			info->nulls_first = NULL;
 		}
 
+		ReleaseSysCache( amtuple );
+
 		elog( DEBUG3 , "IND ADV: almost there...");
 		/*
-		* Fetch the index expressions and predicate, if any.  We must
-		* modify the copies we obtain from the relcache to have the
-		* correct varno for the parent relation, so that they match up
-		* correctly against qual clauses.
+		* Get the index expressions and predicate, if any.  We must
+		* modify our copies to have the correct varno for the parent
+		* relation, so that they match up correctly against qual clauses.
 		*/
 		elog( DEBUG3 , "IND ADV: getting realtion expressions");
-		info->indexprs = RelationGetIndexExpressions(indexRelation);
-		info->ncolumns = simpleColumns + list_length(info->indexprs); // TODO: why is this?!?! really ugly hack?!?
+		info->indexprs = (List *) copyObject( cand->attList );
+		if( list_length( info->indexprs ) != exprColumns )
+		{
+			elog( DEBUG1, "IND ADV: get_relation_info_callback: expressions don't match the columns of %d - skipping", cand->idxoid );
+			continue;
+		}
 
 		elog( DEBUG3 , "IND ADV: get index predicates");
-		info->indpred = RelationGetIndexPredicate(indexRelation);
-		elog( DEBUG3 , "IND ADV: change var nodes - expr");
-		if (info->indexprs && varno != 1)
-		  ChangeVarNodes((Node *) info->indexprs, 1, varno, 0);
-		elog( DEBUG3 , "IND ADV: change var nodes - pred");
-		if (info->indpred && varno != 1)
-		  ChangeVarNodes((Node *) info->indpred, 1, varno, 0);
-
-		//elog_node_display( DEBUG3 , "IND ADV: get_relation_info_callback: ", (const OpExpr*)list_nth(context->predicate,0),true);
+		info->indpred = (List *) copyObject( get_rel_clauses( table_clauses, cand->reloid, cand->erefAlias ) );
+
+		elog( DEBUG3 , "IND ADV: change var nodes");
+		set_varno_walker( (Node *) info->indexprs, &varno );
+		set_varno_walker( (Node *) info->indpred, &varno );
+
+		/* same as RelationGetIndexExpressions() does */
+		info->indexprs = (List *) eval_const_expressions( root, (Node *) info->indexprs );
+
 		elog( DEBUG3 , "IND ADV: Build targetlist using the completed indexprs data");
 
 		/* Build targetlist using the completed indexprs data - used in index only scans */
@@ -976,103 +1713,32 @@ static void get_relation_info_callback(	PlannerInfo	*root,
 		elog_node_display( DEBUG3, "IND ADV:  (fill in tlist )", info->indextlist, true );
 
 		info->predOK = false;       /* set later in indxpath.c */
-		info->unique = index->indisunique;
-		info->immediate = index->indimmediate;
+		info->unique = false;
+		info->immediate = true;
 		info->hypothetical = true; // used to prevent access to the disc. see: src/backend/utils/adt/selfuncs.c -> get_actual_variable_range
 
-		/* We call estimate_index_pages() here, instead of immediately after
-		 * index_create() API call, since rel has been run through
+		/* We call estimate_index_pages() here, since rel has been run through
 		 * estimate_rel_size() by the caller!
 		 */
 		elog( DEBUG1, "IND ADV: get_relation_info_callback: hypothetical? %s",BOOL_FMT(info->hypothetical));
 
-		if( is_virtual_index( info->indexoid, &cand ) )
+		/* re-plans of the same advice reuse the size estimated the first time */
+		if( cand->pages > 0 )
+		{
+			info->pages = cand->pages;
+			info->tuples = cand->tuples;
+#if PG_VERSION_NUM >= 90300
+			info->tree_height = cand->tree_height;
+#endif
+		}
+		else
 		{
 			Selectivity btreeSelectivity;
-			Node       *left,  *right;
-			Var        *var;
-			Const		*cons;
-			VariableStatData ldata,rdata;
-			VariableStatData *vardata;
 
-			elog( DEBUG3 , "IND ADV: get index predicates args");
 			elog_node_display( DEBUG3, "IND ADV:  (info->indpred)", info->indpred, true );
-			if (info->indpred){ // TODO: do i need the varno != 1
-				OpExpr     *opclause = (OpExpr *) linitial(info->indpred);
-				Oid         opno = opclause->opno;
-				RegProcedure oprrest = get_oprrest(opno);
-				elog( DEBUG3 , "IND ADV: get opno 2 %d",opno);
-				elog( DEBUG3 , "IND ADV: get oprrest 2 %d",oprrest);
-
-				/* TODO: add support for boolean selectivity, create a " var = 't' " clause */
-				if(not_clause(opclause))
-				{
-					elog( DEBUG3 , "IND ADV: boolean not expression - todo: compute selectivity");
-					var = (Var *) get_notclausearg((Expr *) opclause);
-					cons = (Const *) makeBoolConst(false,false);
-					opno = BooleanNotEqualOperator   ;
-				}
-				else if(IsA(opclause, Var))
-				{
-					elog( DEBUG3 , "IND ADV: var expression - todo: compute selectivity");
-					var = (Var *) opclause;
-					cons = (Const *) makeBoolConst(true,false);
-					opno = BooleanEqualOperator;
-				}
-				else
-				{
-
-					left = (Node *) linitial(opclause->args);
-					right = (Node *) lsecond(opclause->args);
-					/*
-					 * Examine both sides.  Note that when varRelid is nonzero, Vars of other
-					 * relations will be treated as pseudoconstants.
-					 */
-					elog( DEBUG3 , "IND ADV: get oprrest3");
-					examine_variable(root, left,  cand->idxoid, &ldata);
-					examine_variable(root, right, cand->idxoid, &rdata);
-
-					/* Set up result fields other than the stats tuple */
-					if(IsA(right, Var))
-					{
-						var = (Var *) right;
-						cons = (Const *) left;
-					}else
-					{
-						var = (Var *) left;
-						cons = (Const *) right;
-					}
-				}
-				elog( DEBUG3 , "IND ADV: get oprrest 4");
-
-				elog( DEBUG4, "IND ADV: get_relation_info_callback:  pallocate mem for vardata, size: %ld",sizeof(VariableStatData));
-				vardata = palloc(sizeof(VariableStatData));
-
-				vardata->var = (Node *)var;    /* return Var without relabeling */
-				vardata->rel = rel;
-				vardata->atttype = var->vartype;
-				vardata->atttypmod = var->vartypmod;
-				vardata->isunique = has_unique_index(vardata->rel, var->varattno);
-				/* Try to locate some stats */
-				vardata->statsTuple = SearchSysCache3(STATRELATTINH,
-													ObjectIdGetDatum(relationObjectId),
-													Int16GetDatum(var->varattno),
-													BoolGetDatum(false));
-				vardata->freefunc = ReleaseSysCache;
-				elog( DEBUG3, "IND ADV: get_relation_info_callback: %s stats found for %d",(vardata->statsTuple == NULL) ? "No":"",relationObjectId);
-
-
-				elog( DEBUG3, "IND ADV: get_relation_info_callback: estimate virtual index pages for: %d",cand->idxoid);
-				elog( DEBUG3, "IND ADV: get_relation_info_callback: opno: %d",opno);
-				elog( DEBUG3, "IND ADV: get_relation_info_callback: cluse type : %d",nodeTag((Node *) linitial(info->indpred)));
-				elog( DEBUG3, "IND ADV: get_relation_info_callback: oprrest : %d",oprrest);
-				//elog( DEBUG3, "IND ADV: get_relation_info_callback: arg list length : %d",list_length(opclause->args));
-
-				/* Estimate selectivity for a restriction clause. */
-				btreeSelectivity = var_eq_cons(vardata, opno,cons->constvalue,
-								cons->constisnull,true);
-
-			}else
+			if( info->indpred )
+				btreeSelectivity = predicate_selectivity( root, rel, cand, info->indpred );
+			else
 			{
 				elog( DEBUG3, "IND ADV: get_relation_info_callback: no index predicates");
 				btreeSelectivity = 1;
@@ -1081,1300 +1747,1922 @@ static void get_relation_info_callback(	PlannerInfo	*root,
 			elog( DEBUG3, "IND ADV: get_relation_info_callback: selectivity = %.5f", btreeSelectivity);
 
 			/* estimate the size */
-			cand->pages = (BlockNumber)lrint(btreeSelectivity * estimate_index_pages(cand->reloid, cand->idxoid));
+			cand->pages = estimate_index_pages( rel, cand, btreeSelectivity * rel->tuples,
+												&cand->tree_height );
 			if(cand->pages == 0) // we must allocate at least 1 page
 				cand->pages=1;
 			info->pages = cand->pages;
+#if PG_VERSION_NUM >= 90300
+			info->tree_height = cand->tree_height;
+#endif
 			elog( DEBUG3, "IDX_ADV: get_relation_info_callback: pages: %d",info->pages);
 			info->tuples = (int) ceil(btreeSelectivity * rel->tuples);
 			cand->tuples = (int) ceil(btreeSelectivity * rel->tuples);
-			//elog( DEBUG3, "IND ADV: get_relation_info_callback: tuples: %d",info->tuples);
 		}
-		index_close(indexRelation, NoLock);
+
 		elog( DEBUG3 , "add the index to the indexinfos list");
-		indexinfos = lcons(info, indexinfos);
+		/* the real indexes built by get_relation_info() stay in the list */
+		rel->indexlist = lcons(info, rel->indexlist);
 	}
-        heap_close(relation, NoLock);
-	rel->indexlist = indexinfos;
+	heap_close(relation, NoLock);
 	elog( DEBUG1, "IDX ADV: get_relation_info_callback: cand list length %d",list_length(rel->indexlist));
 
     elog( DEBUG1, "IDX ADV: get_relation_info_callback: EXIT");
 }
 
-/* Use this function to reset the hooks that are required to be registered only
- * for a short while; these may have been left registered by the previous call, in
- * case of an ERROR.
+/**
+ * predicate_selectivity
+ *    the share of the relation's rows a partial index's predicate (the whole
+ * list, ANDed) keeps, as clauselist_selectivity() estimates it.
+ *
+ *     The candidates of a relation share their predicate (see table_clauses),
+ * so the result is kept in its RelClause for the rest of the advisement.
  */
-static void resetSecondaryHooks()
+static Selectivity predicate_selectivity( PlannerInfo* root, RelOptInfo* rel,
+				const IndexCandidate* cand, List* indpred )
 {
-	get_relation_info_hook		= NULL;
-	explain_get_index_name_hook	= NULL;
+	ListCell	*rcCell = get_rel_clausesCell( table_clauses, cand->reloid, cand->erefAlias );
+	RelClause	*rc = rcCell != NULL ? (RelClause*)lfirst( rcCell ) : NULL;
+	RelOptInfo	*saved;
+	Selectivity	selectivity;
+
+	if( rc != NULL && rc->selectivityValid )
+		return rc->selectivity;
+
+	/*
+	 * get_relation_info() runs before build_simple_rel() files the rel, but
+	 * the selectivity functions look the Vars' rel up; file it for the call.
+	 */
+	saved = root->simple_rel_array[ rel->relid ];
+	root->simple_rel_array[ rel->relid ] = rel;
+
+	selectivity = clauselist_selectivity( root, indpred, rel->relid, JOIN_INNER, NULL );
+
+	root->simple_rel_array[ rel->relid ] = saved;
+
+	elog( DEBUG3, "IND ADV: predicate_selectivity: %s: %.5f", cand->erefAlias, selectivity );
+
+	if( rc != NULL )
+	{
+		rc->selectivity = selectivity;
+		rc->selectivityValid = true;
+	}
+
+	return selectivity;
 }
 
-static bool is_virtual_index( Oid oid, IndexCandidate **cand_out )
+/*
+ * set_varno_walker
+ *    points all Vars of a virtual index expression/predicate at the given
+ * range table entry.
+ */
+static bool set_varno_walker( Node *node, Index *varno )
 {
-	ListCell *cell1;
+	if( node == NULL )
+		return false;
 
-	foreach( cell1, index_candidates )
+	if( IsA( node, Var ) )
 	{
-		IndexCandidate *cand = (IndexCandidate*)lfirst( cell1 );
-		//elog( DEBUG4 ,"is_virtual_index compare: oid:%d, cand:%d",oid,cand->idxoid);
-		if( cand->idxoid == oid )
+		Var *var = (Var *) node;
+
+		if( var->varlevelsup == 0 )
 		{
-			if( cand_out )
-				*cand_out = cand;
-			return true;
+			var->varno = *varno;
+			var->varnoold = *varno;
 		}
+		return false;
 	}
 
-	return false;
+	return expression_tree_walker( node, set_varno_walker, (void *) varno );
 }
 
-static const char * explain_get_index_name_callback(Oid indexId)
+/**
+ * get_supported_operators
+ *    returns the oids of the operators supported by the index adviser.
+ *
+ * They are looked up once per backend and kept in sorted arrays; a change in
+ * pg_operator makes us look them up again on the next call.
+ */
+static OpnosContext* get_supported_operators()
 {
-	StringInfoData buf;
-	IndexCandidate *cand;
-
-	elog( DEBUG1 ,"explain_get_index_name_callback: ENTER - looking at oid: %d",indexId);
-
-	if( is_virtual_index( indexId, &cand ) )
+	if( supportedOpnos == NULL )
 	{
-		elog( DEBUG1 ,"explain_get_index_name_callback: our virt index");
-		initStringInfo(&buf);
-
-		appendStringInfo( &buf, "<V-Index>:%d", cand->idxoid );
+		supportedOpnos = (OpnosContext*) MemoryContextAllocZero( TopMemoryContext,
+														sizeof(OpnosContext) );
+		CacheRegisterSyscacheCallback( OPEROID, operator_cache_callback, (Datum) 0 );
+	}
 
-		return buf.data;
+	/* a NULL array means an ERROR interrupted the previous lookup */
+	if( !supportedOpnosValid || supportedOpnos->gistopnos == NULL )
+	{
+		if( supportedOpnos->opnos ) pfree( supportedOpnos->opnos );
+		if( supportedOpnos->ginopnos ) pfree( supportedOpnos->ginopnos );
+		if( supportedOpnos->gistopnos ) pfree( supportedOpnos->gistopnos );
+		MemSet( supportedOpnos, 0, sizeof(OpnosContext) );
+
+		/* mark it valid first, an invalidation during the lookups wins */
+		supportedOpnosValid = true;
+
+		supportedOpnos->opnos = create_operator_array( SupportedOps,
+							lengthof(SupportedOps), &supportedOpnos->nopnos,
+							TopMemoryContext );
+		supportedOpnos->ginopnos = create_operator_array( SupportedGinOps,
+							lengthof(SupportedGinOps), &supportedOpnos->nginopnos,
+							TopMemoryContext );
+		supportedOpnos->gistopnos = create_operator_array( SupportedGistOps,
+							lengthof(SupportedGistOps), &supportedOpnos->ngistopnos,
+							TopMemoryContext );
 	}
 
-	elog( DEBUG1 ,"explain_get_index_name_callback: EXIT - not ours");
-	return NULL;                            /* allow default behavior */
+	return supportedOpnos;
 }
 
+/*
+ * operator_cache_callback
+ *    pg_operator changed; the arrays may be in use, so just mark them stale.
+ */
+static void operator_cache_callback( Datum arg, int cacheid, uint32 hashvalue )
+{
+	supportedOpnosValid = false;
+}
 
- /*!
-  * store_idx_advice
-  * \brief for every candidate insert an entry into IDX_ADV_TABL.
-  * @param  List* of candidates
-  */
-static void store_idx_advice( List* candidates , ExplainState * 	es )
-{
-	StringInfoData	query;	/*!< string for Query */
-	StringInfoData	cols;	/*!< string for Columns */
-	StringInfoData	pcols;	/*!< string for Partial clause Columns  */
-	StringInfoData	pvals;	/*!< string for Partial clause Values */
-	StringInfoData	op_class;	/*!< string for op class family */
-	StringInfoData	collationObjectId;	/*!< string for collation object */
-	StringInfoData	attList;	/*!< string for functional attributes */
-	StringInfoData	partialClause;	/*!< string for partial clause */
-	StringInfoData	indexDef;	/*!< string for index definition */
-	Oid				advise_oid;
-	List       *context;
+/*
+ * check_partial_columns
+ *    GUC check hook for index_adviser.cols: parse the list of column names
+ * once, instead of every time a clause is examined.
+ */
+static bool check_partial_columns( char **newval, void **extra, GucSource source )
+{
+	char			*rawstring;
+	List			*namelist;
 	ListCell		*cell;
-	ListCell   *indexpr_item;
-	List *rel_clauses = NIL;
+	PartialColumns	*cols;
+	int				i = 0;
 
+	/* SplitIdentifierString() scribbles on its input */
+	rawstring = pstrdup( *newval );
 
-	elog( DEBUG2, "IDX_ADV: store_idx_advice: ENTER" );
+	if( !SplitIdentifierString( rawstring, ',', &namelist ) )
+	{
+		GUC_check_errdetail( "List syntax is invalid." );
+		pfree( rawstring );
+		list_free( namelist );
+		return false;
+	}
 
-	Assert( list_length(candidates) != 0 );
+	cols = (PartialColumns*) malloc( offsetof(PartialColumns, names)
+									 + list_length( namelist ) * sizeof(NameData) );
+	if( cols == NULL )
+	{
+		pfree( rawstring );
+		list_free( namelist );
+		return false;
+	}
 
-	/*
-	 * Minimal check: check that IDX_ADV_TABL is at least visible to us. There
-	 * are a lot more checks we should do in order to not let the INSERT fail,
-	 * like permissions, datatype mis-match, etc., but we leave those checks
-	 * upto the executor.
-	 */
+	cols->ncols = list_length( namelist );
+	foreach( cell, namelist )
+		namestrcpy( &cols->names[i++], (char*) lfirst( cell ) );
 
-	/* find a relation named IDX_ADV_TABL on the search path */
-	advise_oid = RelnameGetRelid( IDX_ADV_TABL );
+	pfree( rawstring );
+	list_free( namelist );
 
-	if (advise_oid != InvalidOid)
-	{
-		Relation advise_rel = relation_open(advise_oid, AccessShareLock);
+	*extra = cols;
+	return true;
+}
 
-		if (advise_rel->rd_rel->relkind != RELKIND_RELATION
-			&& advise_rel->rd_rel->relkind != RELKIND_VIEW)
-		{
-			relation_close(advise_rel, AccessShareLock);
+/*
+ * assign_partial_columns
+ *    GUC assign hook for index_adviser.cols: install the parsed list and forget
+ * the attnums resolved for the previous one.
+ */
+static void assign_partial_columns( const char *newval, void *extra )
+{
+	partialColumns = (PartialColumns*) extra;
 
-			/* FIXME: add errdetail() and/or errcontext() calls here. */
-			ereport(ERROR,
-					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
-					 errmsg( IDX_ADV_ERROR_NTV )));
-		}
+	partial_columns_reset();
+}
 
-		relation_close(advise_rel, AccessShareLock);
-	}
-	else
+/*
+ * partial_columns_reset
+ *    forget the attnums resolved for all relations; the bitmaps live in the
+ * context of the hash table, so they go with it.
+ */
+static void partial_columns_reset( void )
+{
+	if( partialColumnsContext == NULL )
+		return;
+
+	MemoryContextDelete( partialColumnsContext );
+	partialColumnsContext = NULL;
+	partialColumnsByRel = NULL;
+}
+
+/*
+ * is_partial_column
+ *    is the column one of index_adviser.cols?
+ *
+ * The names are resolved into an attnum bitmap the first time a relation is
+ * looked at; DDL on the relation makes us resolve them again. The catalog
+ * lookups may accept invalidations that drop the entry or the whole table, so
+ * the bitmap is built before the entry is made.
+ */
+static bool is_partial_column( Oid relid, AttrNumber attno )
+{
+	PartialColumnsEntry	*entry;
+	Bitmapset			*attnums = NULL;
+	MemoryContext		oldcontext;
+	bool				found;
+	int					i;
+
+	if( partialColumns == NULL || partialColumns->ncols == 0 || attno <= 0 )
+		return false;
+
+	if( partialColumnsByRel != NULL )
 	{
-		/* FIXME: add errdetail() and/or errcontext() calls here. */
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_TABLE),
-				 errmsg( IDX_ADV_ERROR_NE )));
+		entry = (PartialColumnsEntry*) hash_search( partialColumnsByRel, &relid,
+													HASH_FIND, NULL );
+		if( entry != NULL )
+			return bms_is_member( attno, entry->attnums );
 	}
 
-	initStringInfo( &query );
-	initStringInfo( &cols );
-	initStringInfo( &pvals );
-	initStringInfo( &pcols );
-	initStringInfo( &op_class );
-	initStringInfo( &collationObjectId );
-	initStringInfo( &attList );
-	initStringInfo( &partialClause );
-	initStringInfo( &indexDef );
-
-	foreach( cell, candidates )
+	for( i = 0; i < partialColumns->ncols; ++i )
 	{
-		int i;
-		//int val;
-		IndexCandidate* idxcd = (IndexCandidate*)lfirst( cell );
+		AttrNumber colattno = get_attnum( relid, NameStr( partialColumns->names[i] ) );
 
-		if( !idxcd->idxused )
-			continue;
+		if( colattno > 0 )
+			attnums = bms_add_member( attnums, colattno );
+	}
 
-		/* pfree() the memory allocated for the previous candidate. FIXME: Avoid
-		 * meddling with the internals of a StringInfo, and try to use an API.
-		 */
-		/*if( cols.len > 0 )
-		{
-			pfree( cols.data );
-			cols.data = NULL;
-		}*/
-
-		resetStringInfo( &query );
-		resetStringInfo( &cols );
-		resetStringInfo( &pvals );
-		resetStringInfo( &pcols );
-		resetStringInfo( &op_class );
-		resetStringInfo( &collationObjectId );
-		resetStringInfo( &attList );
-		resetStringInfo( &partialClause );
-		resetStringInfo( &indexDef );
-
-		//initStringInfo( &cols );
-		indexpr_item = list_head(idxcd->attList);
-		context = deparse_context_for(idxcd->erefAlias, idxcd->reloid);
-
-                //elog( DEBUG2 , "IDX_ADV: store_idx_advice: num cols: %d ",idxcd->ncols);
-		for (i = 0; i < idxcd->ncols; ++i){
-			Oid         keycoltype;
-
-			appendStringInfo( &cols, "%s%d", (i>0?",":""), idxcd->varattno[i]);
-			appendStringInfo( &op_class, "%s%d", (i>0?",":""), idxcd->op_class[i]);
-			appendStringInfo( &collationObjectId, "%s%d", (i>0?",":""), idxcd->collationObjectId[i]);
-
-			if (idxcd->varattno[i] == 0)
-			{
-				/* expressional index */
-				Node       *indexkey;
-
-				indexkey = (Node *) lfirst(indexpr_item);
-				indexpr_item = lnext(indexpr_item);
-				keycoltype = exprType(indexkey); // get the attribut column type
-				//elog( DEBUG2 , "IND ADV: store_idx_advice: column collation: %d",exprCollation(indexkey)); // get the attribut collation
-				appendStringInfo(&attList,"%s%s", (i>0?",":""),deparse_expression(indexkey, context, false, false));
-				get_opclass_name(idxcd->op_class[i], keycoltype, &attList);
-				//elog( DEBUG2 , "IND ADV: store_idx_advice: column: %s",deparse_expression(indexkey, context, false, false));
-				//elog( DEBUG2 , "IND ADV: store_idx_advice: column opclass: %s",attList.data);
-			}
-			else
-			{
-				//elog( DEBUG2 , "IND ADV: store_idx_advice: column name: %s",get_attname(idxcd->reloid,idxcd->varattno[i]));
-				appendStringInfo(&attList,"%s%s", (i>0?",":""),get_attname(idxcd->reloid,idxcd->varattno[i]));
-			}
-		}
-		//elog( DEBUG2 , "IND ADV: store_idx_advice: const exsits %s",pg_get_indexdef_columns(idxcd->idxoid,2));
-		elog( DEBUG2 , "IDX_ADV: store_idx_advice: idx am %d",idxcd->amOid); 
-
-		//appendStringInfo(&attList,TextDatumGetCString(DirectFunctionCall2(pg_get_expr,CStringGetTextDatum(nodeToString(make_ands_explicit(idxcd->attList))), ObjectIdGetDatum(idxcd->reloid))));
-		//elog( DEBUG2 , "IND ADV: store_idx_advice - idxcd->attList: %s",TextDatumGetCString(DirectFunctionCall2(pg_get_expr,CStringGetTextDatum(nodeToString(make_ands_explicit(idxcd->attList))), ObjectIdGetDatum(idxcd->reloid))));
-		// TODO: go over this in a loop
-		if(table_clauses != NIL){
-			//int j=0;
-			//ListCell		*clausCell;
-			rel_clauses = get_rel_clauses(table_clauses, idxcd->reloid,idxcd->erefAlias);
-			//elog( INFO , "IND ADV: store_idx_advice: no where clause oid: %d, alias: %s, name: %s",idxcd->reloid,idxcd->erefAlias,get_rel_name(idxcd->reloid));
-
-			//elog( DEBUG2 , "IND ADV: store_idx_advice - rel_clauses: %s",TextDatumGetCString(DirectFunctionCall2(pg_get_expr,CStringGetTextDatum(nodeToString(make_ands_explicit(rel_clauses))), ObjectIdGetDatum(idxcd->reloid))));
-			if(rel_clauses != NIL){
-				 appendStringInfoString(&partialClause,deparse_expression((Node *)make_ands_explicit(rel_clauses), context, false, false));
-			}
-			//elog( DEBUG2 , "IND ADV: store_idx_advice: rel_clauses: %s",deparse_expression(make_ands_explicit(rel_clauses), context, false, false));
-		} else
+	if( partialColumnsByRel == NULL )
+	{
+		static bool callbackRegistered = false;
+		HASHCTL		ctl;
+
+		partialColumnsContext = AllocSetContextCreate( TopMemoryContext,
+													   "index_adviser partial columns",
+													   ALLOCSET_SMALL_MINSIZE,
+													   ALLOCSET_SMALL_INITSIZE,
+													   ALLOCSET_SMALL_MAXSIZE );
+
+		memset( &ctl, 0, sizeof(ctl) );
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(PartialColumnsEntry);
+		ctl.hash = oid_hash;
+		ctl.hcxt = partialColumnsContext;
+		partialColumnsByRel = hash_create( "index_adviser partial columns", 64,
+										   &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+
+		if( !callbackRegistered )
 		{
-			elog( DEBUG3 , "IND ADV: store_idx_advice: no where clause");
+			CacheRegisterRelcacheCallback( partial_columns_relcache_callback, (Datum) 0 );
+			callbackRegistered = true;
 		}
+	}
 
-		//appendStringInfo( &indexDef,"create index on %s(%s)%s%s",get_rel_name(idxcd->reloid),attList.data,partialClause.len>0?" where":"",partialClause.len>0?partialClause.data:"");
-		appendStringInfo( &indexDef,"create index on %s",get_rel_name(idxcd->reloid));
-		switch (idxcd->amOid)
-                {
-                	case BTREE_AM_OID:
-                                        break;
-                        case GIN_AM_OID:
-				appendStringInfo( &indexDef," USING GIN");
-                                        break;
-                        case GIST_AM_OID:
-				appendStringInfo( &indexDef," USING GIST");
-                                        break;
-#if PG_VERSION_NUM >= 90500
-                        case BRIN_AM_OID:
-				appendStringInfo( &indexDef," USING BRIN");
-                        	break;
-#endif
-                }
-		appendStringInfo( &indexDef,"(%s)%s%s",attList.data,partialClause.len>0?" where":"",partialClause.len>0?partialClause.data:"");
-
-
-		/* FIXME: Mention the column names explicitly after the table name. */
-		appendStringInfo( &query, "insert into %s.\""IDX_ADV_TABL"\" values ( %d, array[%s], %f, %d, %d, now(),array[%s],array[%s],array[%s],$$%s$$,$$%s$$,$$%s$$,$$%s$$);",
-									idxadv_schema,
-									idxcd->reloid,
-									cols.data,
-									idxcd->benefit,
-									idxcd->pages * BLCKSZ/1024, /* in KBs */
-									MyProcPid,
-									collationObjectId.data,
-									op_class.data,
-									op_class.data,
-									nodeToString(idxcd->attList),
-									nodeToString(rel_clauses),
-									strstr(debug_query_string,"explain ")!=NULL?(debug_query_string+8):debug_query_string, /* the explain cmd without the "explain " at the begining... - if it's not found return the original string*/
-									indexDef.data);
-		//elog( DEBUG4 , "IND ADV: store_idx_advice: build the index: create index on %s(%s)%s%s",idxcd->erefAlias,attList.data,partialClause.len>0?" where":"",partialClause.len>0?partialClause.data:"");
-
-		if( query.len > 0 )	/* if we generated any SQL */
-		{
-			//appendStringInfo(es->str, "read only, advice, index: %s\n",indexDef.data);
-
-			elog(DEBUG1, "IDX ADV: read only, advice: %s, \n index: %s\n",query.data,indexDef.data);
-			if (es != NULL) { appendStringInfo(es->str, "read only, advice, index: %s\n",indexDef.data); }
-
-			elog( DEBUG1, "SPI connection start - save advice");
-			if( SPI_connect() == SPI_OK_CONNECT )
-			{
-				elog( DEBUG1 , "IND ADV: store_idx_advice: build the insert query %s",query.data);
-				if( SPI_execute( query.data, false, 0 ) != SPI_OK_INSERT )
-						elog( WARNING, "IND ADV: SPI_execute failed while saving advice." );
-
-				elog( DEBUG1, "SPI connection finish");
-				if( SPI_finish() != SPI_OK_FINISH )
-					elog( WARNING, "IND ADV: SPI_finish failed while saving advice." );
-			}
-			else
-				elog( WARNING, "IND ADV: SPI_connect failed while saving advice." );
-		}
+	/* no catalog access from here on: nothing can invalidate the entry */
+	entry = (PartialColumnsEntry*) hash_search( partialColumnsByRel, &relid,
+												HASH_ENTER, &found );
+	if( !found )
+	{
+		oldcontext = MemoryContextSwitchTo( partialColumnsContext );
+		entry->attnums = bms_copy( attnums );
+		MemoryContextSwitchTo( oldcontext );
 	}
 
+	found = bms_is_member( attno, attnums );
+	bms_free( attnums );
+
+	return found;
+}
+
+/*
+ * partial_columns_relcache_callback
+ *    a column may have been added, dropped or renamed - resolve the names of
+ * that relation again on next use.
+ */
+static void partial_columns_relcache_callback( Datum arg, Oid relid )
+{
+	PartialColumnsEntry	*entry;
+
+	if( partialColumnsByRel == NULL )
+		return;
 
-	/* TODO: Propose to -hackers to introduce API to free a StringInfoData . */
-	if ( query.len > 0 )
-		pfree( query.data );
+	if( relid == InvalidOid )
+	{
+		partial_columns_reset();
+		return;
+	}
 
-	if ( cols.len > 0 )
-		pfree( cols.data );
+	entry = (PartialColumnsEntry*) hash_search( partialColumnsByRel, &relid,
+												HASH_FIND, NULL );
+	if( entry != NULL )
+	{
+		bms_free( entry->attnums );
+		hash_search( partialColumnsByRel, &relid, HASH_REMOVE, NULL );
+	}
+}
 
-	if ( pcols.len > 0 )
-		pfree( pcols.data );
+/* Use this function to reset the hooks that are required to be registered only
+ * for a short while; these may have been left registered by the previous call, in
+ * case of an ERROR.
+ */
+static void resetSecondaryHooks()
+{
+	get_relation_info_hook		= NULL;
+	explain_get_index_name_hook	= NULL;
+}
 
-	if ( pvals.len > 0 )
-		pfree( pvals.data );
+/**
+ * is_virtual_index
+ *    is the oid one of our virtual indexes? if so, return its candidate.
+ */
+static bool is_virtual_index( Oid oid, IndexCandidate **cand_out )
+{
+	VirtualIndexEntry *entry;
 
-	if ( attList.len > 0 )
-		pfree( attList.data );
+	if( virtual_indexes == NULL )
+		return false;
 
-	if ( partialClause.len > 0 )
-		pfree( partialClause.data );
-	if ( indexDef.len > 0 )
-		pfree( indexDef.data );
+	entry = (VirtualIndexEntry*) hash_search( virtual_indexes, &oid, HASH_FIND, NULL );
+	if( entry == NULL )
+		return false;
 
+	if( cand_out )
+		*cand_out = entry->cand;
 
-	elog( DEBUG3, "IND ADV: store_idx_advice: EXIT" );
+	return true;
 }
 
 /**
- * remove_irrelevant_candidates
- *
- * A candidate is irrelevant if it has one of the followingg properties:
- *
- * (a) it indexes an unsupported relation (system-relations or temp-relations)
- * (b) it matches an already present index.
- *
- * TODO Log the candidates as they are pruned, and remove the call to
- * log_candidates() in index_adviser() after this function is called.
- *
- * REALLY BIG TODO/FIXME: simplify this function.
- *
+ * free_index_candidates
+ *    release the candidates of the current advice together with their oid
+ * lookup table and the collected table clauses.
  */
-static List* remove_irrelevant_candidates( List* candidates )
+static void free_index_candidates( void )
 {
-	ListCell *cell = list_head(candidates);
-	ListCell *prev = NULL;
+	ListCell *cell;
 
-	while(cell != NULL)
+	if( virtual_indexes != NULL )
 	{
-		ListCell *old_cell = cell;
-
-		Oid base_rel_oid = ((IndexCandidate*)lfirst( cell ))->reloid;
-		Relation base_rel = heap_open( base_rel_oid, AccessShareLock );
+		hash_destroy( virtual_indexes );
+		virtual_indexes = NULL;
+	}
 
-		/* decide if the relation is unsupported. This check is now done before
-		 * creating a candidate in scan_generic_node(); but still keeping the
-		 * code here.
-		 */
-		// if((base_rel->rd_istemp == true) replaced
-                if((!RelationNeedsWAL(base_rel))
-			|| IsSystemRelation(base_rel))
-		{
-			ListCell *cell2;
-			ListCell *prev2;
-			ListCell *next;
+	foreach( cell, index_candidates )
+		pfree( (IndexCandidate*)lfirst( cell ) );
 
-			/* remove all candidates that are on currently unsupported relations */
-			elog( DEBUG1,
-					"Index candidate(s) on an unsupported relation (%d) found!",
-					base_rel_oid );
+	list_free( index_candidates );
+	index_candidates = NIL;
 
-			/* Remove all candidates with same unsupported relation */
-			for(cell2 = cell, prev2 = prev; cell2 != NULL; cell2 = next)
-			{
-				next = lnext(cell2);
+	foreach( cell, table_clauses )
+		pfree( (RelClause*)lfirst( cell ) );
 
-				if(((IndexCandidate*)lfirst(cell2))->reloid == base_rel_oid)
-				{
-					pfree((IndexCandidate*)lfirst(cell2));
-					candidates = list_delete_cell( candidates, cell2, prev2 );
+	list_free( table_clauses );
+	table_clauses = NIL;
+}
 
-					if(cell2 == cell)
-						cell = next;
-				}
-				else
-				{
-					prev2 = cell2;
-				}
-			}
-		}
-		else
-		{
-			/* Remove candidates that match any of already existing indexes.
-			 * The prefix old_ in these variables means 'existing' index
-			*/
+static const char * explain_get_index_name_callback(Oid indexId)
+{
+	StringInfoData buf;
+	IndexCandidate *cand;
 
-			/* get all index Oids */
-			ListCell	*index_cell;
-			List		*old_index_oids = RelationGetIndexList( base_rel );
+	elog( DEBUG1 ,"explain_get_index_name_callback: ENTER - looking at oid: %d",indexId);
 
-			foreach( index_cell, old_index_oids )
-			{
-				/* open index relation and get the index info */
-				Oid			old_index_oid	= lfirst_oid( index_cell );
-				Relation	old_index_rel	= index_open( old_index_oid,
-										AccessShareLock );
-				IndexInfo	*old_index_info	= BuildIndexInfo( old_index_rel );
+	if( is_virtual_index( indexId, &cand ) )
+	{
+		elog( DEBUG1 ,"explain_get_index_name_callback: our virt index");
+		initStringInfo(&buf);
 
-				/* We ignore expressional indexes and partial indexes */
-				if( old_index_rel->rd_index->indisvalid
-					&& old_index_info->ii_Expressions == NIL
-					&& old_index_info->ii_Predicate == NIL )
-				{
-					ListCell *cell2;
-					ListCell *prev2;
-					ListCell *next;
+		appendStringInfo( &buf, "<V-Index>:%d", cand->idxoid );
 
-					Assert( old_index_info->ii_Expressions == NIL );
-					Assert( old_index_info->ii_Predicate == NIL );
+		return buf.data;
+	}
 
-					/* search for a matching candidate */
-					for(cell2 = cell, prev2 = prev;
-						cell2 != NULL;
-						cell2 = next)
-					{next = lnext(cell2);{ /* FIXME: move this line to the block below; it doesn't need to be here. */
+	elog( DEBUG1 ,"explain_get_index_name_callback: EXIT - not ours");
+	return NULL;                            /* allow default behavior */
+}
 
-						IndexCandidate* cand = (IndexCandidate*)lfirst(cell2);
 
-						signed int cmp = (signed int)cand->ncols
-											- old_index_info->ii_NumIndexAttrs;
+ /*!
+  * prepare_advice_insert
+  * \brief return the saved plan inserting a batch of advice rows into IDX_ADV_TABL.
+  *
+  * Every column is passed as an array with one element per advice, so all the
+  * advice of a batch goes in with a single execution of a single plan. The plan
+  * is kept for the life of the backend and prepared again only when
+  * index_adviser.schema changes.
+  * Must be called while connected to SPI.
+  */
+static SPIPlanPtr prepare_advice_insert( void )
+{
+	static SPIPlanPtr	plan = NULL;
+	static char			*planSchema = NULL;
+	static bool			planAggregate = false;
+	Oid				argtypes[ IDX_ADV_INSERT_NARGS ];
+	StringInfoData	query;
+	SPIPlanPtr		newPlan;
+
+	if( plan != NULL && planSchema != NULL && strcmp( planSchema, idxadv_schema ) == 0
+		&& planAggregate == idxadv_aggregate )
+		return plan;
+
+	argtypes[0]		= get_array_type( OIDOID );			/* $1  reloid */
+	argtypes[1]		= get_array_type( TEXTOID );		/* $2  attrs */
+	argtypes[2]		= get_array_type( FLOAT4OID );		/* $3  benefit */
+	argtypes[3]		= get_array_type( INT4OID );		/* $4  index_size */
+	argtypes[4]		= get_array_type( INT4OID );		/* $5  backend_pid */
+	argtypes[5]		= get_array_type( TIMESTAMPTZOID );	/* $6  timestamp */
+	argtypes[6]		= get_array_type( TEXTOID );		/* $7  indcollation */
+	argtypes[7]		= get_array_type( TEXTOID );		/* $8  indclass */
+	argtypes[8]		= get_array_type( TEXTOID );		/* $9  indexprs */
+	argtypes[9]		= get_array_type( TEXTOID );		/* $10 indpred */
+	argtypes[10]	= get_array_type( TEXTOID );		/* $11 query */
+	argtypes[11]	= get_array_type( TEXTOID );		/* $12 recommendation */
+	argtypes[12]	= get_array_type( INT8OID );		/* $13 query fingerprint */
+	argtypes[13]	= get_array_type( FLOAT4OID );		/* $14 cost_saved_min */
+	argtypes[14]	= get_array_type( FLOAT4OID );		/* $15 cost_saved_p50 */
+	argtypes[15]	= get_array_type( FLOAT4OID );		/* $16 cost_saved_p90 */
+	argtypes[16]	= get_array_type( FLOAT4OID );		/* $17 cost_saved_max */
 
-						if(cmp == 0)
-						{
-							int i = 0;
-							do
-							{
-								cmp =
-									cand->varattno[i]
-									- old_index_info->ii_KeyAttrNumbers[i];
-								++i;
-							/* FIXME: should this while condition be: cmp==0&&(i<min(ncols,ii_NumIndexAttrs))
- 							 * maybe this is to eliminate candidates that are a prefix match of an existing index. */
-							} while((cmp == 0) && (i < cand->ncols));
-						}
+	initStringInfo( &query );
+	if( idxadv_aggregate )
+		appendStringInfo( &query,
+			"select %s."IDX_ADV_UPSERT"($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13,"
+				" $14, $15, $16, $17)",
+			idxadv_schema );
+	else
+		/* indoption gets the opclasses, as it always did */
+		appendStringInfo( &query,
+			"insert into %s.\""IDX_ADV_TABL"\" (reloid, attrs, benefit, index_size,"
+				" backend_pid, timestamp, indcollation, indclass, indoption,"
+				" indexprs, indpred, query, recommendation,"
+				" cost_saved_min, cost_saved_p50, cost_saved_p90, cost_saved_max)"
+			" select $1[i], $2[i]::int[], $3[i], $4[i], $5[i], $6[i],"
+				" $7[i]::int[], $8[i]::int[], $8[i]::int[], $9[i], $10[i], $11[i], $12[i],"
+				" $14[i], $15[i], $16[i], $17[i]"
+			" from generate_subscripts($1, 1) as i",
+			idxadv_schema );
+
+	elog( DEBUG1, "IND ADV: prepare_advice_insert: %s", query.data );
+
+	newPlan = SPI_prepare( query.data, IDX_ADV_INSERT_NARGS, argtypes );
+	pfree( query.data );
+
+	if( newPlan == NULL )
+	{
+		elog( WARNING, "IND ADV: SPI_prepare failed while saving advice: %s",
+			  SPI_result_code_string( SPI_result ) );
+		return NULL;
+	}
 
-						if(cmp != 0)
-						{
-							/* current candidate does not match the current
-							 * index, so go to next candidate.
-							 */
-							prev2 = cell2;
-						}
-						else
-						{
-							elog( DEBUG1,
-									"A candidate matches the index oid of : %d;"
-										"hence ignoring it.",
-							 		old_index_oid );
+	if( SPI_keepplan( newPlan ) != 0 )
+	{
+		elog( WARNING, "IND ADV: SPI_keepplan failed while saving advice." );
+		return NULL;
+	}
 
-							/* remove the candidate from the list */
-							candidates = list_delete_cell(candidates,
-															cell2, prev2);
-							pfree( cand );
+	/* swap in the new plan only now that it is safely saved */
+	if( plan != NULL )
+		SPI_freeplan( plan );
+	plan = newPlan;
 
-							/* If we just deleted the current node of the outer-most loop, fix that. */
-							if (cell2 == cell)
-								cell = next;
+	if( planSchema != NULL )
+		pfree( planSchema );
+	planSchema = MemoryContextStrdup( TopMemoryContext, idxadv_schema );
+	planAggregate = idxadv_aggregate;
 
-							break;	/* while */
-						}
-					}} /* for */
-				}
+	return plan;
+}
 
-				/* close index relation and free index info */
-				index_close( old_index_rel, AccessShareLock );
-				pfree( old_index_info );
-			}
+ /*!
+  * int_list_text
+  * \brief format an int array as an array literal, "{1,2,3}".
+  */
+static Datum int_list_text( const Oid* values, int n )
+{
+	StringInfoData	buf;
+	Datum			result;
+	int				i;
 
-			/* free the list of existing index Oids */
-			list_free( old_index_oids );
+	initStringInfo( &buf );
+	appendStringInfoChar( &buf, '{' );
+	for( i = 0; i < n; ++i )
+		appendStringInfo( &buf, "%s%d", (i>0?",":""), values[i] );
+	appendStringInfoChar( &buf, '}' );
 
-			/* clear the index-list, else the planner can not see the
-			 * virtual-indexes
-			 * TODO: Really?? Verify this.
-			 */
-			base_rel->rd_indexlist  = NIL;
-			base_rel->rd_indexvalid = 0;
-		}
+	result = CStringGetTextDatum( buf.data );
+	pfree( buf.data );
 
-		/* close the relation */
-		heap_close( base_rel, AccessShareLock );
+	return result;
+}
 
-		/*
-		 * Move the pointer forward, only if the crazy logic above did not do it
-		 * else, cell is already pointing to a new list-element that needs
-		 * processing
-		 */
-		if(cell == old_cell)
-		{
-			prev = cell;
-			cell = lnext(cell);
-		}
-	}
+ /*!
+  * insert_advice_records
+  * \brief insert the advice records into IDX_ADV_TABL, in one execution.
+  *
+  * Used both by store_idx_advice() and by the advice writer worker.
+  */
+void insert_advice_records( const AdviceRecord* records, int nrecords )
+{
+	Datum	*columns[ IDX_ADV_INSERT_NARGS ];
+	Datum	values[ IDX_ADV_INSERT_NARGS ];
+	bool	*unsampled;
+	int		dims[1];
+	int		lbs[1];
+	bool	pushed;
+	int		i;
 
-	return candidates;
-}
+	if( nrecords <= 0 )
+		return;
 
-/**
- * tag_and_remove_candidates
- *    tag every candidate we do use and remove those unneeded
- * Note: should i really remove or wait for cleanup?.
- */
-static void tag_and_remove_candidates(Cost startupCostSaved, Cost totalCostSaved,PlannedStmt		*new_plan, const Node* const head,List* const candidates)
-{
+	for( i = 0; i < IDX_ADV_INSERT_NARGS; ++i )
+		columns[i] = (Datum*) palloc( nrecords * sizeof(Datum) );
+	unsampled = (bool*) palloc( nrecords * sizeof(bool) );
 
-	if( startupCostSaved >0 || totalCostSaved > 0 )
+	for( i = 0; i < nrecords; ++i )
 	{
-		/* scan the plan for virtual indexes used */
-		plannedStmtGlobal = new_plan;
+		const AdviceRecord* const rec = &records[i];
+		Oid		attnos[ INDEX_MAX_KEYS ];
+		int		j;
+
+		for( j = 0; j < rec->ncols; ++j )
+			attnos[j] = rec->attrs[j];
+
+		columns[0][i]	= ObjectIdGetDatum( rec->reloid );
+		columns[1][i]	= int_list_text( attnos, rec->ncols );
+		columns[2][i]	= Float4GetDatum( rec->benefit );
+		columns[3][i]	= Int32GetDatum( rec->index_size );
+		columns[4][i]	= Int32GetDatum( rec->backend_pid );
+		columns[5][i]	= TimestampTzGetDatum( rec->timestamp );
+		columns[6][i]	= int_list_text( rec->indcollation, rec->ncols );
+		columns[7][i]	= int_list_text( rec->indclass, rec->ncols );
+		columns[8][i]	= CStringGetTextDatum( rec->indexprs );
+		columns[9][i]	= CStringGetTextDatum( rec->indpred );
+		columns[10][i]	= CStringGetTextDatum( rec->query != NULL ? rec->query : "" );
+		columns[11][i]	= CStringGetTextDatum( rec->recommendation );
+		columns[12][i]	= Int64GetDatum( (int64) rec->fingerprint );
+
+		/* the percentiles are NULL unless advised on bind value samples */
+		for( j = 0; j < ADVICE_SAMPLE_PERCENTILES; ++j )
+			columns[13 + j][i] = Float4GetDatum( rec->sampleCostSaved[j] );
+		unsampled[i] = !rec->sampled;
+	}
 
-		//elog_node_display( DEBUG4, "plan (using Index Adviser)",(Node*)new_plan->planTree, true );
+	values[0]	= PointerGetDatum( construct_array( columns[0], nrecords, OIDOID, sizeof(Oid), true, 'i' ) );
+	values[1]	= PointerGetDatum( construct_array( columns[1], nrecords, TEXTOID, -1, false, 'i' ) );
+	values[2]	= PointerGetDatum( construct_array( columns[2], nrecords, FLOAT4OID, sizeof(float4), FLOAT4PASSBYVAL, 'i' ) );
+	values[3]	= PointerGetDatum( construct_array( columns[3], nrecords, INT4OID, sizeof(int32), true, 'i' ) );
+	values[4]	= PointerGetDatum( construct_array( columns[4], nrecords, INT4OID, sizeof(int32), true, 'i' ) );
+	values[5]	= PointerGetDatum( construct_array( columns[5], nrecords, TIMESTAMPTZOID, sizeof(TimestampTz), FLOAT8PASSBYVAL, 'd' ) );
+	for( i = 6; i < 12; ++i )
+		values[i] = PointerGetDatum( construct_array( columns[i], nrecords, TEXTOID, -1, false, 'i' ) );
+	values[12]	= PointerGetDatum( construct_array( columns[12], nrecords, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd' ) );
+	dims[0] = nrecords;
+	lbs[0] = 1;
+	for( i = 13; i < IDX_ADV_INSERT_NARGS; ++i )
+		values[i] = PointerGetDatum( construct_md_array( columns[i], unsampled, 1, dims, lbs,
+														 FLOAT4OID, sizeof(float4), FLOAT4PASSBYVAL, 'i' ) );
+
+	/* don't advise on our own insert */
+	++SuppressRecursion;
+
+	/* we may be called from within an SPI procedure */
+	pushed = SPI_push_conditional();
+
+	elog( DEBUG1, "SPI connection start - save advice");
+	if( SPI_connect() == SPI_OK_CONNECT )
+	{
+		SPIPlanPtr plan = prepare_advice_insert();
+
+		if( plan != NULL )
+		{
+			int ret = SPI_execute_plan( plan, values, NULL, false, 0 );
 
-		mark_used_candidates( head, candidates );
+			if( ret != (idxadv_aggregate ? SPI_OK_SELECT : SPI_OK_INSERT) )
+				elog( WARNING, "IND ADV: SPI_execute_plan failed while saving advice." );
+		}
 
-		plannedStmtGlobal = NULL;
+		elog( DEBUG1, "SPI connection finish");
+		if( SPI_finish() != SPI_OK_FINISH )
+			elog( WARNING, "IND ADV: SPI_finish failed while saving advice." );
 	}
+	else
+		elog( WARNING, "IND ADV: SPI_connect failed while saving advice." );
 
-	elog( DEBUG3, "IND ADV: Remove unused candidates from the list" );
-	/* Remove unused candidates from the list. */
-	/*for( prev = NULL, cell = list_head(candidates);
-			cell != NULL;
-			cell = next )
-	{
-		IndexCandidate *cand = (IndexCandidate*)lfirst( cell );
+	SPI_pop_conditional( pushed );
 
-		next = lnext( cell );
+	--SuppressRecursion;
 
-		if( !cand->idxused )
-		{
-			pfree( cand );
-			candidates = list_delete_cell( candidates, cell, prev );
-		}
-		else
-			prev = cell;
-	}*/
+	for( i = 0; i < IDX_ADV_INSERT_NARGS; ++i )
+		pfree( columns[i] );
+	pfree( unsampled );
 }
 
 /**
- * mark_used_candidates
- *    scan the execution plan to find hypothetical indexes used by the planner
- * Note: there is no tree_walker for execution plans so we need to drill down ourselves.
+ * index_recommendation
+ *    the CREATE INDEX statement for a candidate. The predicate of a partial
+ * index is returned in rel_clauses.
  */
-static void mark_used_candidates(const Node* const node, List* const candidates)
+static char* index_recommendation( const IndexCandidate* idxcd, List** rel_clauses )
 {
-	const ListCell	*cell;
-	bool  planNode = true;	/* assume it to be a plan node */
-
-	elog( DEBUG3, "IND ADV: mark_used_candidates: ENTER" );
-
-     //TODO: remove this
-	//foreach( cell, candidates )
-	//{
-	//	/* is virtual-index-oid in the IndexScan-list? */
- //   	IndexCandidate* const idxcd = (IndexCandidate*)lfirst( cell );
- //   	idxcd->idxused = true;
-	//}
-	//return;
-	elog( DEBUG3, "IND ADV: mark_used_candidates: node tag: %d ", nodeTag( node ) );
-	switch( nodeTag( node ) )
-	{
-		/* if the node is an indexscan */
-		case T_IndexScan: // TAG: 110
-		{
-			/* are there any used virtual-indexes? */
-			const IndexScan* const idxScan = (const IndexScan*)node;
-			elog( DEBUG3, "IND ADV: mark_used_candidates: plan idx: %d ", idxScan->indexid );
+	StringInfoData	attList;	/*!< string for functional attributes */
+	StringInfoData	partialClause;	/*!< string for partial clause */
+	StringInfoData	indexDef;	/*!< string for index definition */
+	List       *context;
+	ListCell   *indexpr_item;
+	int			i;
 
-			foreach( cell, candidates )
-			{
+	initStringInfo( &attList );
+	initStringInfo( &partialClause );
+	initStringInfo( &indexDef );
+	*rel_clauses = NIL;
 
-				/* is virtual-index-oid in the IndexScan-list? */
-				IndexCandidate* const idxcd = (IndexCandidate*)lfirst( cell );
-				elog( DEBUG3, "IND ADV: mark_used_candidates: cand idx: %d ", idxcd->idxoid );
-				const bool used = (idxcd->idxoid == idxScan->indexid);
+	indexpr_item = list_head(idxcd->attList);
+	context = deparse_context_for(idxcd->erefAlias, idxcd->reloid);
 
-				/* connect the existing value per OR */
-				idxcd->idxused = (idxcd->idxused || used);
+	for (i = 0; i < idxcd->cols->ncols; ++i){
+		Oid         keycoltype;
 
-			}
+		if (idxcd->cols->varattno[i] == 0)
+		{
+			/* expressional index */
+			Node       *indexkey;
+
+			indexkey = (Node *) lfirst(indexpr_item);
+			indexpr_item = lnext(indexpr_item);
+			keycoltype = exprType(indexkey); // get the attribut column type
+			appendStringInfo(&attList,"%s%s", (i>0?",":""),deparse_expression(indexkey, context, false, false));
+			get_opclass_name(idxcd->cols->op_class[i], keycoltype, &attList);
 		}
-		break;
-		case T_IndexOnlyScan: // TAG: 110
+		else
 		{
-			/* are there any used virtual-indexes? */
-			const IndexOnlyScan* const idxScan = (const IndexOnlyScan*)node;
-			elog( DEBUG3, "IND ADV: mark_used_candidates: plan idx: %d ", idxScan->indexid );
-
-			foreach( cell, candidates )
-			{
-
-				/* is virtual-index-oid in the IndexScan-list? */
-				IndexCandidate* const idxcd = (IndexCandidate*)lfirst( cell );
-				elog( DEBUG3, "IND ADV: mark_used_candidates: cand idx: %d ", idxcd->idxoid );
-				const bool used = (idxcd->idxoid == idxScan->indexid);
-
-				/* connect the existing value per OR */
-				idxcd->idxused = (idxcd->idxused || used);
-
-			}
+			appendStringInfo(&attList,"%s%s", (i>0?",":""),get_attname(idxcd->reloid,idxcd->cols->varattno[i]));
 		}
-		break;
-
+	}
+	elog( DEBUG2 , "IDX_ADV: index_recommendation: idx am %d",idxcd->amOid);
 
-		/* if the node is a bitmap-index-scan */
-		case T_BitmapIndexScan:
-		{
-			/* are there any used virtual-indexes? */
-			const BitmapIndexScan* const bmiScan = (const BitmapIndexScan*)node;
-			elog( DEBUG3, "IND ADV: mark_used_candidates: plan idx: %d ", bmiScan->indexid );
+	// TODO: go over this in a loop
+	if(table_clauses != NIL){
+		*rel_clauses = get_rel_clauses(table_clauses, idxcd->reloid,idxcd->erefAlias);
+		if(*rel_clauses != NIL){
+			appendStringInfoString(&partialClause,deparse_expression((Node *)make_ands_explicit(*rel_clauses), context, false, false));
+		}
+	} else
+	{
+		elog( DEBUG3 , "IND ADV: index_recommendation: no where clause");
+	}
 
-			foreach( cell, candidates )
-			{
-				/* is virtual-index-oid in the BMIndexScan-list? */
-				IndexCandidate* const idxcd = (IndexCandidate*)lfirst( cell );
-				elog( DEBUG3, "IND ADV: mark_used_candidates: cand idx: %d ", idxcd->idxoid );
-				const bool used = idxcd->idxoid == bmiScan->indexid;
+	appendStringInfo( &indexDef,"create index on %s",get_rel_name(idxcd->reloid));
+	switch (idxcd->amOid)
+	{
+		case BTREE_AM_OID:
+			break;
+		case GIN_AM_OID:
+			appendStringInfo( &indexDef," USING GIN");
+			break;
+		case GIST_AM_OID:
+			appendStringInfo( &indexDef," USING GIST");
+			break;
+#if PG_VERSION_NUM >= 90500
+		case BRIN_AM_OID:
+			appendStringInfo( &indexDef," USING BRIN");
+			break;
+#endif
+	}
+	appendStringInfo( &indexDef,"(%s)%s%s",attList.data,partialClause.len>0?" where":"",partialClause.len>0?partialClause.data:"");
 
-				/* conntect the existing value per OR */
-				idxcd->idxused = idxcd->idxused || used;
-			}
-		}
-		break;
+	pfree( attList.data );
+	pfree( partialClause.data );
 
-		/* if the node is a bitmap-and */
-		case T_BitmapAnd:
-		{
-			/* are there any used virtual-indexes? */
-			const BitmapAnd* const bmiAndScan = (const BitmapAnd*)node;
+	return indexDef.data;
+}
 
-			foreach( cell, bmiAndScan->bitmapplans )
-				mark_used_candidates( (Node*)lfirst( cell ), candidates );
-		}
-		break;
+/**
+ * index_size_kb
+ *    the estimated size of the index in KBs, for an int column; the pages of
+ * a large index overflow 32 bits once multiplied out.
+ */
+static int32 index_size_kb( const IndexCandidate* idxcd )
+{
+	int64 size = (int64) idxcd->pages * (BLCKSZ / 1024);
 
-		/* if the node is a bitmap-or */
-		case T_BitmapOr:
-		{
-			/* are there any used virtual-indexes? */
-			const BitmapOr* const bmiOrScan = (const BitmapOr*)node;
+	return size > INT_MAX ? INT_MAX : (int32) size;
+}
 
-			foreach( cell, bmiOrScan->bitmapplans )
-				mark_used_candidates( (Node*)lfirst( cell ), candidates );
-		}
-		break;
+/**
+ * free_advice_record
+ *    frees the texts store_idx_advice() made for a record; the query text is
+ * not ours.
+ */
+static void free_advice_record( AdviceRecord* rec )
+{
+	pfree( rec->indexprs );
+	pfree( rec->indpred );
+	pfree( rec->recommendation );
+}
 
-		case T_SubqueryScan:
-		{
-			/* scan subqueryplan */
-			const SubqueryScan* const subScan = (const SubqueryScan*)node;
-			mark_used_candidates( (const Node*)subScan->subplan, candidates );
-		}
-		break;
+ /*!
+  * store_idx_advice
+  * \brief insert an entry into IDX_ADV_TABL for every used candidate.
+  *
+  * With index_adviser.async the entries are handed to the advice writer through
+  * the advice queue; whatever can't be queued is inserted right away.
+  * @param  List* of candidates
+  * @param  fingerprint of the advised query, for the aggregated advisory
+  */
+static void store_idx_advice( List* candidates , ExplainState * 	es, uint32 fingerprint )
+{
+	Oid				advise_oid;
+	ListCell		*cell;
+	List *rel_clauses = NIL;
+	char			*recommendation;
+	AdviceRecord	*records;
+	int				nrecords = 0;
+	int				nsync = 0;
+	const char		*query_text;
+	TimestampTz		now = GetCurrentTransactionStartTimestamp();	/* now() */
+	bool			useQueue = idxadv_async && advice_queue_available();
+	int				i;
 
-		case T_NestLoop:
-		case T_MergeJoin:
-		case T_HashJoin:
-		case T_Join:
-		{
-			/* scan join-quals */
-			const Join* const join = (const Join*)node;
+	elog( DEBUG2, "IDX_ADV: store_idx_advice: ENTER" );
 
-			foreach( cell, join->joinqual )
-			{
-				const Node* const qualPlan = (const Node*)lfirst( cell );
-				mark_used_candidates( qualPlan, candidates );
-			}
-		}
-		break;
+	Assert( list_length(candidates) != 0 );
 
-		case T_OpExpr:
-		{
-			const OpExpr* const expr = (const OpExpr*)node;
+	/*
+	 * Minimal check: check that IDX_ADV_TABL is at least visible to us. There
+	 * are a lot more checks we should do in order to not let the INSERT fail,
+	 * like permissions, datatype mis-match, etc., but we leave those checks
+	 * upto the executor.
+	 */
 
-			planNode = false;
+	/* find a relation named IDX_ADV_TABL on the search path */
+	advise_oid = RelnameGetRelid( IDX_ADV_TABL );
 
-			foreach( cell, expr->args )
-				mark_used_candidates( (const Node*)lfirst( cell ), candidates );
-		}
-		break;
+	if (advise_oid != InvalidOid)
+	{
+		Relation advise_rel = relation_open(advise_oid, AccessShareLock);
 
-		case T_SubPlan:
+		if (advise_rel->rd_rel->relkind != RELKIND_RELATION
+			&& advise_rel->rd_rel->relkind != RELKIND_VIEW)
 		{
-			/* scan the subplan */
-			const SubPlan* const subPlan = (const SubPlan*)node;
-
-			planNode = false;
+			relation_close(advise_rel, AccessShareLock);
 
-			mark_used_candidates( (const Node*)&plannedStmtGlobal->subplans[subPlan->plan_id], candidates );
+			/* FIXME: add errdetail() and/or errcontext() calls here. */
+			ereport(ERROR,
+					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+					 errmsg( IDX_ADV_ERROR_NTV )));
 		}
-		break;
 
+		relation_close(advise_rel, AccessShareLock);
+	}
+	else
+	{
+		/* FIXME: add errdetail() and/or errcontext() calls here. */
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg( IDX_ADV_ERROR_NE )));
+	}
 
-		case T_BoolExpr:
-		{
-			const BoolExpr* const expr = (const BoolExpr*)node;
+	/* the explain cmd without the "explain " at the begining... - if it's not found use the original string */
+	query_text = strstr(debug_query_string,"explain ")!=NULL?(debug_query_string+8):debug_query_string;
 
-			planNode = false;
+	records = (AdviceRecord*) palloc( list_length( candidates ) * sizeof(AdviceRecord) );
 
-			foreach( cell, expr->args )
-			{
-				const Node* const nodeBool = (const Node*)lfirst( cell );
-				mark_used_candidates( nodeBool, candidates );
-			}
-		}
-		break;
-		/*
-		case T_CoerceViaIO:
-		{
-			elog_node_display( DEBUG3 , "T_CoerceViaIO", node,true);
-		}
-		break;
-		*/
+	foreach( cell, candidates )
+	{
+		AdviceRecord* rec;
+		IndexCandidate* idxcd = (IndexCandidate*)lfirst( cell );
 
-		case T_FunctionScan:
-		case T_CteScan:
-		case T_RecursiveUnion:
-		case T_Result:
-		case T_Append:
-		case T_MergeAppend:
-		case T_TidScan:
-		case T_Material:
-		case T_Sort:
-		case T_Group:
-		case T_Agg:
-		case T_WindowAgg:
-		case T_Unique:
-		case T_Hash:
-		case T_SetOp:
-		case T_Limit:
-		case T_Scan:
-		case T_SeqScan:
-		case T_BitmapHeapScan:
+		if( !idxcd->idxused )
+			continue;
 
-		break;
+		recommendation = index_recommendation( idxcd, &rel_clauses );
 
-		case T_AlternativeSubPlan:
-		case T_FuncExpr:
-		case T_Const:
-		case T_MinMaxExpr:
-		case T_CoerceViaIO:
-		case T_ArrayCoerceExpr:
-                case T_NullTest:
-		case T_Var:
-			planNode = false;
-		break;
+		elog(DEBUG1, "IDX ADV: read only, advice, index: %s\n",recommendation);
+		if (es != NULL) { appendStringInfo(es->str, "read only, advice, index: %s\n",recommendation); }
 
-		/* report parse-node types that we missed */
-		default:
-		{
-			elog( NOTICE, "IND ADV: unhandled plan-node type: %d; Query: %s\n",
-					(int)nodeTag( node ), debug_query_string );
-			planNode = false;	/* stop scanning the tree here */
+		rec = &records[ nrecords++ ];
+		rec->reloid			= idxcd->reloid;
+		rec->ncols			= idxcd->cols->ncols;
+		for (i = 0; i < idxcd->cols->ncols; ++i){
+			rec->attrs[i]			= idxcd->cols->varattno[i];
+			rec->indcollation[i]	= idxcd->cols->collationObjectId[i];
+			rec->indclass[i]		= idxcd->cols->op_class[i];
 		}
-		break;
+		rec->benefit		= idxcd->benefit;
+		rec->index_size		= index_size_kb( idxcd );
+		rec->backend_pid	= MyProcPid;
+		rec->timestamp		= now;
+		rec->indexprs		= nodeToString( idxcd->attList );
+		rec->indpred		= nodeToString( rel_clauses );
+		rec->query			= (char*) query_text;
+		rec->recommendation	= recommendation;
+		rec->fingerprint	= fingerprint;
+		rec->sampled		= adviceSampled;
+		for (i = 0; i < ADVICE_SAMPLE_PERCENTILES; ++i)
+			rec->sampleCostSaved[i] = adviceSampled ? adviceSampleCostSaved[i] : 0;
 	}
 
-	if( planNode )
+	if( !idxadv_read_only )
 	{
-		const Plan* const plan = (Plan *) node;
-
-		if( plan->initPlan )
+		/* queue what we can; keep the rest at the front of the array */
+		for( i = 0; i < nrecords; ++i )
 		{
-			ListCell *cell;
-
-			foreach( cell, ((Plan*)node)->initPlan )
+			/* the queue keeps copies of the texts */
+			if( useQueue && advice_queue_push( &records[i] ) )
 			{
-				SubPlan *subPlan = (SubPlan*)lfirst( cell );
-
-				mark_used_candidates( (Node*)exec_subplan_get_plan(
-															plannedStmtGlobal,
-															subPlan),
-										candidates );
+				free_advice_record( &records[i] );
+				continue;
 			}
-		}
-
-		if( IsA(((Node*)plan), Append) )
-		{
-			Append	*appendplan = (Append *)node;
-			ListCell *cell;
-
-			foreach( cell, appendplan->appendplans )
-			{
-				Plan *child = (Plan*)lfirst( cell );
 
-				mark_used_candidates( (Node*)child, candidates );
-			}
+			if( nsync != i )
+				records[ nsync ] = records[ i ];
+			++nsync;
 		}
-                if( IsA(((Node*)plan), MergeAppend) )
-                {
-                        MergeAppend  *appendplan = (MergeAppend *)node;
-                        ListCell *cell;
-
-                        foreach( cell, appendplan->mergeplans )
-                        {
-                                Plan *child = (Plan*)lfirst( cell );
-
-                                mark_used_candidates( (Node*)child, candidates );
-                        }
-                }
-
 
-		/* scan left- and right-tree */
-		if( outerPlan(plan) )
-			mark_used_candidates( (const Node*)outerPlan(plan), candidates );
+		/* a standby or a read-only transaction can't take the insert - print only */
+		if( nsync > 0 && !RecoveryInProgress() && !XactReadOnly )
+			insert_advice_records( records, nsync );
+	}
+	else
+		nsync = nrecords;
 
-		if( innerPlan(plan) )
-			mark_used_candidates( (const Node*)innerPlan(plan), candidates );
+	for( i = 0; i < nsync; ++i )
+		free_advice_record( &records[i] );
 
-		/* walk through the qual-list */
-		foreach( cell, plan->qual )
-		{
-			const Node* const nodeQual = (const Node*)lfirst( cell );
-			mark_used_candidates( nodeQual, candidates );
-		}
-	}
+	pfree( records );
 
-	elog( DEBUG3, "IND ADV: mark_used_candidates: EXIT" );
+	elog( DEBUG3, "IND ADV: store_idx_advice: EXIT" );
 }
 
 /**
- * scan_query
- *    Runs thru the whole query to find columns to create index candidates.
- *   Note: We do not use the query_tree_walker here because it doesn't go into
- * GROUP BY, ORDER BY, and we also add aditional handeling of inheritence table expension.
+ * remove_irrelevant_candidates
+ *
+ * A candidate is irrelevant if it has one of the followingg properties:
+ *
+ * (a) it indexes an unsupported relation (system-relations or temp-relations)
+ * (b) it matches an already present index.
+ *
+ * TODO Log the candidates as they are pruned, and remove the call to
+ * log_candidates() in index_adviser() after this function is called.
+ *
+ * REALLY BIG TODO/FIXME: simplify this function.
+ *
  */
-static List* scan_query(	const Query* const query,
-				OpnosContext* context,
-				List* rangeTableStack )
+static List* remove_irrelevant_candidates( List* candidates )
 {
-	const ListCell*	cell;
-	List*		candidates		= NIL;
-	List*		newCandidates	= NIL;
-
-	elog( DEBUG4, "IND ADV: scan_query: ENTER" );
-
-	/* add the current rangetable to the stack */
-	rangeTableStack = lcons( query->rtable, rangeTableStack );
-	// TODO: can i use this to allow inheritance?
-	//elog_node_display( DEBUG4 , "query - print whole", query,true);
+	ListCell *cell = list_head(candidates);
+	ListCell *prev = NULL;
 
-	/* scan CTE-queries */
-	foreach( cell, query->cteList )
+	while(cell != NULL)
 	{
-		const CommonTableExpr* const rte = (const CommonTableExpr*)lfirst( cell );
-		elog( DEBUG3 , "IND ADV: scan_query: CTE working on: %s",rte->ctename);
+		ListCell *old_cell = cell;
 
-		if( rte->ctequery )
-		{
-			elog_node_display( DEBUG4 , "CTE query", rte->ctequery,true);
-			candidates = merge_candidates( candidates, scan_query(
-										rte->ctequery,
-										context,
-										rangeTableStack));
-		}
-	}
-
-	/* scan sub-queries */
-	foreach( cell, query->rtable )
-	{
-		const RangeTblEntry* const rte = (const RangeTblEntry*)lfirst( cell );
-		elog( DEBUG3 , "IND ADV: scan_query: SUB working on: %s",rte->eref->aliasname);
-		//elog( DEBUG3 , "IND ADV: scan_query: working on: %d",rte->rtekind);
+		Oid base_rel_oid = ((IndexCandidate*)lfirst( cell ))->reloid;
+		Relation base_rel = heap_open( base_rel_oid, AccessShareLock );
 
-		if( rte->subquery )
+		/* decide if the relation is unsupported. This check is now done before
+		 * creating a candidate in scan_generic_node(); but still keeping the
+		 * code here.
+		 */
+		// if((base_rel->rd_istemp == true) replaced
+                if((!RelationNeedsWAL(base_rel))
+			|| IsSystemRelation(base_rel))
 		{
-			elog_node_display( DEBUG4 , "sub query", rte->subquery,true);
-			candidates = merge_candidates( candidates, scan_query(
-										rte->subquery,
-										context,
-										rangeTableStack));
-		}
+			ListCell *cell2;
+			ListCell *prev2;
+			ListCell *next;
 
-		/* adding support for join clause */
-		if (rte->joinaliasvars)
-		{
-			//elog( DEBUG3 , "IND ADV: scan_query: join");
-			//elog( DEBUG3 , "IND ADV: scan_query: join type : %d",rte->jointype);
-			//elog_node_display( DEBUG4 , "sub query", rte->joinaliasvars,true);
-			candidates = merge_candidates( candidates, scan_generic_node( rte->joinaliasvars,
-											context,
-											rangeTableStack));
+			/* remove all candidates that are on currently unsupported relations */
+			elog( DEBUG1,
+					"Index candidate(s) on an unsupported relation (%d) found!",
+					base_rel_oid );
+
+			/* Remove all candidates with same unsupported relation */
+			for(cell2 = cell, prev2 = prev; cell2 != NULL; cell2 = next)
+			{
+				next = lnext(cell2);
+
+				if(((IndexCandidate*)lfirst(cell2))->reloid == base_rel_oid)
+				{
+					pfree((IndexCandidate*)lfirst(cell2));
+					candidates = list_delete_cell( candidates, cell2, prev2 );
+
+					if(cell2 == cell)
+						cell = next;
+				}
+				else
+				{
+					prev2 = cell2;
+				}
+			}
 		}
-	}
+		else
+		{
+			/* Remove candidates that match any of already existing indexes.
+			 * The prefix old_ in these variables means 'existing' index
+			*/
 
-	/* scan "where" from the current query */
-	if( query->jointree->quals != NULL )
-	{
-		newCandidates = scan_generic_node(	query->jointree->quals, context,
-							rangeTableStack );
-	}
+			/* get all index Oids */
+			ListCell	*index_cell;
+			List		*old_index_oids = RelationGetIndexList( base_rel );
 
-	/* FIXME: Why don't we consider the GROUP BY and ORDER BY clause
-	 * irrespective of whether we found candidates in WHERE clause?
-	 */
-        elog( DEBUG3, "IND ADV: scan_query: at FIXME");
+			foreach( index_cell, old_index_oids )
+			{
+				/* open index relation and get the index info */
+				Oid			old_index_oid	= lfirst_oid( index_cell );
+				Relation	old_index_rel	= index_open( old_index_oid,
+										AccessShareLock );
+				IndexInfo	*old_index_info	= BuildIndexInfo( old_index_rel );
 
-	/* if no indexcadidate found in "where", scan "group" */
-	if( ( newCandidates == NIL ) && ( query->groupClause != NULL ) )
-	{
-		newCandidates = scan_group_clause(	query->groupClause,
-							query->targetList,
-							context,
-							rangeTableStack );
-	}
+				/* We ignore expressional indexes and partial indexes */
+				if( old_index_rel->rd_index->indisvalid
+					&& old_index_info->ii_Expressions == NIL
+					&& old_index_info->ii_Predicate == NIL )
+				{
+					ListCell *cell2;
+					ListCell *prev2;
+					ListCell *next;
 
-	/* if no indexcadidate found in "group", scan "order by" */
-	if( ( newCandidates == NIL ) && ( query->sortClause != NULL ) )
-	{
-		newCandidates = scan_group_clause(	query->sortClause,
-							query->targetList,
-							context,
-							rangeTableStack );
-	}
-	/* if no indexcadidate found until now, scan the target list "select" */
-	if( ( newCandidates == NIL ) && ( query->targetList != NULL ) )
-	{
-		newCandidates = scan_targetList(	query->targetList,
-							context,
-							rangeTableStack );
-	}
+					Assert( old_index_info->ii_Expressions == NIL );
+					Assert( old_index_info->ii_Predicate == NIL );
 
-	/* remove the current rangetable from the stack */
-	rangeTableStack = list_delete_ptr( rangeTableStack, query->rtable );
+					/* search for a matching candidate */
+					for(cell2 = cell, prev2 = prev;
+						cell2 != NULL;
+						cell2 = next)
+					{next = lnext(cell2);{ /* FIXME: move this line to the block below; it doesn't need to be here. */
 
-	/* merge indexcandiates */
-	candidates = merge_candidates( candidates, newCandidates );
+						IndexCandidate* cand = (IndexCandidate*)lfirst(cell2);
 
-	/* expend inherited tables */
-	candidates = expand_inherited_candidates( candidates);
-	expand_inherited_rel_clauses();
+						signed int cmp = (signed int)cand->cols->ncols
+											- old_index_info->ii_NumIndexAttrs;
 
-	elog( DEBUG3, "IND ADV: scan_query: EXIT" );
+						if(cmp == 0)
+						{
+							int i = 0;
+							do
+							{
+								cmp =
+									cand->cols->varattno[i]
+									- old_index_info->ii_KeyAttrNumbers[i];
+								++i;
+							/* FIXME: should this while condition be: cmp==0&&(i<min(ncols,ii_NumIndexAttrs))
+ 							 * maybe this is to eliminate candidates that are a prefix match of an existing index. */
+							} while((cmp == 0) && (i < cand->cols->ncols));
+						}
 
-	return candidates;
-}
+						if(cmp != 0)
+						{
+							/* current candidate does not match the current
+							 * index, so go to next candidate.
+							 */
+							prev2 = cell2;
+						}
+						else
+						{
+							elog( DEBUG1,
+									"A candidate matches the index oid of : %d;"
+										"hence ignoring it.",
+							 		old_index_oid );
 
-/**
- * scan_group_clause
- *    Runs thru the GROUP BY clause looking for columns to create index candidates.
- */
-static List* scan_group_clause(	List* const groupList,
-			List* const targetList,
-			OpnosContext* context,
-			List* const rangeTableStack )
-{
-	const ListCell*	cell;
-	List* candidates = NIL;
+							/* remove the candidate from the list */
+							candidates = list_delete_cell(candidates,
+															cell2, prev2);
+							pfree( cand );
 
-	elog( DEBUG3, "IND ADV: scan_group_clause: ENTER" );
+							/* If we just deleted the current node of the outer-most loop, fix that. */
+							if (cell2 == cell)
+								cell = next;
 
-	/* scan every entry in the group-list */
-	foreach( cell , groupList )
-	{
-		/* convert to group-element */
-		const SortGroupClause* const groupElm = (const SortGroupClause*)lfirst( cell );
+							break;	/* while */
+						}
+					}} /* for */
+				}
 
-		/* get the column the group-clause is for */
-		const TargetEntry* const targetElm = list_nth( targetList,
-								groupElm->tleSortGroupRef - 1);
+				/* close index relation and free index info */
+				index_close( old_index_rel, AccessShareLock );
+				pfree( old_index_info );
+			}
 
-		/* scan the node and get candidates */
-		const Node* const node = (const Node*)targetElm->expr;
+			/* free the list of existing index Oids */
+			list_free( old_index_oids );
+		}
 
-		candidates = merge_candidates( candidates, scan_generic_node( node,
-							context,
-							rangeTableStack));
-	}
+		/* close the relation */
+		heap_close( base_rel, AccessShareLock );
 
-	elog( DEBUG3, "IND ADV: scan_group_clause: EXIT" );
+		/*
+		 * Move the pointer forward, only if the crazy logic above did not do it
+		 * else, cell is already pointing to a new list-element that needs
+		 * processing
+		 */
+		if(cell == old_cell)
+		{
+			prev = cell;
+			cell = lnext(cell);
+		}
+	}
 
 	return candidates;
 }
 
-
 /**
- * scan_targetList
- *    Runs thru the GROUP BY clause looking for columns to create index candidates.
+ * plan_candidates
+ *    plans a copy of the query, offering the planner only the active
+ * candidates, and marks the candidates the new plan uses.
  */
-static List* scan_targetList(	List* const targetList,
-				OpnosContext* context,
-				List* const rangeTableStack )
+static PlannedStmt* plan_candidates( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, List* candidates )
 {
-	const ListCell*	cell;
-	List* candidates = NIL;
-
-	elog( DEBUG3, "IND ADV: scan_targetList: ENTER" );
-
-	/* scan every entry in the target-list */
-	foreach( cell , targetList )
-	{
-		/* convert to TargetEntry - the column with the expression */
-		const TargetEntry* const targetElm = (const TargetEntry*)lfirst( cell );
+	PlannedStmt	*plan;
+	ListCell	*cell;
 
-		/* scan the node and get candidates */
-		const Node* const node = (const Node*)targetElm->expr;
+	foreach( cell, candidates )
+		((IndexCandidate*)lfirst( cell ))->idxused = false;
 
-		candidates = merge_candidates(  candidates, scan_generic_node( node,
-						context,
-						rangeTableStack));
-	}
+	/* planner() scribbles on it's input */
+	plan = standard_planner( (Query*)copyObject( query ), cursorOptions, boundParams );
 
-	elog( DEBUG3, "IND ADV: scan_targetList: EXIT" );
+	mark_used_candidates( plan, candidates );
 
-	return candidates;
+	return plan;
 }
 
-
-static bool index_candidates_walker (Node *root, ScanContext *context)
+/**
+ * measure_marginal_benefits
+ *    index_adviser.marginal_benefit: the benefit of each used candidate is the
+ * cost the plan gains when that candidate alone is taken away.
+ *
+ *     The candidates keep their virtual oids and sizes between the re-plans,
+ * so a re-plan costs just the planning; at most index_adviser.max_replans are
+ * made, and the candidates beyond that keep their share by size.
+ */
+static void measure_marginal_benefits( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, Cost newTotalCost, List* candidates )
 {
-	ListCell*		cell;
-	List*			candidates = NIL;
+	MemoryContext	searchContext = CurrentMemoryContext;
+	List			*used = NIL;
+	ListCell		*cell;
+	int				replans = 0;
 
-	elog( DEBUG4, "IND ADV: scan_generic_node: ENTER" );
-
-	   if (root == NULL)
-       return false;
-   	// check for nodes that special work is required for, eg:
+	foreach( cell, candidates )
+	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
 
+		if( cand->idxused )
+			used = lappend( used, cand );
+	}
 
-	elog( DEBUG4, "IND ADV: scan_generic_node, tag: %d", nodeTag( root ));
-	switch( nodeTag( root ) )
+	foreach( cell, used )
 	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+		MemoryContext	trialContext;
+		PlannedStmt		*plan;
+		Cost			delta;
 
-		/* if the node is a boolean-expression */
-		case T_BoolExpr:
-		{
-			const BoolExpr* const expr = (const BoolExpr*)root;
+		if( replans++ >= idxadv_max_replans )
+			break;
 
-			if( expr->boolop != AND_EXPR )
-			{
-				/* non-AND expression */
-				Assert( expr->boolop == OR_EXPR || expr->boolop == NOT_EXPR );
+		trialContext = AllocSetContextCreate( searchContext,
+											"index_adviser trial",
+											ALLOCSET_DEFAULT_MINSIZE,
+											ALLOCSET_DEFAULT_INITSIZE,
+											ALLOCSET_DEFAULT_MAXSIZE );
+		MemoryContextSwitchTo( trialContext );
 
-				foreach( cell, expr->args )
-				{
-					const Node* const node = (const Node*)lfirst( cell );
-					context->candidates = merge_candidates( context->candidates,
-											scan_generic_node( node, context->context,
-														context->rangeTableStack));
-				}
-			}
-			else
-			{
-				/* AND expression */
-				List* compositeCandidates = NIL;
+		cand->active = false;
+		plan = plan_candidates( query, cursorOptions, boundParams, candidates );
+		cand->active = true;
 
-				foreach( cell, expr->args )
-				{
-					const Node* const node = (const Node*)lfirst( cell );
-					List	*icList; /* Index candidate list */
-					List	*cicList; /* Composite index candidate list */
+		/* the planner may find an equally good plan without it */
+		delta = plan->planTree->total_cost - newTotalCost;
+		cand->benefit = delta > 0 ? (float4)delta : 0;
 
-					icList	= scan_generic_node( node, context->context, context->rangeTableStack );
-					cicList = build_composite_candidates(candidates, icList);
-					context->candidates = merge_candidates(context->candidates, icList);
-					compositeCandidates = merge_candidates(compositeCandidates,
-										cicList);
-				}
+		elog( DEBUG2, "IND ADV: measure_marginal_benefits: %d saves %.2f",
+			  cand->idxoid, cand->benefit );
 
-				/* now append the composite (multi-col) indexes to the list */
-				context->candidates = merge_candidates(context->candidates, compositeCandidates);
-			}
-			return false;
-		}
-		break;
+		MemoryContextSwitchTo( searchContext );
+		MemoryContextDelete( trialContext );
+	}
 
-		/* if the node is an operator */
-		case T_OpExpr:
-		{
-			/* get candidates if operator is supported */
-			const OpExpr* const expr = (const OpExpr*)root;
-			elog( DEBUG3 , "IND ADV: OpExpr: opno:%d, location:%d",expr->opno,expr->location);
+	/* plan_candidates() has re-marked them for every re-plan */
+	foreach( cell, candidates )
+		((IndexCandidate*)lfirst( cell ))->idxused = false;
 
-			if( list_member_oid( context->context->opnos, expr->opno ) || list_member_oid( context->context->ginopnos, expr->opno) )
-			{
-				bool foundToken = false;
-				/* this part extracts the expr to be used as the predicate for the partial index */
-				elog( DEBUG3 , "IND ADV: OpExpr: check context");
+	foreach( cell, used )
+		((IndexCandidate*)lfirst( cell ))->idxused = true;
 
-		                foreach( cell, expr->args )
-		                {
-					const Node* const node = (const Node*)lfirst( cell );
+	list_free( used );
+}
 
- 		 			elog( DEBUG4 , "IND ADV: OpExpr: check var %d",nodeTag(node));
-                    			if(nodeTag(node)==T_Var){
-			                        const Var* const e = (const Var*)(node);
-			                        List* rt = list_nth( context->rangeTableStack, e->varlevelsup );
-			                        const RangeTblEntry* rte = list_nth( rt, e->varno - 1 );
-						if (rte->rtekind == RTE_CTE) break; // break if working on CTE.
-                        			RelClause* rc = NULL;
-						char *token = NULL;
+/*! a candidate and the total cost of the plan using it alone */
+typedef struct {
+	IndexCandidate*	cand;
+	Cost			cost;
+} CandidateSeed;
 
-			                        elog( DEBUG3 , "IND ADV: OpExpr: working on: %s",rte->eref->aliasname);
-			                        char *varname = get_relid_attribute_name(rte->relid, e->varattno);
-			                        elog( DEBUG3 , "IND ADV: OpExpr: working on: %d",rte->relid);
-						char *token_str = strdup(idxadv_columns);
-
-						elog( DEBUG1 , "IND ADV: OpExpr: check right var, %s, cols: %s",varname,idxadv_columns);
-						token = strtok(token_str, ",");
-						elog( DEBUG1 , "IND ADV: token %s",token);
-						while (token && ! foundToken){
-							foundToken = (strcmp(token,varname)==0) ? true : false ;
-							token = strtok(NULL, ",");
-							elog( DEBUG4 , "IND ADV: token %s",token);
-						}
+static int candidate_seed_cmp( const void* a, const void* b )
+{
+	const CandidateSeed* const s1 = (const CandidateSeed*) a;
+	const CandidateSeed* const s2 = (const CandidateSeed*) b;
 
-                        			if (foundToken)
-			                        {
-			                            ListCell* relPredicates = get_rel_clausesCell(table_clauses, rte->relid,rte->eref->aliasname);
-			                            elog( INFO , "IND ADV: create the clause for: %s",rte->eref->aliasname);
-			                            if (relPredicates == NULL){
-                                Node* f = linitial(expr->args);
-                                Node* s = lsecond(expr->args);
-                                elog( DEBUG4 , "index candidate - create a new entry for the relation");
-                                // create a new entry for the relation
-                                rc = (RelClause*)palloc0(sizeof(RelClause));
-                                rc->reloid = rte->relid;
-                                rc->erefAlias = pstrdup(rte->eref->aliasname);
-                                if(nodeTag(f)==T_Var){
-                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) s, (Var*) f));
-                                }else{
-                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) f, (Var*) s));
-                                }
-                                elog( DEBUG4 , "IND ADV: created the clause");
+	if( s1->cost != s2->cost )
+		return s1->cost < s2->cost ? -1 : 1;
 
-                                table_clauses = lappend(table_clauses, rc );
-                            }else{
-                                //use the existing rc
-                                Node* f = linitial(expr->args);
-                                Node* s = lsecond(expr->args);
-                                elog( DEBUG4 , "index candidate - use the existing rc");
-                                rc = (RelClause*)lfirst( relPredicates );
-                                if(nodeTag(f)==T_Var){
-                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) s, (Var*) f));
-                                }else{
-                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) f, (Var*) s));
-                                }
-                                elog( DEBUG4 , "IND ADV: created the clause");
-                            }
+	return s1->cand->idxoid > s2->cand->idxoid ? -1 : 1;
+}
 
-                            //context = (QueryContext*)palloc0(sizeof(QueryContext));
-                            elog_node_display( DEBUG4 , "predicate", linitial(rc->predicate),true);
-                            //context->predicate = make_ands_implicit((Expr *) root);
+/**
+ * greedy_candidate_search
+ *    index_adviser.search = greedy: instead of offering the planner all the
+ * candidates at once, offer it small subsets.
+ *
+ *     First every candidate is planned alone (the seeds); those the planner
+ * does not use, or which do not beat the actual plan, are dropped. Then,
+ * cheapest seed first, each candidate is added to the set chosen so far and
+ * kept only if the plan gets cheaper. The cost it saves is its marginal
+ * benefit. A chosen candidate the cheaper plan stops using is dropped again,
+ * and its benefit goes to the one that replaced it. No more than
+ * index_adviser.max_replans plans are made.
+ *
+ * @returns the cheapest plan found (in a child of the current memory context),
+ * or NULL if no candidate improved on the actual plan. On return, the active
+ * and idxused flags mark the chosen candidates.
+ */
+static PlannedStmt* greedy_candidate_search( const Query* query, int cursorOptions,
+				ParamListInfo boundParams, Cost actualTotalCost, List* candidates )
+{
+	MemoryContext	searchContext = CurrentMemoryContext;
+	MemoryContext	bestContext = NULL;
+	PlannedStmt		*bestPlan = NULL;
+	Cost			bestCost = actualTotalCost;
+	CandidateSeed	*seeds;
+	ListCell		*cell;
+	int				nseeds = 0;
+	int				replans = 0;
+	int				i;
 
-                            elog( DEBUG4 , "index candidate - context->predicate set");
-                            break;
-                        }
-                    }
-                }
+	elog( DEBUG3, "IND ADV: greedy_candidate_search: ENTER" );
 
-				if(! foundToken){
-					foreach( cell, expr->args )
-					{
-						const Node* const node = (const Node*)lfirst( cell );
+	seeds = (CandidateSeed*) palloc( list_length( candidates ) * sizeof(CandidateSeed) );
 
-						context->candidates = merge_candidates( context->candidates,
-											scan_generic_node( node, context->context,
-													   context->rangeTableStack));
+	foreach( cell, candidates )
+		((IndexCandidate*)lfirst( cell ))->active = false;
 
-					}
-				}
-			}
-			return false;
-		}
-		break;
+	/* plan every candidate alone */
+	foreach( cell, candidates )
+	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+		MemoryContext	trialContext;
+		PlannedStmt		*plan;
 
-		/* if this case is reached, the variable is an index-candidate */
-		case T_Var:
+		if( replans >= idxadv_max_replans )
+			break;
+
+		trialContext = AllocSetContextCreate( searchContext,
+											"index_adviser trial",
+											ALLOCSET_DEFAULT_MINSIZE,
+											ALLOCSET_DEFAULT_INITSIZE,
+											ALLOCSET_DEFAULT_MAXSIZE );
+		MemoryContextSwitchTo( trialContext );
+
+		cand->active = true;
+		plan = plan_candidates( query, cursorOptions, boundParams, candidates );
+		++replans;
+		cand->active = false;
+
+		if( cand->idxused && plan->planTree->total_cost < actualTotalCost )
 		{
-			const Var* const expr = (const Var*)root;
-			List* rt = list_nth( context->rangeTableStack, expr->varlevelsup );
-			const RangeTblEntry* rte = list_nth( rt, expr->varno - 1 );
+			seeds[ nseeds ].cand = cand;
+			seeds[ nseeds ].cost = plan->planTree->total_cost;
+			++nseeds;
+		}
 
-			elog( DEBUG3 , "index candidate - var: %d rtekind: %d",expr->varattno,rte->rtekind);
+		MemoryContextSwitchTo( searchContext );
+		MemoryContextDelete( trialContext );
+	}
 
-			/* only relations have indexes */
-			if( rte->rtekind == RTE_RELATION )
-			{
-				Relation base_rel = heap_open( rte->relid, AccessShareLock );
-				elog( DEBUG3 , "index candidate - here %d %d %d %d %d",RelationNeedsWAL(base_rel),!IsSystemRelation(base_rel),expr->varattno,base_rel->rd_rel->relpages,base_rel->rd_rel->reltuples);
-				/* We do not support catalog tables and temporary tables */
-				if( RelationNeedsWAL(base_rel)
-					&& !IsSystemRelation(base_rel)
-					/* and don't recommend indexes on hidden/system columns */
-					&& expr->varattno > 0
-					/* and it should have at least two tuples */
-					//TODO: Do we really need these checks?
-					//&& base_rel->rd_rel->relpages > 1
-					//&& base_rel->rd_rel->reltuples > 1
-					)
-				{
-					/* create index-candidate and build a new list */
-					int				i;
-					TYPCATEGORY tcategory ;
-					IndexCandidate	*cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+	elog( DEBUG2, "IND ADV: greedy_candidate_search: %d of %d candidates help alone",
+		  nseeds, list_length( candidates ) );
 
-					elog( DEBUG3 , "index candidate - in here");
+	qsort( seeds, nseeds, sizeof(CandidateSeed), candidate_seed_cmp );
 
-					cand->varno         = expr->varno;
-					cand->varlevelsup   = expr->varlevelsup;
-					cand->ncols         = 1;
-					cand->reloid        = rte->relid;
-					cand->erefAlias     = pstrdup(rte->eref->aliasname);
-					cand->inh			= rte->inh;
-					elog( DEBUG3 , "index candidate - rel: %s, inh: %s",cand->erefAlias,BOOL_FMT(rte->inh));
-					cand->vartype[ 0 ]  = expr->vartype;
-					cand->varattno[ 0 ] = expr->varattno;
-					cand->varname[ 0 ]   = get_relid_attribute_name(rte->relid, expr->varattno);
-					elog( DEBUG3 , "index candidate - rel: %s, var: %s",cand->erefAlias,cand->varname[ 0 ]);
-					/*FIXME: Do we really need this loop? palloc0 and ncols,
-					 * above, should have taken care of this!
-					 */
-					tcategory = TypeCategory(expr->vartype);
-					cand->amOid = ((tcategory == TYPCATEGORY_ARRAY)||(tcategory == TYPCATEGORY_USER)) ? GIN_AM_OID : BTREE_AM_OID ;
-					elog( DEBUG3 , "index candidate - am: %d, category: %c",cand->amOid,tcategory);
-					for( i = 1; i < INDEX_MAX_KEYS; ++i )
-						cand->varattno[i] = 0;
+	/* add them to the chosen set, cheapest first */
+	for( i = 0; i < nseeds && replans < idxadv_max_replans; ++i )
+	{
+		IndexCandidate* const cand = seeds[ i ].cand;
+		MemoryContext	trialContext;
+		PlannedStmt		*plan;
+		float4			replaced = 0;
 
-					context->candidates = list_make1( cand );
-				}
+		trialContext = AllocSetContextCreate( searchContext,
+											"index_adviser trial",
+											ALLOCSET_DEFAULT_MINSIZE,
+											ALLOCSET_DEFAULT_INITSIZE,
+											ALLOCSET_DEFAULT_MAXSIZE );
+		MemoryContextSwitchTo( trialContext );
 
-				heap_close( base_rel, AccessShareLock );
-			}
-			return false;
-		}
-		break;
+		cand->active = true;
+		plan = plan_candidates( query, cursorOptions, boundParams, candidates );
+		++replans;
 
-		/* Query found */
-		case T_Query:
-		{
-			const Query* const query = (const Query*)root;
+		MemoryContextSwitchTo( searchContext );
 
-			context->candidates = scan_query( query, context->context, context->rangeTableStack );
-			return false;
-		}
-		break;
-		case T_WindowFunc:
+		if( !cand->idxused || plan->planTree->total_cost >= bestCost )
 		{
-		  elog(DEBUG4, "IDX_ADV: inside window func");
-		}break;
-		case T_MinMaxExpr:
-		{
-		  elog(DEBUG4, "IDX_ADV: inside T_MinMaxExpr func");
-		}break;
-#if PG_VERSION_NUM >= 90500
-		case T_GroupingFunc:
+			cand->active = false;
+			MemoryContextDelete( trialContext );
+			continue;
+		}
+
+		/* chosen candidates the new plan does without are dropped */
+		foreach( cell, candidates )
 		{
-		  elog(DEBUG4, "IDX_ADV: inside grouping func");
-		}break;
-#endif
-		/* create functional index */
-		case T_FuncExpr:
+			IndexCandidate* const other = (IndexCandidate*)lfirst( cell );
+
+			if( other->active && !other->idxused )
 			{
-				int				i;
-				bool			too_complex = false;
-				IndexCandidate	*cand;
-				//IndexCandidate	*cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
-				IndexElem *ind_elm = palloc0(sizeof(IndexElem));
-				FuncExpr* expr = (FuncExpr*) palloc0(sizeof(FuncExpr));
-				Node       *func_var; /* use this to find the relation info*/
+				other->active = false;
+				replaced += other->benefit;
+				other->benefit = 0;
+			}
+		}
 
-				elog(DEBUG4, "IND ADV: duplicate func expr properties.");
-				expr->xpr = ((const FuncExpr*)root)->xpr;
-				expr->funcid = ((const FuncExpr*)root)->funcid;
-				expr->funcresulttype = ((const FuncExpr*)root)->funcresulttype;
-				expr->funcretset = ((const FuncExpr*)root)->funcretset;
-				//expr->funcvariadic = ((const FuncExpr*)root)->funcvariadic;
-				expr->funcformat = ((const FuncExpr*)root)->funcformat;
-				expr->funccollid = ((const FuncExpr*)root)->funccollid;
-				expr->inputcollid = ((const FuncExpr*)root)->inputcollid;
-				expr->args = list_copy(((const FuncExpr*)root)->args);
-				expr->location = ((const FuncExpr*)root)->location;
+		cand->benefit = (float4)( bestCost - plan->planTree->total_cost ) + replaced;
 
-				elog(DEBUG4, "TBD: support functional indexes.");
-				//elog_node_display(DEBUG2,"Func Expr: ",root,true);
-				elog_node_display(DEBUG2,"Func Expr: ",expr,true);
-				//ind_elm->type = T_FuncExpr;
-				//ind_elm->name = NULL;
-				//ind_elm->expr = (Node *)expr;
-				//ind_elm->indexcolname = NULL;
-				//ind_elm->collation = NIL;
-				//ind_elm->opclass = NIL; //TODO: change to the opclass needed for varchar_pattern_ops
-				//ind_elm->ordering = SORTBY_DEFAULT ;
-				//ind_elm->nulls_ordering = SORTBY_NULLS_DEFAULT ;
+		elog( DEBUG2, "IND ADV: greedy_candidate_search: chose %d, cost %.2f -> %.2f",
+			  cand->idxoid, bestCost, plan->planTree->total_cost );
 
+		bestCost = plan->planTree->total_cost;
+		bestPlan = plan;
+		if( bestContext != NULL )
+			MemoryContextDelete( bestContext );
+		bestContext = trialContext;
+	}
 
+	pfree( seeds );
 
-				/* TODO: support func indexes.
-				* currently we only support functions with variables on the first parameter.
-				* other types of functions will be ignored.
-				*/
-				//	indexInfo->ii_KeyAttrNumbers[attn] = 0; /* marks expression */
-				//  indexInfo->ii_Expressions = lappend(indexInfo->ii_Expressions, expr);
+	/* the flags describe the best plan */
+	foreach( cell, candidates )
+	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
 
-				// get to the buttom Var
-				elog( DEBUG4 , "index candidate - get to buttom var");
-				if(list_length(expr->args)==0) { break;} // don't create indexes for expressions with no variables
-				func_var = list_nth(expr->args,0);
-				elog( DEBUG4 , "index candidate - get to buttom type: %d",func_var->type);
-				elog_node_display(DEBUG2,"Func Expr: - maybe ",func_var,true);
+		cand->idxused = cand->active;
+		if( !cand->active )
+			cand->benefit = 0;
+	}
+
+	elog( DEBUG1, "IND ADV: greedy_candidate_search: EXIT after %d plans", replans );
+
+	return bestPlan;
+}
+
+/**
+ * tag_and_remove_candidates
+ *    tag every candidate we do use and remove those unneeded
+ * Note: should i really remove or wait for cleanup?.
+ */
+static void tag_and_remove_candidates(Cost startupCostSaved, Cost totalCostSaved,PlannedStmt		*new_plan, List* const candidates)
+{
+
+	if( startupCostSaved >0 || totalCostSaved > 0 )
+	{
+		/* scan the plan for virtual indexes used */
+
+		//elog_node_display( DEBUG4, "plan (using Index Adviser)",(Node*)new_plan->planTree, true );
+
+		mark_used_candidates( new_plan, candidates );
+	}
+
+	elog( DEBUG3, "IND ADV: Remove unused candidates from the list" );
+	/* Remove unused candidates from the list. */
+	/*for( prev = NULL, cell = list_head(candidates);
+			cell != NULL;
+			cell = next )
+	{
+		IndexCandidate *cand = (IndexCandidate*)lfirst( cell );
+
+		next = lnext( cell );
+
+		if( !cand->idxused )
+		{
+			pfree( cand );
+			candidates = list_delete_cell( candidates, cell, prev );
+		}
+		else
+			prev = cell;
+	}*/
+}
+
+/**
+ * mark_used_candidates
+ *    scan the execution plan to find hypothetical indexes used by the planner.
+ * The main plan and every SubPlan/InitPlan of the statement are walked once,
+ * collecting the used virtual indexes in a bitmapset; then each candidate
+ * is marked by a single lookup.
+ */
+static void mark_used_candidates( const PlannedStmt* const stmt, List* const candidates )
+{
+	Bitmapset	*used = NULL;
+	ListCell	*cell;
+
+	elog( DEBUG3, "IND ADV: mark_used_candidates: ENTER" );
+
+	collect_used_indexes( stmt->planTree, &used );
+
+	/* InitPlans and SubPlans all live in the statement's subplans list */
+	foreach( cell, stmt->subplans )
+		collect_used_indexes( (const Plan*)lfirst( cell ), &used );
+
+	foreach( cell, candidates )
+	{
+		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+
+		if( bms_is_member( IDX_ADV_FIRST_VIRTUAL_OID - cand->idxoid, used ) )
+			cand->idxused = true;
+	}
+
+	bms_free( used );
+
+	elog( DEBUG3, "IND ADV: mark_used_candidates: EXIT" );
+}
+
+/**
+ * collect_used_indexes
+ *    adds the virtual indexes scanned in the plan tree to *used, as offsets
+ * from IDX_ADV_FIRST_VIRTUAL_OID. Children are reached through lefttree/righttree
+ * (this covers joins, Gather, Hash, Sort, RecursiveUnion, ...) and through the
+ * child lists of the nodes that have one. Expressions are not searched: a
+ * SubPlan in a qual is one of PlannedStmt.subplans, which the caller walks.
+ * Note: there is no tree_walker for execution plans so we need to drill down ourselves.
+ */
+static void collect_used_indexes( const Plan* const plan, Bitmapset** used )
+{
+	const ListCell	*cell;
+	List	*children = NIL;
+	Oid		indexid = InvalidOid;
+
+	if( plan == NULL )
+		return;
+
+	switch( nodeTag( plan ) )
+	{
+		case T_IndexScan:
+			indexid = ((const IndexScan*)plan)->indexid;
+			break;
+
+		case T_IndexOnlyScan:
+			indexid = ((const IndexOnlyScan*)plan)->indexid;
+			break;
+
+		case T_BitmapIndexScan:
+			indexid = ((const BitmapIndexScan*)plan)->indexid;
+			break;
+
+		case T_BitmapAnd:
+			children = ((const BitmapAnd*)plan)->bitmapplans;
+			break;
+
+		case T_BitmapOr:
+			children = ((const BitmapOr*)plan)->bitmapplans;
+			break;
+
+		case T_Append:
+			children = ((const Append*)plan)->appendplans;
+			break;
+
+		case T_MergeAppend:
+			children = ((const MergeAppend*)plan)->mergeplans;
+			break;
+
+		case T_ModifyTable:
+			children = ((const ModifyTable*)plan)->plans;
+			break;
+
+		case T_SubqueryScan:
+			collect_used_indexes( ((const SubqueryScan*)plan)->subplan, used );
+			break;
+
+#if PG_VERSION_NUM >= 90500
+		case T_CustomScan:
+			children = ((const CustomScan*)plan)->custom_plans;
+			break;
+#endif
+
+		default:
+			break;
+	}
+
+	/* only the virtual oids are close enough to IDX_ADV_FIRST_VIRTUAL_OID for a small set */
+	if( OidIsValid( indexid ) && is_virtual_index( indexid, NULL ) )
+		*used = bms_add_member( *used, IDX_ADV_FIRST_VIRTUAL_OID - indexid );
+
+	foreach( cell, children )
+		collect_used_indexes( (const Plan*)lfirst( cell ), used );
+
+	collect_used_indexes( outerPlan( plan ), used );
+	collect_used_indexes( innerPlan( plan ), used );
+}
+
+/**
+ * scan_query
+ *    Runs thru the whole query to find columns to create index candidates.
+ *   Note: We do not use the query_tree_walker here because it doesn't go into
+ * GROUP BY, ORDER BY, and we also add aditional handeling of inheritence table expension.
+ */
+static List* scan_query(	const Query* const query,
+				OpnosContext* context,
+				List* rangeTableStack )
+{
+	const ListCell*	cell;
+	List*		candidates		= NIL;
+	List*		newCandidates	= NIL;
+
+	elog( DEBUG4, "IND ADV: scan_query: ENTER" );
+
+	/* add the current rangetable to the stack */
+	rangeTableStack = lcons( query->rtable, rangeTableStack );
+	// TODO: can i use this to allow inheritance?
+	//elog_node_display( DEBUG4 , "query - print whole", query,true);
+
+	/* scan CTE-queries */
+	foreach( cell, query->cteList )
+	{
+		const CommonTableExpr* const rte = (const CommonTableExpr*)lfirst( cell );
+		elog( DEBUG3 , "IND ADV: scan_query: CTE working on: %s",rte->ctename);
+
+		if( rte->ctequery )
+		{
+			elog_node_display( DEBUG4 , "CTE query", rte->ctequery,true);
+			candidates = merge_candidates( candidates, scan_query(
+										rte->ctequery,
+										context,
+										rangeTableStack));
+		}
+	}
+
+	/* scan sub-queries */
+	foreach( cell, query->rtable )
+	{
+		const RangeTblEntry* const rte = (const RangeTblEntry*)lfirst( cell );
+		elog( DEBUG3 , "IND ADV: scan_query: SUB working on: %s",rte->eref->aliasname);
+		//elog( DEBUG3 , "IND ADV: scan_query: working on: %d",rte->rtekind);
+
+		if( rte->subquery )
+		{
+			elog_node_display( DEBUG4 , "sub query", rte->subquery,true);
+			candidates = merge_candidates( candidates, scan_query(
+										rte->subquery,
+										context,
+										rangeTableStack));
+		}
+
+		/* adding support for join clause */
+		if (rte->joinaliasvars)
+		{
+			//elog( DEBUG3 , "IND ADV: scan_query: join");
+			//elog( DEBUG3 , "IND ADV: scan_query: join type : %d",rte->jointype);
+			//elog_node_display( DEBUG4 , "sub query", rte->joinaliasvars,true);
+			candidates = merge_candidates( candidates, scan_generic_node( rte->joinaliasvars,
+											context,
+											rangeTableStack));
+		}
+	}
+
+	/* scan "where" from the current query */
+	if( query->jointree->quals != NULL )
+	{
+		newCandidates = scan_generic_node(	query->jointree->quals, context,
+							rangeTableStack );
+	}
+
+	/* FIXME: Why don't we consider the GROUP BY and ORDER BY clause
+	 * irrespective of whether we found candidates in WHERE clause?
+	 */
+        elog( DEBUG3, "IND ADV: scan_query: at FIXME");
+
+	/* if no indexcadidate found in "where", scan "group" */
+	if( ( newCandidates == NIL ) && ( query->groupClause != NULL ) )
+	{
+		newCandidates = scan_group_clause(	query->groupClause,
+							query->targetList,
+							context,
+							rangeTableStack );
+	}
+
+	/* if no indexcadidate found in "group", scan "order by" */
+	if( ( newCandidates == NIL ) && ( query->sortClause != NULL ) )
+	{
+		newCandidates = scan_group_clause(	query->sortClause,
+							query->targetList,
+							context,
+							rangeTableStack );
+	}
+	/* if no indexcadidate found until now, scan the target list "select" */
+	if( ( newCandidates == NIL ) && ( query->targetList != NULL ) )
+	{
+		newCandidates = scan_targetList(	query->targetList,
+							context,
+							rangeTableStack );
+	}
+
+#if PG_VERSION_NUM >= 90200
+	/* for index-only scans: the candidates extended by the other columns read */
+	newCandidates = merge_candidates( newCandidates,
+								build_covering_candidates( query, newCandidates ) );
+#endif
+
+	/* remove the current rangetable from the stack */
+	rangeTableStack = list_delete_ptr( rangeTableStack, query->rtable );
+
+	/* merge indexcandiates */
+	candidates = merge_candidates( candidates, newCandidates );
+
+	/* expend inherited tables */
+	candidates = expand_inherited_candidates( candidates);
+	expand_inherited_rel_clauses();
+
+	elog( DEBUG3, "IND ADV: scan_query: EXIT" );
+
+	return candidates;
+}
+
+/**
+ * scan_group_clause
+ *    Runs thru the GROUP BY clause looking for columns to create index candidates.
+ */
+static List* scan_group_clause(	List* const groupList,
+			List* const targetList,
+			OpnosContext* context,
+			List* const rangeTableStack )
+{
+	const ListCell*	cell;
+	List* candidates = NIL;
+
+	elog( DEBUG3, "IND ADV: scan_group_clause: ENTER" );
+
+	/* scan every entry in the group-list */
+	foreach( cell , groupList )
+	{
+		/* convert to group-element */
+		const SortGroupClause* const groupElm = (const SortGroupClause*)lfirst( cell );
+
+		/* get the column the group-clause is for */
+		const TargetEntry* const targetElm = list_nth( targetList,
+								groupElm->tleSortGroupRef - 1);
+
+		/* scan the node and get candidates */
+		const Node* const node = (const Node*)targetElm->expr;
+
+		candidates = merge_candidates( candidates, scan_generic_node( node,
+							context,
+							rangeTableStack));
+	}
+
+	elog( DEBUG3, "IND ADV: scan_group_clause: EXIT" );
+
+	return candidates;
+}
+
+
+/**
+ * scan_targetList
+ *    Runs thru the GROUP BY clause looking for columns to create index candidates.
+ */
+static List* scan_targetList(	List* const targetList,
+				OpnosContext* context,
+				List* const rangeTableStack )
+{
+	const ListCell*	cell;
+	List* candidates = NIL;
+
+	elog( DEBUG3, "IND ADV: scan_targetList: ENTER" );
+
+	/* scan every entry in the target-list */
+	foreach( cell , targetList )
+	{
+		/* convert to TargetEntry - the column with the expression */
+		const TargetEntry* const targetElm = (const TargetEntry*)lfirst( cell );
+
+		/* scan the node and get candidates */
+		const Node* const node = (const Node*)targetElm->expr;
+
+		candidates = merge_candidates(  candidates, scan_generic_node( node,
+						context,
+						rangeTableStack));
+	}
+
+	elog( DEBUG3, "IND ADV: scan_targetList: EXIT" );
+
+	return candidates;
+}
+
+
+static bool index_candidates_walker (Node *root, ScanContext *context)
+{
+	ListCell*		cell;
+	List*			candidates = NIL;
+
+	elog( DEBUG4, "IND ADV: scan_generic_node: ENTER" );
+
+	   if (root == NULL)
+       return false;
+   	// check for nodes that special work is required for, eg:
+
+
+	elog( DEBUG4, "IND ADV: scan_generic_node, tag: %d", nodeTag( root ));
+	switch( nodeTag( root ) )
+	{
+
+		/* if the node is a boolean-expression */
+		case T_BoolExpr:
+		{
+			const BoolExpr* const expr = (const BoolExpr*)root;
+
+			if( expr->boolop != AND_EXPR )
+			{
+				/* non-AND expression */
+				Assert( expr->boolop == OR_EXPR || expr->boolop == NOT_EXPR );
+
+				foreach( cell, expr->args )
+				{
+					const Node* const node = (const Node*)lfirst( cell );
+					context->candidates = merge_candidates( context->candidates,
+											scan_generic_node( node, context->context,
+														context->rangeTableStack));
+				}
+			}
+			else
+			{
+				/* AND expression */
+				List* columns = NIL;	/* the columns the composites are made of */
+
+				foreach( cell, expr->args )
+				{
+					const Node* const node = (const Node*)lfirst( cell );
+					const bool equality = clause_is_equality( node );
+					List	*icList; /* Index candidate list */
+					ListCell *icCell;
+
+					icList	= scan_generic_node( node, context->context, context->rangeTableStack );
+
+					/* plain btree columns can be combined */
+					foreach( icCell, icList )
+					{
+						IndexCandidate* const cand = (IndexCandidate*)lfirst( icCell );
+						CompositeColumn* col;
+
+						if( cand->cols->ncols != 1 || cand->cols->varattno[0] <= 0
+							|| cand->amOid != BTREE_AM_OID )
+							continue;
+
+						col = (CompositeColumn*)palloc( sizeof(CompositeColumn) );
+						col->cand = cand;
+						col->equality = equality;
+						col->ndistinct = column_n_distinct( cand->reloid, cand->cols->varattno[0] );
+						columns = lappend( columns, col );
+					}
+
+					context->candidates = merge_candidates(context->candidates, icList);
+				}
+
+				/* now append the composite (multi-col) indexes to the list */
+				context->candidates = merge_candidates(context->candidates,
+										build_composite_candidates( columns ));
+				list_free_deep( columns );
+			}
+			return false;
+		}
+		break;
+
+		/* if the node is an operator */
+		case T_OpExpr:
+		{
+			/* get candidates if operator is supported */
+			const OpExpr* const expr = (const OpExpr*)root;
+			elog( DEBUG3 , "IND ADV: OpExpr: opno:%d, location:%d",expr->opno,expr->location);
+
+			if( operator_in_array( expr->opno, context->context->opnos, context->context->nopnos )
+				|| operator_in_array( expr->opno, context->context->ginopnos, context->context->nginopnos ) )
+			{
+				bool foundToken = false;
+				/* this part extracts the expr to be used as the predicate for the partial index */
+				elog( DEBUG3 , "IND ADV: OpExpr: check context");
+
+		                foreach( cell, expr->args )
+		                {
+					const Node* const node = (const Node*)lfirst( cell );
+
+ 		 			elog( DEBUG4 , "IND ADV: OpExpr: check var %d",nodeTag(node));
+                    			if(nodeTag(node)==T_Var){
+			                        const Var* const e = (const Var*)(node);
+			                        List* rt = list_nth( context->rangeTableStack, e->varlevelsup );
+			                        const RangeTblEntry* rte = list_nth( rt, e->varno - 1 );
+						if (rte->rtekind == RTE_CTE) break; // break if working on CTE.
+                        			RelClause* rc = NULL;
+
+			                        elog( DEBUG3 , "IND ADV: OpExpr: working on: %s",rte->eref->aliasname);
+			                        elog( DEBUG3 , "IND ADV: OpExpr: working on: %d",rte->relid);
+
+						elog( DEBUG1 , "IND ADV: OpExpr: check right var, %d, cols: %s",e->varattno,idxadv_columns);
+						foundToken = is_partial_column( rte->relid, e->varattno );
+
+                        			if (foundToken)
+			                        {
+			                            ListCell* relPredicates = get_rel_clausesCell(table_clauses, rte->relid,rte->eref->aliasname);
+			                            elog( INFO , "IND ADV: create the clause for: %s",rte->eref->aliasname);
+			                            if (relPredicates == NULL){
+                                Node* f = linitial(expr->args);
+                                Node* s = lsecond(expr->args);
+                                elog( DEBUG4 , "index candidate - create a new entry for the relation");
+                                // create a new entry for the relation
+                                rc = (RelClause*)palloc0(sizeof(RelClause));
+                                rc->reloid = rte->relid;
+                                rc->erefAlias = pstrdup(rte->eref->aliasname);
+                                if(nodeTag(f)==T_Var){
+                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) s, (Var*) f));
+                                }else{
+                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) f, (Var*) s));
+                                }
+                                elog( DEBUG4 , "IND ADV: created the clause");
+
+                                table_clauses = lappend(table_clauses, rc );
+                            }else{
+                                //use the existing rc
+                                Node* f = linitial(expr->args);
+                                Node* s = lsecond(expr->args);
+                                elog( DEBUG4 , "index candidate - use the existing rc");
+                                rc = (RelClause*)lfirst( relPredicates );
+                                if(nodeTag(f)==T_Var){
+                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) s, (Var*) f));
+                                }else{
+                                    rc->predicate = lappend(rc->predicate,(Expr *)makePredicateClause((Expr *) root, (Const*) f, (Var*) s));
+                                }
+                                elog( DEBUG4 , "IND ADV: created the clause");
+                            }
+
+                            //context = (QueryContext*)palloc0(sizeof(QueryContext));
+                            elog_node_display( DEBUG4 , "predicate", linitial(rc->predicate),true);
+                            //context->predicate = make_ands_implicit((Expr *) root);
+
+                            elog( DEBUG4 , "index candidate - context->predicate set");
+                            break;
+                        }
+                    }
+                }
+
+				if(! foundToken){
+					List* opCandidates = NIL;
+
+					foreach( cell, expr->args )
+					{
+						const Node* const node = (const Node*)lfirst( cell );
+
+						opCandidates = merge_candidates( opCandidates,
+											scan_generic_node( node, context->context,
+													   context->rangeTableStack));
+
+					}
+#if PG_VERSION_NUM >= 90500
+					/* a range over physically ordered values: try BRIN as well */
+					if( is_range_operator( expr->opno ) )
+						opCandidates = merge_candidates( opCandidates,
+											build_brin_candidates( opCandidates ));
+#endif
+					context->candidates = merge_candidates( context->candidates, opCandidates );
+				}
+			}
+			return false;
+		}
+		break;
+
+		/* if this case is reached, the variable is an index-candidate */
+		case T_Var:
+		{
+			const Var* const expr = (const Var*)root;
+			List* rt = list_nth( context->rangeTableStack, expr->varlevelsup );
+			const RangeTblEntry* rte = list_nth( rt, expr->varno - 1 );
+
+			elog( DEBUG3 , "index candidate - var: %d rtekind: %d",expr->varattno,rte->rtekind);
+
+			/* only relations have indexes */
+			if( rte->rtekind == RTE_RELATION )
+			{
+				Relation base_rel = heap_open( rte->relid, AccessShareLock );
+				elog( DEBUG3 , "index candidate - here %d %d %d %d %d",RelationNeedsWAL(base_rel),!IsSystemRelation(base_rel),expr->varattno,base_rel->rd_rel->relpages,base_rel->rd_rel->reltuples);
+				/* We do not support catalog tables and temporary tables */
+				if( RelationNeedsWAL(base_rel)
+					&& !IsSystemRelation(base_rel)
+					/* and don't recommend indexes on hidden/system columns */
+					&& expr->varattno > 0
+					/* and it should have at least two tuples */
+					//TODO: Do we really need these checks?
+					//&& base_rel->rd_rel->relpages > 1
+					//&& base_rel->rd_rel->reltuples > 1
+					)
+				{
+					/* create index-candidate and build a new list */
+					TYPCATEGORY tcategory ;
+					IndexCandidate	*cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+
+					elog( DEBUG3 , "index candidate - in here");
+
+					cand->varno         = expr->varno;
+					cand->varlevelsup   = expr->varlevelsup;
+					cand->cols          = make_candidate_cols( 1 );
+					cand->reloid        = rte->relid;
+					cand->erefAlias     = pstrdup(rte->eref->aliasname);
+					cand->inh			= rte->inh;
+					elog( DEBUG3 , "index candidate - rel: %s, inh: %s",cand->erefAlias,BOOL_FMT(rte->inh));
+					cand->cols->vartype[ 0 ]  = expr->vartype;
+					cand->cols->varattno[ 0 ] = expr->varattno;
+					elog( DEBUG3 , "index candidate - rel: %s, var: %d",cand->erefAlias,expr->varattno);
+					tcategory = TypeCategory(expr->vartype);
+					cand->amOid = ((tcategory == TYPCATEGORY_ARRAY)||(tcategory == TYPCATEGORY_USER)) ? GIN_AM_OID : BTREE_AM_OID ;
+					elog( DEBUG3 , "index candidate - am: %d, category: %c",cand->amOid,tcategory);
+
+					context->candidates = list_make1( cand );
+				}
+
+				heap_close( base_rel, AccessShareLock );
+			}
+			return false;
+		}
+		break;
+
+		/* Query found */
+		case T_Query:
+		{
+			const Query* const query = (const Query*)root;
+
+			context->candidates = scan_query( query, context->context, context->rangeTableStack );
+			return false;
+		}
+		break;
+		case T_WindowFunc:
+		{
+		  elog(DEBUG4, "IDX_ADV: inside window func");
+		}break;
+		case T_MinMaxExpr:
+		{
+		  elog(DEBUG4, "IDX_ADV: inside T_MinMaxExpr func");
+		}break;
+#if PG_VERSION_NUM >= 90500
+		case T_GroupingFunc:
+		{
+		  elog(DEBUG4, "IDX_ADV: inside grouping func");
+		}break;
+#endif
+		/* create functional index */
+		case T_FuncExpr:
+			{
+				bool			too_complex = false;
+				IndexCandidate	*cand;
+				//IndexCandidate	*cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+				IndexElem *ind_elm = palloc0(sizeof(IndexElem));
+				FuncExpr* expr = (FuncExpr*) palloc0(sizeof(FuncExpr));
+				Node       *func_var; /* use this to find the relation info*/
+
+				elog(DEBUG4, "IND ADV: duplicate func expr properties.");
+				expr->xpr = ((const FuncExpr*)root)->xpr;
+				expr->funcid = ((const FuncExpr*)root)->funcid;
+				expr->funcresulttype = ((const FuncExpr*)root)->funcresulttype;
+				expr->funcretset = ((const FuncExpr*)root)->funcretset;
+				//expr->funcvariadic = ((const FuncExpr*)root)->funcvariadic;
+				expr->funcformat = ((const FuncExpr*)root)->funcformat;
+				expr->funccollid = ((const FuncExpr*)root)->funccollid;
+				expr->inputcollid = ((const FuncExpr*)root)->inputcollid;
+				expr->args = list_copy(((const FuncExpr*)root)->args);
+				expr->location = ((const FuncExpr*)root)->location;
+
+				elog(DEBUG4, "TBD: support functional indexes.");
+				//elog_node_display(DEBUG2,"Func Expr: ",root,true);
+				elog_node_display(DEBUG2,"Func Expr: ",expr,true);
+				//ind_elm->type = T_FuncExpr;
+				//ind_elm->name = NULL;
+				//ind_elm->expr = (Node *)expr;
+				//ind_elm->indexcolname = NULL;
+				//ind_elm->collation = NIL;
+				//ind_elm->opclass = NIL; //TODO: change to the opclass needed for varchar_pattern_ops
+				//ind_elm->ordering = SORTBY_DEFAULT ;
+				//ind_elm->nulls_ordering = SORTBY_NULLS_DEFAULT ;
+
+
+
+				/* TODO: support func indexes.
+				* currently we only support functions with variables on the first parameter.
+				* other types of functions will be ignored.
+				*/
+				//	indexInfo->ii_KeyAttrNumbers[attn] = 0; /* marks expression */
+				//  indexInfo->ii_Expressions = lappend(indexInfo->ii_Expressions, expr);
+
+				// get to the buttom Var
+				elog( DEBUG4 , "index candidate - get to buttom var");
+				if(list_length(expr->args)==0) { break;} // don't create indexes for expressions with no variables
+				func_var = list_nth(expr->args,0);
+				elog( DEBUG4 , "index candidate - get to buttom type: %d",func_var->type);
+				elog_node_display(DEBUG2,"Func Expr: - maybe ",func_var,true);
 				while((!IsA(func_var, Var))&&(!IsA(func_var, Const)) && !too_complex){
 					elog( DEBUG4 , "index candidate - loop to get to buttom type");
 					if(IsA(func_var, FuncExpr))
@@ -2398,692 +3686,1087 @@ static bool index_candidates_walker (Node *root, ScanContext *context)
 				if (IsA(func_var, Var) &&
                 ((Var *) func_var)->varattno != InvalidAttrNumber)
 				{
-				//	const Var* const expr = (const Var*)expr->args;
-					List* rt = list_nth( context->rangeTableStack, ((Var *)func_var)->varlevelsup );
-					const RangeTblEntry* rte = list_nth( rt, ((Var *)func_var)->varno - 1 );
-					if (rte->rtekind != RTE_RELATION) {break;}
-					char *varname = get_attname(rte->relid, ((Var *)func_var)->varattno);
-					if (varname == NULL)
-						elog(ERROR, "cache lookup failed for attribute %d of relation %u",varname, rte->relid);
+				//	const Var* const expr = (const Var*)expr->args;
+					List* rt = list_nth( context->rangeTableStack, ((Var *)func_var)->varlevelsup );
+					const RangeTblEntry* rte = list_nth( rt, ((Var *)func_var)->varno - 1 );
+					if (rte->rtekind != RTE_RELATION) {break;}
+					char *varname = get_attname(rte->relid, ((Var *)func_var)->varattno);
+					if (varname == NULL)
+						elog(ERROR, "cache lookup failed for attribute %d of relation %u",varname, rte->relid);
+
+					elog( DEBUG4 , "index candidate - function on var: %s",varname);
+					cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+
+				///* only relations have indexes */
+				//if( rte->rtekind == RTE_RELATION )
+				//{
+				//	Relation base_rel = heap_open( rte->relid, AccessShareLock );
+
+				//	/* We do not support catalog tables and temporary tables */
+				//	if( RelationNeedsWAL(base_rel)
+				//		&& !IsSystemRelation(base_rel)
+				//		/* and don't recommend indexes on hidden/system columns */
+				//		&& expr->varattno > 0
+				//		/* and it should have at least two tuples */
+				//		//TODO: Do we really need these checks?
+				//		&& base_rel->rd_rel->relpages > 1
+				//		&& base_rel->rd_rel->reltuples > 1
+				//		&& strcmp(varname,IDX_ADV_PART_COL)!=0 )
+				//	{
+				//		/* create index-candidate and build a new list */
+
+
+				//		cand->varno         = expr->varno;
+						cand->varlevelsup   = ((Var *)func_var)->varlevelsup;
+						cand->cols          = make_candidate_cols( 1 );
+						cand->reloid        = rte->relid;
+						cand->erefAlias     = pstrdup(rte->eref->aliasname);
+						cand->idxused       = false;
+						cand->inh			= rte->inh;
+
+						cand->cols->vartype[ 0 ]  = ((Var *)func_var)->vartype;
+						/* an expression column: varattno stays 0 */
+
+
+
+				//	}
+
+				//	heap_close( base_rel, AccessShareLock );
+				}
+				//elog_node_display(DEBUG2,"Func Expr pre list make: ",ind_elm,true);
+				elog( DEBUG4 , "index candidate - func expr");
+				cand->attList = lappend(cand->attList, expr);
+				elog_node_display(DEBUG4,"Func Expr: ",cand->attList,true);
+				context->candidates = list_make1( cand );
+				return false;
+			}
+			break;
+			/* default:
+			{
+				elog( DEBUG4 , "IDX ADV: tree walker - reached the default handler ");
+				elog(ERROR, "unrecognized node type: %d",(int) nodeTag(root));
+			}
+			break; */
+	}
+
+	elog( DEBUG4, "IND ADV: scan_generic_node: EXIT" );
+
+
+
+   // for any root type not specially processed, do:
+   return expression_tree_walker(root, index_candidates_walker, (void *) context);
+}
+
+
+/**
+* scan_generic_node
+* \brief this scanner uses the tree walker to drill down into the query tree to find Indexing candidates.
+*/
+static List* scan_generic_node(	const Node* const root,
+				OpnosContext* opnos_context,
+				List* const rangeTableStack )
+{
+	ScanContext context;
+        context.candidates = NIL;
+	context.context = opnos_context;
+	context.rangeTableStack = rangeTableStack;
+	elog( DEBUG4, "IND ADV: scan_generic_node: before tree walk" );
+	query_or_expression_tree_walker(root,
+	                                index_candidates_walker,
+	                                (void *) &context,
+	                                0);
+	elog( DEBUG4, "IND ADV: scan_generic_node: return index candidates" );
+	return context.candidates;
+
+}
+
+
+
+
+/**
+ * compare_candidates
+ * \brief compares 2 index candidates based on thier OID, alias, columns,
+ * access method and expressions
+ */
+static int compare_candidates( const IndexCandidate* ic1,
+			       const IndexCandidate* ic2 )
+{
+	int result = (signed int)ic1->reloid - (signed int)ic2->reloid;
+	elog( DEBUG3, "IND ADV: compare_candidates: ENTER" );
+
+	if( result == 0 )
+	{
+		result = strcmp(ic1->erefAlias,ic2->erefAlias );
+		if (result == 0)
+		{
+			result = ic1->cols->ncols - ic2->cols->ncols;
+
+			/* shared columns compare equal trivially */
+			if( result == 0 && ic1->cols != ic2->cols )
+			{
+				int i;
+
+				for( i = 0; result == 0 && i < ic1->cols->ncols; ++i )
+					result = ic1->cols->varattno[ i ] - ic2->cols->varattno[ i ];
+			}
+
+			if( result == 0 && ic1->amOid != ic2->amOid )
+				result = ic1->amOid < ic2->amOid ? -1 : 1;
+
+			/* expressional candidates: the expressions have to match too */
+			if( result == 0 && !equal( ic1->attList, ic2->attList ) )
+			{
+				char *e1 = nodeToString( ic1->attList );
+				char *e2 = nodeToString( ic2->attList );
+
+				result = strcmp( e1, e2 );
+				pfree( e1 );
+				pfree( e2 );
+			}
+		}
+	}
+
+	return result;
+}
+
+/*!
+ * \brief get the List containing the predicate clauses for a specific rel
+ */
+static List* get_rel_clauses(List* table_clauses, Oid reloid, char* erefAlias)
+{
+    ListCell		*cell;
+	elog( DEBUG3 , "IND ADV: get_rel_clauses: enter - look for: %s",erefAlias);
+    foreach( cell, table_clauses )
+	{
+		const RelClause* const relClause = (RelClause*)lfirst( cell );
+		elog( DEBUG3 , "IND ADV: get_rel_clauses: in loop");
+		if ((relClause->reloid == reloid) && (strcmp(relClause->erefAlias,erefAlias)==0)){
+		    return relClause->predicate;
+		}
+    }
+	elog( DEBUG3 , "IND ADV: get_rel_clauses: exit - found nothing");
+    return NIL;
+}
+
+/*!
+ * \brief get the ListCell containing the clauses for a specific rel
+ */
+static ListCell* get_rel_clausesCell(List* table_clauses, Oid reloid, char* erefAlias)
+{
+    ListCell		*cell;
+
+    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: enter - look for: %s",erefAlias);
+    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: looking inlist of len: %d",list_length(table_clauses));
+    foreach( cell, table_clauses )
+	{
+		const RelClause* const relClause = (RelClause*)lfirst( cell );
+		elog( DEBUG4 , "IND ADV: get_rel_clausesCell: RelClause");
+		elog( DEBUG4 , "IND ADV: get_rel_clausesCell: RelClause: %s",relClause->erefAlias);
+		if ((relClause->reloid == reloid) && (strcmp(relClause->erefAlias,erefAlias)==0)){
+		    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: found cell");
+		    return cell;
+		}
+    }
+    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: found NULL");
+    return NULL;
+}
+
+/**
+ * log_candidates
+ */
+static void log_candidates( const char* prefix, List* list )
+{
+	ListCell		*cell;
+	StringInfoData	str;/* output string */
+    elog( DEBUG4 , "IND ADV: log_candidates: enter");
+    /* Verify the list is not empty */
+    if(list_length(list)==0){
+    	elog( DEBUG4 , "IND ADV: empty list: exit");
+    	return;
+    }
+
+	/* don't do anything unless we are going to log it */
+	if( log_min_messages > DEBUG1 && client_min_messages > DEBUG1 )
+		return;
+
+	initStringInfo( &str );
+
+	foreach( cell, list )
+	{
+		int i;
+		const IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+
+		appendStringInfo( &str, " %d_(", cand->reloid );
+
+		for( i = 0; i < cand->cols->ncols; ++i )
+			appendStringInfo( &str, "%s%d", (i>0?",":""), cand->cols->varattno[ i ] );
+
+		appendStringInfo( &str, ")%c", ((lnext( cell ) != NULL)?',':' ') );
+	}
+
+	elog( DEBUG1 , "IND ADV: %s: |%d| {%s}", prefix, list_length(list),
+			str.len ? str.data : "" );
+
+	if( str.len > 0 ) pfree( str.data );
+}
+
+/**
+ * make_candidate_cols
+ * 		allocate the columns of a candidate - all the per-column arrays in a
+ * single chunk, sized for ncols.
+ */
+static IndexCandidateCols*
+make_candidate_cols( int ncols )
+{
+	IndexCandidateCols	*cols;
+	char				*data;
+
+	Assert( ncols > 0 && ncols <= INDEX_MAX_KEYS );
+
+	/* the Oid arrays first, to keep them aligned */
+	cols = (IndexCandidateCols*) palloc0( offsetof(IndexCandidateCols, data)
+										  + ncols * ( 3 * sizeof(Oid) + sizeof(AttrNumber) ) );
+	cols->ncols = ncols;
+
+	data = cols->data;
+	cols->vartype = (Oid*) data;
+	data += ncols * sizeof(Oid);
+	cols->op_class = (Oid*) data;
+	data += ncols * sizeof(Oid);
+	cols->collationObjectId = (Oid*) data;
+	data += ncols * sizeof(Oid);
+	cols->varattno = (AttrNumber*) data;
+
+	return cols;
+}
+
+/**
+ * merge_candidates
+ * 		appends list2 to list1.
+ *
+ * The candidates are neither sorted nor de-duplicated while the query is being
+ * scanned; unique_candidates() does it once, on the final list.
+ */
+static List*
+merge_candidates( List* list1, List* list2 )
+{
+	if( list1 == list2 )
+		return list1;
+
+	return list_concat( list1, list2 );
+}
+
+/**
+ * candidate_key
+ * 		fill in the hash key identifying a candidate.
+ */
+static void candidate_key( const IndexCandidate* cand, CandidateKey* key )
+{
+	/* the key is hashed as raw bytes - clear the padding too */
+	memset( key, 0, sizeof(CandidateKey) );
+
+	key->reloid = cand->reloid;
+	key->amOid = cand->amOid;
+	key->aliasHash = cand->erefAlias != NULL
+		? DatumGetUInt32( hash_any( (const unsigned char*) cand->erefAlias,
+									strlen( cand->erefAlias ) ) )
+		: 0;
+
+	if( cand->attList != NIL )
+	{
+		char *exprs = nodeToString( cand->attList );
+
+		key->exprHash = DatumGetUInt32( hash_any( (const unsigned char*) exprs,
+												  strlen( exprs ) ) );
+		pfree( exprs );
+	}
+
+	key->ncols = cand->cols->ncols;
+	memcpy( key->attnos, cand->cols->varattno, cand->cols->ncols * sizeof(AttrNumber) );
+}
+
+static int candidate_qsort_cmp( const void* a, const void* b )
+{
+	return compare_candidates( *(IndexCandidate* const *) a,
+							   *(IndexCandidate* const *) b );
+}
+
+/**
+ * unique_candidates
+ * 		removes the duplicates from the candidate list and sorts it in the
+ * order of compare_candidates().
+ *
+ * The duplicates are found through a hash on the candidate key, and the list is
+ * sorted once - instead of merging sorted lists at every level of the scan.
+ */
+static List*
+unique_candidates( List* candidates )
+{
+	HTAB			*set;
+	HASHCTL			ctl;
+	IndexCandidate	**array;
+	ListCell		*cell;
+	List			*result = NIL;
+	int				n = 0;
+	int				i;
+
+	if( list_length( candidates ) < 2 )
+		return candidates;
+
+	memset( &ctl, 0, sizeof(ctl) );
+	ctl.keysize = sizeof(CandidateKey);
+	ctl.entrysize = sizeof(CandidateSetEntry);
+	ctl.hash = tag_hash;
+	ctl.hcxt = CurrentMemoryContext;
+	set = hash_create( "index_adviser candidates", list_length( candidates ),
+					   &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+
+	array = (IndexCandidate**) palloc( list_length( candidates ) * sizeof(IndexCandidate*) );
+
+	foreach( cell, candidates )
+	{
+		IndexCandidate		*cand = (IndexCandidate*)lfirst( cell );
+		CandidateKey		key;
+		CandidateSetEntry	*entry;
+		bool				found;
+
+		candidate_key( cand, &key );
+		entry = (CandidateSetEntry*) hash_search( set, &key, HASH_ENTER, &found );
+
+		if( !found )
+			entry->cands = NIL;
+		else
+		{
+			/* the alias and the expressions are hashed - check every
+			 * candidate behind the key, not just the first one */
+			ListCell	*seen;
+			bool		duplicate = false;
+
+			foreach( seen, entry->cands )
+			{
+				IndexCandidate *other = (IndexCandidate*)lfirst( seen );
+
+				if( other == cand || compare_candidates( other, cand ) == 0 )
+				{
+					duplicate = true;
+					break;
+				}
+			}
 
-					elog( DEBUG4 , "index candidate - function on var: %s",varname);
-					cand = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+			if( duplicate )
+				continue;
+		}
 
-				///* only relations have indexes */
-				//if( rte->rtekind == RTE_RELATION )
-				//{
-				//	Relation base_rel = heap_open( rte->relid, AccessShareLock );
+		entry->cands = lappend( entry->cands, cand );
+		array[ n++ ] = cand;
+	}
 
-				//	/* We do not support catalog tables and temporary tables */
-				//	if( RelationNeedsWAL(base_rel)
-				//		&& !IsSystemRelation(base_rel)
-				//		/* and don't recommend indexes on hidden/system columns */
-				//		&& expr->varattno > 0
-				//		/* and it should have at least two tuples */
-				//		//TODO: Do we really need these checks?
-				//		&& base_rel->rd_rel->relpages > 1
-				//		&& base_rel->rd_rel->reltuples > 1
-				//		&& strcmp(varname,IDX_ADV_PART_COL)!=0 )
-				//	{
-				//		/* create index-candidate and build a new list */
+	hash_destroy( set );
+	list_free( candidates );
 
+	qsort( array, n, sizeof(IndexCandidate*), candidate_qsort_cmp );
 
-				//		cand->varno         = expr->varno;
-						cand->varlevelsup   = ((Var *)func_var)->varlevelsup;
-						cand->ncols         = 1;
-						cand->reloid        = rte->relid;
-						cand->erefAlias     = pstrdup(rte->eref->aliasname);
-						cand->idxused       = false;
-						cand->inh			= rte->inh;
+	for( i = 0; i < n; ++i )
+		result = lappend( result, array[ i ] );
+
+	pfree( array );
+
+	return result;
+}
+
+/**
+ * expand_inherited_candidates
+ * 		It builds new list out of passed in list, to expand inherited tables.
+ *
+ * see: expand_inherited_rtentry
+ */
+static List* expand_inherited_candidates(List* list)
+{
+	ListCell *cell;
+	LOCKMODE    lockmode = NoLock;
+	IndexCandidate *cand;
+	List       *inhOIDs;
+	List       *newCandidates = NIL;
+	ListCell   *l;
+
+	elog(DEBUG3,"expand_inherited_candidates: Enter - length: %d",list_length(list));
+	for( cell = list_head(list); (cell != NULL) ; cell = lnext( cell ))
+	{
+		cand = ((IndexCandidate*)lfirst( cell ));
+		newCandidates = lappend(newCandidates, cand);
+		if(!cand->inh)
+		{
+			elog(DEBUG3,"expand_inherited_candidates: not inh skipping");
+			continue;
+		}
+		elog(DEBUG3,"expand_inherited_candidates: inh expending");
+		/* Scan for all members of inheritance set, acquire needed locks */
+		//inhOIDs = find_all_inheritors(cand->reloid, lockmode, NULL);
+		inhOIDs = find_inheritance_children(cand->reloid, lockmode);
+		/* Check that there's at least one descendant, else treat as no-child
+         * case.  This could happen despite above has_subclass() check, if table
+         * once had a child but no longer does.
+         */
+		//if (list_length(inhOIDs) < 2)
+		if (list_length(inhOIDs) < 1)
+		{
+			/* Clear flag before returning */
+			elog(DEBUG3,"expand_inherited_candidates: not enough inh -> skipping");
+			cand->inh = false;
+			continue;
+		}
 
-						cand->vartype[ 0 ]  = ((Var *)func_var)->vartype;
-				//		cand->varattno[ 0 ] = expr->varattno;
-				//		cand->varname[ 0 ]   = get_relid_attribute_name(rte->relid, expr->varattno);
-	   //                 elog( DEBUG3 , "index candidate - rel: %s, var: %s",cand->erefAlias,cand->varname[ 0 ]);
-				//		/*FIXME: Do we really need this loop? palloc0 and ncols,
-				//		 * above, should have taken care of this!
-				//		 */
-						for( i = 0; i < INDEX_MAX_KEYS; ++i )
-							cand->varattno[i] = 0;
+		elog(DEBUG3,"expand_inherited_candidates: loop over sons: %d ",list_length(inhOIDs));
+		foreach(l, inhOIDs)
+		{
+			Oid         childOID = lfirst_oid(l);
+			IndexCandidate* cic = (IndexCandidate*)palloc0(sizeof(IndexCandidate));
+			//Relation base_rel = heap_open( childOID, AccessShareLock );
+			/* init some members of composite candidate 1 */
+			cic->varno		= -1;
+			cic->varlevelsup	= -1;
+			/* the children have the very same columns; share them */
+			cic->cols		= cand->cols;
+			cic->reloid		= childOID;
+			cic->erefAlias 		= pstrdup(cand->erefAlias);
+			cic->idxused		= false;
+			cic->inh			= false;
+			cic->parentOid		= cand->reloid;
 
 
+			/* cope index experessions for the new composite indexes */
+			cic->attList = list_copy(cand->attList);
+			cic->amOid   = cand->amOid;
+			elog(DEBUG3,"expand_inherited_candidates: start att copy,attlist cic: %d ",list_length(cic->attList));
+			newCandidates = lappend(newCandidates, cic);
 
-				//	}
+		}
 
-				//	heap_close( base_rel, AccessShareLock );
-				}
-				//elog_node_display(DEBUG2,"Func Expr pre list make: ",ind_elm,true);
-				elog( DEBUG4 , "index candidate - func expr");
-				cand->attList = lappend(cand->attList, expr);
-				elog_node_display(DEBUG4,"Func Expr: ",cand->attList,true);
-				context->candidates = list_make1( cand );
-				return false;
-			}
-			break;
-			/* default:
-			{
-				elog( DEBUG4 , "IDX ADV: tree walker - reached the default handler ");
-				elog(ERROR, "unrecognized node type: %d",(int) nodeTag(root));
-			}
-			break; */
+		/* the outer query levels must not expand it again */
+		cand->inh = false;
 	}
 
-	elog( DEBUG4, "IND ADV: scan_generic_node: EXIT" );
-
-
-
-   // for any root type not specially processed, do:
-   return expression_tree_walker(root, index_candidates_walker, (void *) context);
+	list_free(list);
+	elog(DEBUG3,"expand_inherited_candidates: Exit - length: %d",list_length(newCandidates));
+	return newCandidates;
 }
 
 
 /**
-* scan_generic_node
-* \brief this scanner uses the tree walker to drill down into the query tree to find Indexing candidates.
-*/
-static List* scan_generic_node(	const Node* const root,
-				OpnosContext* opnos_context,
-				List* const rangeTableStack )
+* \brief expand the inherited relation clause for the table_clauses list.
+**/
+static void expand_inherited_rel_clauses()
 {
-	ScanContext context;
-        context.candidates = NIL;
-	context.context = opnos_context;
-	context.rangeTableStack = rangeTableStack;
-	elog( DEBUG4, "IND ADV: scan_generic_node: before tree walk" );
-	query_or_expression_tree_walker(root,
-	                                index_candidates_walker,
-	                                (void *) &context,
-	                                0);
-	elog( DEBUG4, "IND ADV: scan_generic_node: return index candidates" );
-	return context.candidates;
+	ListCell *cell;
+	LOCKMODE    lockmode = NoLock;
+	RelClause *cand;
+	List       *inhOIDs;
+	ListCell   *l;
 
-}
+	elog(DEBUG3,"expand_inherited_rel_clauses: Enter - length: %d",list_length(table_clauses));
+	for( cell = list_head(table_clauses); (cell != NULL) ; cell = lnext( cell ))
+	{
+		cand = ((RelClause*)lfirst( cell ));
+
+		elog(DEBUG3,"expand_inherited_rel_clauses: inh expending");
+		/* Scan for all members of inheritance set, acquire needed locks */
+		//inhOIDs = find_all_inheritors(cand->reloid, lockmode, NULL);
+		inhOIDs = find_inheritance_children(cand->reloid, lockmode);
+		/* Check that there's at least one descendant, else treat as no-child
+         * case.  This could happen despite above has_subclass() check, if table
+         * once had a child but no longer does.
+         */
+		//if (list_length(inhOIDs) < 2)
+		if (list_length(inhOIDs) < 1)
+		{
+			/* Clear flag before returning */
+			elog(DEBUG3,"expand_inherited_rel_clauses: not enough inh -> skipping");
+			continue;
+		}
+
+		elog(DEBUG3,"expand_inherited_rel_clauses: loop over sons: %d ",list_length(inhOIDs));
+		foreach(l, inhOIDs)
+		{
+			//int i;
+			Oid         childOID = lfirst_oid(l);
+			RelClause* cic = (RelClause*)palloc(sizeof(RelClause));
 
+			//Relation base_rel = heap_open( childOID, AccessShareLock );
+			/* init some members of composite candidate 1 */
+			cic->reloid			= childOID;
+			cic->erefAlias      = cand->erefAlias;
+			elog(DEBUG3,"expand_inherited_rel_clauses: create chield clause for %d, name: %s",childOID,cic->erefAlias);
 
+			/* cope table clause experessions for the new cheild table */
+			cic->predicate = list_copy(cand->predicate);
+			cic->selectivityValid = false;
+			table_clauses = lappend(table_clauses, cic);
+		}
+	}
+	elog(DEBUG3,"expand_inherited_rel_clauses: Exit - length: %d",list_length(table_clauses));
+}
 
 
+#if PG_VERSION_NUM >= 90200
 /**
- * compare_candidates
- * \brief compares 2 index candidates based on thier OID, alias, and columns
- * \TODO extend to support functional indexes
+ * build_covering_candidates
+ *    covering twins of a query's btree candidates: the candidate's columns
+ * followed by all the other columns of the relation the query reads, so that
+ * the planner can consider an index-only scan.
+ *
+ *     What the twin saves is the heap access for the all-visible part of the
+ * table, which cost_index() accounts for by the visibility map fraction
+ * (relallvisible); tables with no all-visible page get no twins. A twin wider
+ * than index_adviser.covering_max_cols columns, or one needing a system column
+ * or the whole row, is not built.
  */
-static int compare_candidates( const IndexCandidate* ic1,
-			       const IndexCandidate* ic2 )
+static List* build_covering_candidates( const Query* query, List* candidates )
 {
-	int result = (signed int)ic1->reloid - (signed int)ic2->reloid;
-	elog( DEBUG3, "IND ADV: compare_candidates: ENTER" );
+	List		*coveringCandidates = NIL;
+	ListCell	*cell;
 
-	if( result == 0 )
+	if( idxadv_covering_max_cols <= 0 )
+		return NIL;
+
+	foreach( cell, candidates )
 	{
-		result = strcmp(ic1->erefAlias,ic2->erefAlias );
-		if (result == 0)
+		const IndexCandidate* const cand = (const IndexCandidate*)lfirst( cell );
+		IndexCandidate	*cic;
+		Bitmapset		*needed = NULL;
+		Bitmapset		*tmpset;
+		ListCell		*rtcell;
+		HeapTuple		reltup;
+		Index			varno = 0;
+		Index			rti = 0;
+		bool			allvisible = false;
+		bool			coverable = true;
+		int				ncols;
+		int				member;
+		int				i;
+
+		if( cand->amOid != BTREE_AM_OID || cand->attList != NIL )
+			continue;
+
+		/* the range table entry of the candidate, on this query level */
+		foreach( rtcell, query->rtable )
 		{
-			result = ic1->ncols - ic2->ncols;
+			const RangeTblEntry* const rte = (const RangeTblEntry*)lfirst( rtcell );
 
-			if( result == 0 )
+			++rti;
+			if( rte->rtekind == RTE_RELATION && rte->relid == cand->reloid
+				&& strcmp( rte->eref->aliasname, cand->erefAlias ) == 0 )
 			{
-				int i = 0;
-
-				do
-				{
-					result = ic1->varattno[ i ] - ic2->varattno[ i ];
-					++i;
-				} while( ( result == 0 ) && ( i < ic1->ncols ) );
+				varno = rti;
+				break;
 			}
 		}
-	}
 
-	return result;
-}
+		if( varno == 0 )
+			continue;
 
-/*!
- * \brief get the List containing the predicate clauses for a specific rel
- */
-static List* get_rel_clauses(List* table_clauses, Oid reloid, char* erefAlias)
-{
-    ListCell		*cell;
-	elog( DEBUG3 , "IND ADV: get_rel_clauses: enter - look for: %s",erefAlias);
-    foreach( cell, table_clauses )
-	{
-		const RelClause* const relClause = (RelClause*)lfirst( cell );
-		elog( DEBUG3 , "IND ADV: get_rel_clauses: in loop");
-		if ((relClause->reloid == reloid) && (strcmp(relClause->erefAlias,erefAlias)==0)){
-		    return relClause->predicate;
+		reltup = SearchSysCache1( RELOID, ObjectIdGetDatum( cand->reloid ) );
+		if( HeapTupleIsValid( reltup ) )
+		{
+			allvisible = ((Form_pg_class) GETSTRUCT( reltup ))->relallvisible > 0;
+			ReleaseSysCache( reltup );
 		}
-    }
-	elog( DEBUG3 , "IND ADV: get_rel_clauses: exit - found nothing");
-    return NIL;
-}
 
-/*!
- * \brief get the ListCell containing the clauses for a specific rel
- */
-static ListCell* get_rel_clausesCell(List* table_clauses, Oid reloid, char* erefAlias)
-{
-    ListCell		*cell;
+		if( !allvisible )
+			continue;
 
-    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: enter - look for: %s",erefAlias);
-    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: looking inlist of len: %d",list_length(table_clauses));
-    foreach( cell, table_clauses )
-	{
-		const RelClause* const relClause = (RelClause*)lfirst( cell );
-		elog( DEBUG4 , "IND ADV: get_rel_clausesCell: RelClause");
-		elog( DEBUG4 , "IND ADV: get_rel_clausesCell: RelClause: %s",relClause->erefAlias);
-		if ((relClause->reloid == reloid) && (strcmp(relClause->erefAlias,erefAlias)==0)){
-		    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: found cell");
-		    return cell;
+		/* the columns read; pull_varattnos() offsets them */
+		pull_varattnos( (Node*) query->targetList, varno, &needed );
+		pull_varattnos( (Node*) query->jointree, varno, &needed );
+		pull_varattnos( query->havingQual, varno, &needed );
+
+		for( i = 0; i < cand->cols->ncols; ++i )
+			needed = bms_del_member( needed,
+							cand->cols->varattno[ i ] - FirstLowInvalidHeapAttributeNumber );
+
+		ncols = cand->cols->ncols + bms_num_members( needed );
+
+		if( bms_is_empty( needed ) || ncols > idxadv_covering_max_cols
+			|| ncols > INDEX_MAX_KEYS )
+		{
+			bms_free( needed );
+			continue;
 		}
-    }
-    elog( DEBUG4 , "IND ADV: get_rel_clausesCell: found NULL");
-    return NULL;
-}
 
-/**
- * log_candidates
- */
-static void log_candidates( const char* prefix, List* list )
-{
-	ListCell		*cell;
-	StringInfoData	str;/* output string */
-    elog( DEBUG4 , "IND ADV: log_candidates: enter");
-    /* Verify the list is not empty */
-    if(list_length(list)==0){
-    	elog( DEBUG4 , "IND ADV: empty list: exit");
-    	return;
-    }
+		cic = (IndexCandidate*)palloc( sizeof(IndexCandidate) );
+		memcpy( cic, cand, sizeof(IndexCandidate) );
+		cic->cols = make_candidate_cols( ncols );
+		cic->erefAlias = pstrdup( cand->erefAlias );
 
-	/* don't do anything unless we are going to log it */
-	/*if( log_min_messages < DEBUG1 )
-		return;*/
+		for( i = 0; i < cand->cols->ncols; ++i )
+		{
+			cic->cols->vartype[ i ]		= cand->cols->vartype[ i ];
+			cic->cols->varattno[ i ]	= cand->cols->varattno[ i ];
+		}
 
-	initStringInfo( &str );
+		/* the rest trail, in column order */
+		tmpset = bms_copy( needed );
+		while( ( member = bms_first_member( tmpset ) ) >= 0 )
+		{
+			const AttrNumber attno = member + FirstLowInvalidHeapAttributeNumber;
 
-	foreach( cell, list )
-	{
-		int i;
-		const IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+			if( attno <= 0 )
+			{
+				coverable = false;
+				break;
+			}
 
-		appendStringInfo( &str, " %d_(", cand->reloid );
+			cic->cols->vartype[ i ]		= get_atttype( cand->reloid, attno );
+			cic->cols->varattno[ i ]	= attno;
+			++i;
+		}
 
-		for( i = 0; i < cand->ncols; ++i )
-			appendStringInfo( &str, "%s%d", (i>0?",":""), cand->varattno[ i ] );
+		bms_free( tmpset );
+		bms_free( needed );
 
-		appendStringInfo( &str, ")%c", ((lnext( cell ) != NULL)?',':' ') );
-	}
+		if( !coverable )
+		{
+			pfree( cic->cols );
+			pfree( cic->erefAlias );
+			pfree( cic );
+			continue;
+		}
 
-	elog( DEBUG1 , "IND ADV: %s: |%d| {%s}", prefix, list_length(list),
-			str.len ? str.data : "" );
+		elog( DEBUG3, "IND ADV: build_covering_candidates: %s, %d columns",
+			  cic->erefAlias, ncols );
 
-	if( str.len > 0 ) pfree( str.data );
+		coveringCandidates = lappend( coveringCandidates, cic );
+	}
+
+	return coveringCandidates;
 }
+#endif
 
 /**
- * merge_candidates
- * 		It builds new list out of passed in lists, and then frees the two lists.
- *
- * This function maintains order of the candidates as determined by
- * compare_candidates() function.
+ * clause_is_equality
+ *    is the clause an equality (or an IN list) that a btree can use to pin a
+ * column down?
  */
-static List*
-merge_candidates( List* list1, List* list2 )
+static bool clause_is_equality( const Node* clause )
 {
-	List *ret;
-	ListCell *cell1;
-	ListCell *cell2;
-	ListCell *prev2;
+	if( clause == NULL )
+		return false;
 
-	if( list_length( list1 ) == 0 && list_length( list2 ) == 0 )
-		return NIL;
+	if( IsA( clause, OpExpr ) )
+		return get_oprrest( ((const OpExpr*)clause)->opno ) == F_EQSEL;
 
-	elog( DEBUG4, "IND ADV: merge_candidates: ENTER" );
-	elog( DEBUG4, "IND ADV: merge_candidates: list 1 length: %d",list_length( list1 ) );
-	elog( DEBUG4, "IND ADV: merge_candidates: list 2 length: %d",list_length( list2 ) );
+	if( IsA( clause, ScalarArrayOpExpr ) )
+		return ((const ScalarArrayOpExpr*)clause)->useOr
+			&& get_oprrest( ((const ScalarArrayOpExpr*)clause)->opno ) == F_EQSEL;
+
+	return false;
+}
 
-	/* list1 and list2 are assumed to be sorted in ascending order */
+/**
+ * get_column_stats
+ *    average width, null fraction and number of distinct values of a column,
+ * as gathered by ANALYZE. Returns false if the column has no statistics.
+ */
+static bool get_column_stats( Oid relid, AttrNumber attno, ColumnStats* stats )
+{
+	HeapTuple	tuple;
+	Form_pg_statistic form;
+
+	tuple = SearchSysCache3( STATRELATTINH,
+							 ObjectIdGetDatum( relid ),
+							 Int16GetDatum( attno ),
+							 BoolGetDatum( false ) );
+	if( !HeapTupleIsValid( tuple ) )
+		return false;
+
+	form = (Form_pg_statistic) GETSTRUCT( tuple );
+	stats->width = form->stawidth;
+	stats->nullfrac = form->stanullfrac;
+	stats->ndistinct = form->stadistinct;
+	ReleaseSysCache( tuple );
+
+	/* negative: a fraction of the rows */
+	if( stats->ndistinct < 0 )
+	{
+		HeapTuple	reltup = SearchSysCache1( RELOID, ObjectIdGetDatum( relid ) );
 
-	elog( DEBUG1, "IND ADV: ---merge_candidates---" );
-	log_candidates( "idxcd-list1", list1 );
-	log_candidates( "idxcd-list2", list2 );
+		if( HeapTupleIsValid( reltup ) )
+		{
+			stats->ndistinct = -stats->ndistinct * ((Form_pg_class) GETSTRUCT( reltup ))->reltuples;
+			ReleaseSysCache( reltup );
+		}
+		else
+			stats->ndistinct = 0;
+	}
 
-	if( list_length( list1 ) == 0 )
-		return list2;
+	return true;
+}
 
-	if( list_length( list2 ) == 0 )
-		return list1;
+/**
+ * column_n_distinct
+ *    number of distinct values in the column, per pg_statistic; 0 if unknown.
+ */
+static double column_n_distinct( Oid relid, AttrNumber attno )
+{
+	ColumnStats	stats;
 
-        if ( list1 == list2 ) return list1;
+	return get_column_stats( relid, attno, &stats ) ? stats.ndistinct : 0;
+}
 
-	ret = NIL;
-	prev2 = NULL;
+#if PG_VERSION_NUM >= 90200
+/**
+ * gin_column_keys
+ *    the number of distinct elements of an array column, from its most common
+ * elements (MCELEM) statistics; 0 if ANALYZE didn't gather those. *items is
+ * set to the average distinct elements per row, if known (DECHIST).
+ *
+ *     The elements missing from the MCELEM list are rarer than the rarest one
+ * in it, so the rest of the average row's elements are spread over at least
+ * (items - sum of the frequencies) / minimum frequency more elements.
+ */
+static double gin_column_keys( Oid relid, AttrNumber attno, double tuples, double* items )
+{
+	HeapTuple	tuple;
+	float4		*numbers;
+	int			nnumbers;
+	double		keys = 0;
+
+	tuple = SearchSysCache3( STATRELATTINH,
+							 ObjectIdGetDatum( relid ),
+							 Int16GetDatum( attno ),
+							 BoolGetDatum( false ) );
+	if( !HeapTupleIsValid( tuple ) )
+		return 0;
+
+	/* the last number of the histogram is the average */
+	if( get_attstatsslot( tuple, InvalidOid, 0, STATISTIC_KIND_DECHIST, InvalidOid,
+						  NULL, NULL, NULL, &numbers, &nnumbers ) )
+	{
+		if( nnumbers > 0 )
+			*items = Max( numbers[ nnumbers - 1 ], 1 );
+		free_attstatsslot( InvalidOid, NULL, 0, numbers, nnumbers );
+	}
 
-	for( cell1 = list_head(list1), cell2 = list_head(list2);
-		(cell1 != NULL) && (cell2 != NULL); )
+	/* the element frequencies, followed by the min, max and null frequencies */
+	if( get_attstatsslot( tuple, InvalidOid, 0, STATISTIC_KIND_MCELEM, InvalidOid,
+						  NULL, NULL, NULL, &numbers, &nnumbers ) )
 	{
-		const int cmp = compare_candidates( (IndexCandidate*)lfirst( cell1 ),
-				  		    (IndexCandidate*)lfirst( cell2 ) );
-                elog( DEBUG4, "IDX_ADV: candidate compare returns: %d",cmp);
-		if( cmp <= 0 )
+		const int	nmce = nnumbers - 3;
+
+		if( nmce > 0 )
 		{
-			/* next candidate comes from list 1 */
-			ret = lappend( ret, lfirst( cell1 ) );
+			const double minfreq = Max( numbers[ nmce ], 1.0 / Max( tuples, 1 ) );
+			double		sumfreq = 0;
+			int			i;
 
-			cell1 = lnext( cell1 );
+			for( i = 0; i < nmce; ++i )
+				sumfreq += numbers[ i ];
 
-			/* if we have found two identical candidates then we remove the
-			 * candidate from list 2
-			 */
-			if( cmp == 0 )
-			{
-				ListCell *next = lnext( cell2 );
+			keys = nmce + Max( *items - sumfreq, 0 ) / minfreq;
+			keys = Min( keys, Max( tuples * *items, nmce ) );
+		}
+		free_attstatsslot( InvalidOid, NULL, 0, numbers, nnumbers );
+	}
 
-				//pfree( (IndexCandidate*)lfirst( cell2 ) );
-				//list2 = list_delete_cell( list2, cell2, prev2 );
+	ReleaseSysCache( tuple );
 
-				cell2 = next;
-			}
-		}
-		else
-		{
-			/* next candidate comes from list 2 */
-			ret = lappend( ret, lfirst( cell2 ) );
+	return keys;
+}
+#endif
+
+/**
+ * virtual_gin_stats
+ *    the statistics estimate_index_pages() made up for a virtual GIN index;
+ * false if the oid isn't one.
+ */
+bool virtual_gin_stats( Oid indexoid, VirtualGinStats* stats )
+{
+	IndexCandidate *cand;
 
-			prev2 = cell2;
-			cell2 = lnext( cell2 );
-		}
-	}
+	if( !is_virtual_index( indexoid, &cand ) || cand->amOid != GIN_AM_OID )
+		return false;
+
+	*stats = cand->gin;
 
-        elog( DEBUG4, "IDX_ADV: so far we have: %d",list_length( ret ));
-         log_candidates( "so far: ", ret );
+	return true;
+}
 
-	/* Now append the leftovers from both the lists; only one of them should have any elements left */
-	for( ; cell1 != NULL; cell1 = lnext(cell1) )
-		ret = lappend( ret, lfirst(cell1) );
+#if PG_VERSION_NUM >= 90500
+/**
+ * is_range_operator
+ *    does the operator compare by range (<, <=, >, >=)?
+ */
+static bool is_range_operator( Oid opno )
+{
+	const RegProcedure oprrest = get_oprrest( opno );
 
-	for( ; cell2 != NULL ; cell2 = lnext(cell2) )
-		ret = lappend( ret, lfirst(cell2) );
+	return oprrest == F_SCALARLTSEL || oprrest == F_SCALARGTSEL;
+}
 
-        elog( DEBUG4, "IDX_ADV: free current candidate lists");
-        list1->type = T_List;
-        list2->type = T_List;
-        elog( DEBUG4, "IDX_ADV: free current candidate list1");
-	if (list1 != NIL ) list_free( list1 );
-        elog( DEBUG4, "IDX_ADV: free current candidate list2");
-	if (list2 != NIL ) list_free( list2 );
+/**
+ * column_correlation
+ *    correlation between the physical order of the rows and the order of the
+ * column's values, per pg_statistic; 0 if unknown.
+ */
+static float4 column_correlation( Oid relid, AttrNumber attno )
+{
+	HeapTuple	tuple;
+	float4		*numbers;
+	int			nnumbers;
+	float4		correlation = 0;
+
+	tuple = SearchSysCache3( STATRELATTINH,
+							 ObjectIdGetDatum( relid ),
+							 Int16GetDatum( attno ),
+							 BoolGetDatum( false ) );
+	if( !HeapTupleIsValid( tuple ) )
+		return 0;
+
+	if( get_attstatsslot( tuple, InvalidOid, 0, STATISTIC_KIND_CORRELATION, InvalidOid,
+						  NULL, NULL, NULL, &numbers, &nnumbers ) )
+	{
+		if( nnumbers == 1 )
+			correlation = numbers[ 0 ];
+		free_attstatsslot( InvalidOid, NULL, 0, numbers, nnumbers );
+	}
 
-	log_candidates( "merged-list", ret );
+	ReleaseSysCache( tuple );
 
-	elog( DEBUG4, "IND ADV: merge_candidates: EXIT" );
-        ret->type = T_List;
-	return ret;
+	return correlation;
 }
 
 /**
- * expand_inherited_candidates
- * 		It builds new list out of passed in list, to expand inherited tables.
+ * build_brin_candidates
+ *    BRIN twins of the single column btree candidates of a range predicate,
+ * for the columns whose values follow the physical row order (in either
+ * direction) at least as closely as index_adviser.brin_correlation says.
  *
- * see: expand_inherited_rtentry
+ *     The twins compete with the btree candidates in the re-planning; being a
+ * small fraction of their size, they win on append-only tables where a range
+ * of values maps to a few ranges of pages.
  */
-static List* expand_inherited_candidates(List* list)
+static List* build_brin_candidates( List* candidates )
 {
-	ListCell *cell;
-	LOCKMODE    lockmode = NoLock;
-	IndexCandidate *cand;
-	List       *inhOIDs;
-	List       *newCandidates = NIL;
-	ListCell   *l;
+	List		*brinCandidates = NIL;
+	ListCell	*cell;
 
-	elog(DEBUG3,"expand_inherited_candidates: Enter - length: %d",list_length(list));
-	for( cell = list_head(list); (cell != NULL) ; cell = lnext( cell ))
+	if( idxadv_brin_correlation <= 0 )
+		return NIL;
+
+	foreach( cell, candidates )
 	{
-		cand = ((IndexCandidate*)lfirst( cell ));
-		newCandidates = lappend(newCandidates, cand);
-		if(!cand->inh)
-		{
-			elog(DEBUG3,"expand_inherited_candidates: not inh skipping");
-			continue;
-		}
-		elog(DEBUG3,"expand_inherited_candidates: inh expending");
-		/* Scan for all members of inheritance set, acquire needed locks */
-		//inhOIDs = find_all_inheritors(cand->reloid, lockmode, NULL);
-		inhOIDs = find_inheritance_children(cand->reloid, lockmode);
-		/* Check that there's at least one descendant, else treat as no-child
-         * case.  This could happen despite above has_subclass() check, if table
-         * once had a child but no longer does.
-         */
-		//if (list_length(inhOIDs) < 2)
-		if (list_length(inhOIDs) < 1)
-		{
-			/* Clear flag before returning */
-			elog(DEBUG3,"expand_inherited_candidates: not enough inh -> skipping");
-			cand->inh = false;
-			continue;
-		}
+		const IndexCandidate* const cand = (const IndexCandidate*)lfirst( cell );
+		IndexCandidate	*bic;
+		float4			correlation;
 
-		elog(DEBUG3,"expand_inherited_candidates: loop over sons: %d ",list_length(inhOIDs));
-		foreach(l, inhOIDs)
-		{
-			int i;
-			Oid         childOID = lfirst_oid(l);
-			IndexCandidate* cic = (IndexCandidate*)palloc(sizeof(IndexCandidate));
-			//Relation base_rel = heap_open( childOID, AccessShareLock );
-			/* init some members of composite candidate 1 */
-			cic->varno		= -1;
-			cic->varlevelsup	= -1;
-			cic->ncols		= cand->ncols;
-			cic->reloid		= childOID;
-			cic->erefAlias 		= pstrdup(cand->erefAlias);
-			cic->idxused		= false;
-			cic->parentOid		= cand->reloid;
+		if( cand->amOid != BTREE_AM_OID || cand->cols->ncols != 1
+			|| cand->cols->varattno[0] <= 0 )
+			continue;
 
-            elog( DEBUG3, "expand_inherited_candidates: start att copy, ncols: %d", cand->ncols);
-			/* copy attributes of the candidate to the inherited candidate 	*/
-			for( i = 0; i < cand->ncols; ++i)
-			{
-				cic->vartype[ i ]  = cand->vartype[ i ];
-				cic->varattno[ i ] = cand->varattno[ i ];
-				cic->varname[ i ]  = cand->varname[ i ];
-			}
+		correlation = column_correlation( cand->reloid, cand->cols->varattno[0] );
+		if( fabs( correlation ) < idxadv_brin_correlation )
+			continue;
 
-			/* set remaining attributes to null */
-			for( i = cand->ncols ;	i < INDEX_MAX_KEYS;	++i )
-			{
-				cic->varattno[ i ] = 0;
+		bic = (IndexCandidate*)palloc( sizeof(IndexCandidate) );
+		memcpy( bic, cand, sizeof(IndexCandidate) );
 
-			}
+		/* the op classes are per access method; the columns can't be shared */
+		bic->cols = make_candidate_cols( 1 );
+		bic->cols->vartype[ 0 ]		= cand->cols->vartype[ 0 ];
+		bic->cols->varattno[ 0 ]	= cand->cols->varattno[ 0 ];
+		bic->erefAlias		= pstrdup( cand->erefAlias );
+		bic->attList		= NIL;
+		bic->amOid			= BRIN_AM_OID;
 
-			/* cope index experessions for the new composite indexes */
-			cic->attList = list_copy(cand->attList);
-			cic->amOid   = cand->amOid;
-			elog(DEBUG3,"expand_inherited_candidates: start att copy,attlist cic: %d ",list_length(cic->attList));
-			newCandidates = lappend(newCandidates, cic);
+		elog( DEBUG3, "IND ADV: build_brin_candidates: %s, column %d, correlation %.2f",
+			  bic->erefAlias, bic->cols->varattno[ 0 ], correlation );
 
-		}
+		brinCandidates = lappend( brinCandidates, bic );
 	}
 
-	list_free(list);
-	elog(DEBUG3,"expand_inherited_candidates: Exit - length: %d",list_length(newCandidates));
-	return newCandidates;
+	return brinCandidates;
 }
+#endif
 
-
-/**
-* \brief expand the inherited relation clause for the table_clauses list.
-**/
-static void expand_inherited_rel_clauses()
+/* rank the columns of a relation: equality before range, then the most selective */
+static int composite_column_cmp( const void* a, const void* b )
 {
-	ListCell *cell;
-	LOCKMODE    lockmode = NoLock;
-	RelClause *cand;
-	List       *inhOIDs;
-	ListCell   *l;
+	const CompositeColumn* const c1 = *(CompositeColumn* const *) a;
+	const CompositeColumn* const c2 = *(CompositeColumn* const *) b;
+	int result;
 
-	elog(DEBUG3,"expand_inherited_rel_clauses: Enter - length: %d",list_length(table_clauses));
-	for( cell = list_head(table_clauses); (cell != NULL) ; cell = lnext( cell ))
-	{
-		cand = ((RelClause*)lfirst( cell ));
+	if( c1->cand->reloid != c2->cand->reloid )
+		return c1->cand->reloid < c2->cand->reloid ? -1 : 1;
 
-		elog(DEBUG3,"expand_inherited_rel_clauses: inh expending");
-		/* Scan for all members of inheritance set, acquire needed locks */
-		//inhOIDs = find_all_inheritors(cand->reloid, lockmode, NULL);
-		inhOIDs = find_inheritance_children(cand->reloid, lockmode);
-		/* Check that there's at least one descendant, else treat as no-child
-         * case.  This could happen despite above has_subclass() check, if table
-         * once had a child but no longer does.
-         */
-		//if (list_length(inhOIDs) < 2)
-		if (list_length(inhOIDs) < 1)
-		{
-			/* Clear flag before returning */
-			elog(DEBUG3,"expand_inherited_rel_clauses: not enough inh -> skipping");
-			continue;
-		}
+	result = strcmp( c1->cand->erefAlias, c2->cand->erefAlias );
+	if( result != 0 )
+		return result;
 
-		elog(DEBUG3,"expand_inherited_rel_clauses: loop over sons: %d ",list_length(inhOIDs));
-		foreach(l, inhOIDs)
-		{
-			//int i;
-			Oid         childOID = lfirst_oid(l);
-			RelClause* cic = (RelClause*)palloc(sizeof(RelClause));
+	if( c1->equality != c2->equality )
+		return c1->equality ? -1 : 1;
 
-			//Relation base_rel = heap_open( childOID, AccessShareLock );
-			/* init some members of composite candidate 1 */
-			cic->reloid			= childOID;
-			cic->erefAlias      = cand->erefAlias;
-			elog(DEBUG3,"expand_inherited_rel_clauses: create chield clause for %d, name: %s",childOID,cic->erefAlias);
+	if( c1->ndistinct != c2->ndistinct )
+		return c1->ndistinct > c2->ndistinct ? -1 : 1;
 
-			/* cope table clause experessions for the new cheild table */
-			cic->predicate = list_copy(cand->predicate);
-			table_clauses = lappend(table_clauses, cic);
-		}
-	}
-	elog(DEBUG3,"expand_inherited_rel_clauses: Exit - length: %d",list_length(table_clauses));
+	return c1->cand->cols->varattno[0] - c2->cand->cols->varattno[0];
 }
 
+/* order the column orderings by descending score */
+static int composite_ordering_cmp( const void* a, const void* b )
+{
+	const CompositeOrdering* const o1 = (const CompositeOrdering*) a;
+	const CompositeOrdering* const o2 = (const CompositeOrdering*) b;
+
+	if( o1->score != o2->score )
+		return o1->score > o2->score ? -1 : 1;
+
+	return o1->lead - o2->lead;
+}
 
 /**
  * build_composite_candidates.
  *
- * @param [IN] list1 is a sorted list of candidates in ascending order.
- * @param [IN] list2 is a sorted list of candidates in ascending order.
+ * @param [IN] columns is a list of CompositeColumn - the single column btree
+ * candidates found in the arms of an AND expression.
  *
- * @returns A new sorted list containing composite candidates.
+ * @returns A new list containing the composite candidates.
+ *
+ * Rather than every ordered pair of columns, only the most promising orderings
+ * of each relation's columns are built: the columns are ranked equality before
+ * range and then by n_distinct, and every column in turn leads an ordering
+ * followed by the rest in rank order (up to index_adviser.composit_max_cols
+ * columns). The index_adviser.composite_orderings orderings with the best score
+ * - the column weights, discounted by their position - become candidates.
  */
 static List*
-build_composite_candidates( List* list1, List* list2 )
+build_composite_candidates( List* columns )
 {
-	ListCell *cell1 = list_head( list1 );
-	ListCell *cell2 = list_head( list2 );
-	IndexCandidate *cand1;
-	IndexCandidate *cand2;
+	CompositeColumn		**array;
+	CompositeOrdering	*orderings;
+	ListCell			*cell;
+	int					ncolumns = list_length( columns );
+	int					n = 0;
+	int					start;
 
 	List* compositeCandidates = NIL;
 
 	elog( DEBUG4, "IND ADV: build_composite_candidates: ENTER" );
 
-	if( cell1 == NULL || cell2 == NULL )
+	if( ncolumns < 2 || idxadv_composite_orderings <= 0
+		|| idxadv_composit_max_cols < 2 )
 		goto DoneCleanly;
 
-	elog( DEBUG4, "IND ADV: ---build_composite_candidates---" );
-	log_candidates( "idxcd-list1", list1 );
-	log_candidates( "idxcd-list2", list2 );
-
-		/* build list with composite candiates */
-	while( ( cell1 != NULL ) && ( cell2 != NULL ) )
-	{
-		int cmp ;
+	array = (CompositeColumn**) palloc( ncolumns * sizeof(CompositeColumn*) );
+	foreach( cell, columns )
+		array[ n++ ] = (CompositeColumn*)lfirst( cell );
 
-		cand1 = ((IndexCandidate*)lfirst( cell1 ));
-		cand2 = ((IndexCandidate*)lfirst( cell2 ));
+	qsort( array, n, sizeof(CompositeColumn*), composite_column_cmp );
 
-        /*!
-         * \TODO: fix the comparisson to create composite indexes
-         */
-        elog( DEBUG4, "IND ADV: build_composite_candidates: compare reloids %d %d", cand1->reloid, cand2->reloid);
-		cmp = cand1->reloid - cand2->reloid;
-		elog( DEBUG4, "IND ADV: build_composite_candidates: compare aliases %s %s",cand1->erefAlias,cand2->erefAlias );
-		cmp = cmp + strcmp(cand1->erefAlias,cand2->erefAlias);
+	orderings = (CompositeOrdering*) palloc( n * sizeof(CompositeOrdering) );
 
-		if( cmp != 0 )
+	/* one relation (and alias) at a time */
+	for( start = 0; start < n; )
+	{
+		CompositeColumn	*group[ INDEX_MAX_KEYS ];
+		int				ngroup = 0;
+		int				end;
+		int				maxcols;
+		int				norderings = 0;
+		int				lead;
+		int				k;
+
+		for( end = start; end < n
+				&& array[ end ]->cand->reloid == array[ start ]->cand->reloid
+				&& strcmp( array[ end ]->cand->erefAlias, array[ start ]->cand->erefAlias ) == 0;
+			 ++end )
 		{
-			Oid relOid;
-
-			if( cmp < 0 )
+			/* the same column may appear in several arms; keep its best rank */
+			if( ngroup > 0 && ngroup < INDEX_MAX_KEYS )
 			{
-				/* advance in list 1 */
-				relOid = cand2->reloid;
+				int		g;
+				bool	seen = false;
 
-				do
-					cell1 = lnext( cell1 );
-				while( cell1 != NULL && (relOid > cand1->reloid));
+				for( g = 0; g < ngroup && !seen; ++g )
+					seen = group[ g ]->cand->cols->varattno[0] == array[ end ]->cand->cols->varattno[0];
+				if( seen )
+					continue;
 			}
-			else
-			{
-				/* advance in list 2 */
-				relOid = cand1->reloid;
 
-				do
-					cell2 = lnext( cell2 );
-				while( cell2 != NULL && ( relOid > cand2->reloid ));
-			}
+			if( ngroup < INDEX_MAX_KEYS )
+				group[ ngroup++ ] = array[ end ];
 		}
-		else
-		{
-			/* build composite candidates */
-			Oid relationOid = ((IndexCandidate*)lfirst(cell1))->reloid;
-			char* alias = ((IndexCandidate*)lfirst(cell1))->erefAlias;
-			ListCell* l1b;
 
-			elog( DEBUG3, "IND ADV: build_composite_candidates: build composite candidates %s ",alias );
+		start = end;
 
-			do
-			{
-				cand2 = lfirst( cell2 );
+		maxcols = Min( Min( ngroup, idxadv_composit_max_cols ), INDEX_MAX_KEYS - 1 );
+		if( maxcols < 2 )
+			continue;
 
-				l1b = cell1;
-				do
-				{
-					cand1 = lfirst( l1b );
+		/* score the ordering led by each column */
+		for( lead = 0; lead < ngroup; ++lead )
+		{
+			double	score = 0;
+			int		pos = 0;
+			int		g;
 
-					/* do not build a composite candidate if the number of
-					 * attributes would exceed INDEX_MAX_KEYS
-					*/
-					if(( ( cand1->ncols + cand2->ncols ) < INDEX_MAX_KEYS )&&(( cand1->ncols + cand2->ncols ) <= idxadv_composit_max_cols))
-					{
+			for( g = -1; g < ngroup && pos < maxcols; ++g )
+			{
+				const CompositeColumn* col;
 
-						/* Check if candidates have any common attribute */
-						int		i1, i2;
-						bool	foundCommon = false;
-
-						for(i1 = 0; i1 < cand1->ncols && !foundCommon; ++i1)
-							for(i2 = 0; i2 < cand2->ncols && !foundCommon; ++i2)
-								if(cand1->varattno[i1] == cand2->varattno[i2])
-									foundCommon = true;
-						if( foundCommon )
-							elog( DEBUG3, "IND ADV: build_composite_candidates: found common - %d - skipping ",cand1->varattno[i1] );
-
-						/* build composite candidates if the previous test
-						 * succeeded
-						 */
-						if( !foundCommon )
-						{
-							signed int cmp;
+				if( g == lead )
+					continue;
+				col = group[ g < 0 ? lead : g ];
 
-							/* composite candidate 1 is a combination of
-							 * candidates 1,2 AND
-							 * composite candidate 2 is a combination of
-							 * candidates 2,1
-							 */
-							IndexCandidate* cic1
-								= (IndexCandidate*)palloc(
-													sizeof(IndexCandidate));
-							IndexCandidate* cic2
-								= (IndexCandidate*)palloc(
-													sizeof(IndexCandidate));
-
-							/* init some members of composite candidate 1 */
-							cic1->varno			= -1;
-							cic1->varlevelsup	= -1;
-							cic1->ncols			= cand1->ncols + cand2->ncols;
-							cic1->reloid		= relationOid;
-							cic1->erefAlias     = pstrdup(alias);
-							cic1->idxused		= false;
-
-							/* init some members of composite candidate 2 */
-							cic2->varno			= -1;
-							cic2->varlevelsup	= -1;
-							cic2->ncols			= cand1->ncols + cand2->ncols;
-							cic2->reloid		= relationOid;
-							cic2->erefAlias     = pstrdup(alias);
-							cic2->idxused		= false;
-
-                            elog( DEBUG3, "IND ADV: build_composite_candidates: start att copy, ncols1: %d, ncols2: %d - total: %d", cand1->ncols , cand2->ncols,cic2->ncols);
-							/* copy attributes of candidate 1 to attributes of
-							 * composite candidates 1,2
-							 */
-							for( i1 = 0; i1 < cand1->ncols; ++i1)
-							{
-								cic1->vartype[ i1 ]
-									= cic2->vartype[cand2->ncols + i1]
-									= cand1->vartype[ i1 ];
-
-								cic1->varattno[ i1 ]
-									= cic2->varattno[cand2->ncols + i1]
-									= cand1->varattno[ i1 ];
-								cic1->varname[ i1 ]
-				                    = cic2->varname[cand2->ncols + i1]
-                                	= cand1->varname[ i1 ];
-							}
-
-							/* copy attributes of candidate 2 to attributes of
-							 * composite candidates 2,1
-							 */
-							for( i1 = 0; i1 < cand2->ncols; ++i1)
-							{
-								cic1->vartype[cand1->ncols + i1]
-									= cic2->vartype[ i1 ]
-									= cand2->vartype[ i1 ];
-
-								cic1->varattno[cand1->ncols + i1]
-									= cic2->varattno[ i1 ]
-									= cand2->varattno[ i1 ];
-
-								cic1->varname[cand1->ncols + i1]
-                                    = cic2->varname[ i1 ]
-				                    = cand2->varname[ i1 ];
-							}
-
-							/* set remaining attributes to null */
-							for( i1 = cand1->ncols + cand2->ncols;
-									i1 < INDEX_MAX_KEYS;
-									++i1 )
-							{
-								cic1->varattno[ i1 ] = 0;
-								cic2->varattno[ i1 ] = 0;
-							}
+				score += ( col->equality ? 2.0 : 1.0 ) * ( 1.0 + log( 1.0 + col->ndistinct ) )
+							/ ( pos + 1 );
+				++pos;
+			}
 
-							/* cope index experessions for the new composite indexes */
-							cic1->attList = list_concat_unique(cand1->attList,cand2->attList);
-							cic2->attList = list_concat_unique(cand2->attList,cand1->attList);
-							elog(DEBUG3,"build_composite_candidates: start att copy,attlist cic1: %d, cic2: %d ",list_length(cic1->attList),list_length(cic2->attList));
+			orderings[ norderings ].lead = lead;
+			orderings[ norderings ].score = score;
+			++norderings;
+		}
 
-							/* add new composite candidates to list */
-							cmp = compare_candidates(cic1, cic2);
+		qsort( orderings, norderings, sizeof(CompositeOrdering), composite_ordering_cmp );
 
-							if( cmp == 0 )
-							{
-								compositeCandidates =
-									merge_candidates( list_make1( cic1 ),
-													compositeCandidates );
-								pfree( cic2 );
-							}
-							else
-							{
-								List* l;
+		for( k = 0; k < norderings && k < idxadv_composite_orderings; ++k )
+		{
+			const IndexCandidate* const first = group[ orderings[ k ].lead ]->cand;
+			IndexCandidate* cic = (IndexCandidate*)palloc0( sizeof(IndexCandidate) );
+			int		pos = 0;
+			int		g;
 
-								if( cmp < 0 )
-									l = lcons( cic1, list_make1( cic2 ) );
-								else
-									l = lcons( cic2, list_make1( cic1 ) );
+			cic->varno			= -1;
+			cic->varlevelsup	= -1;
+			cic->cols			= make_candidate_cols( maxcols );
+			cic->reloid			= first->reloid;
+			cic->erefAlias		= pstrdup( first->erefAlias );
+			cic->amOid			= BTREE_AM_OID;
+			cic->inh			= first->inh;
+			cic->idxused		= false;
 
-								compositeCandidates =
-									merge_candidates(l, compositeCandidates);
-							}
-						}
-					}
+			for( g = -1; g < ngroup && pos < maxcols; ++g )
+			{
+				const IndexCandidate* col;
 
-					l1b = lnext( l1b );
+				if( g == orderings[ k ].lead )
+					continue;
+				col = group[ g < 0 ? orderings[ k ].lead : g ]->cand;
 
-				} while( ( l1b != NULL ) &&
-					( relationOid == ((IndexCandidate*)lfirst( l1b ))->reloid));
+				cic->cols->vartype[ pos ]	= col->cols->vartype[ 0 ];
+				cic->cols->varattno[ pos ]	= col->cols->varattno[ 0 ];
+				++pos;
+			}
 
-				cell2 = lnext( cell2 );
+			elog( DEBUG3, "IND ADV: build_composite_candidates: %s, ordering %d, score %.2f",
+				  cic->erefAlias, k, orderings[ k ].score );
 
-			} while( ( cell2 != NULL ) &&
-				( relationOid == ((IndexCandidate*)lfirst( cell2 ))->reloid ) );
-			cell1 = l1b;
+			compositeCandidates = lappend( compositeCandidates, cic );
 		}
 	}
 
+	pfree( orderings );
+	pfree( array );
+
 	log_candidates( "composite-l", compositeCandidates );
 
 DoneCleanly:
@@ -3094,7 +4777,11 @@ DoneCleanly:
 
 /**
  * create_virtual_indexes
- *    creates an index for every entry in the index-candidate-list.
+ *    registers a hypothetical index for every entry in the index-candidate-list.
+ *
+ * Nothing is written to the catalogs; every candidate just gets its opclasses
+ * resolved and a virtual index oid assigned. get_relation_info_callback() later
+ * builds the IndexOptInfo straight from the candidate.
  *
  * It may delete some candidates from the list passed in to it.
  */
@@ -3102,301 +4789,306 @@ static List* create_virtual_indexes( List* candidates )
 {
 	ListCell	*cell;					  /* an entry from the candidate-list */
 	ListCell	*prev, *next;						 /* for list manipulation */
-	char		idx_name[ 16 ];		/* contains the name of the current index */
-	int		idx_count = 0;				   /* number of the current index */
-	IndexInfo*	indexInfo;
-	Oid		op_class[INDEX_MAX_KEYS];			/* the field op class family */
-	Oid		collationObjectId[INDEX_MAX_KEYS];	/* the field collation */
+	Oid			idxoid = IDX_ADV_FIRST_VIRTUAL_OID;
 
 	elog( DEBUG4, "IND ADV: create_virtual_indexes: ENTER" );
-
-	/* fill index-info */
-	indexInfo = makeNode( IndexInfo );
-
-	indexInfo->ii_Expressions		= NIL;
-	indexInfo->ii_ExpressionsState	= NIL;
-	indexInfo->ii_PredicateState	= NIL;
-	indexInfo->ii_Unique			= false;
-	indexInfo->ii_Concurrent		= true;
-    indexInfo->ii_ReadyForInserts   = false;
-	indexInfo->ii_BrokenHotChain    = false;
-	indexInfo->ii_ExclusionOps      = NULL;
-	indexInfo->ii_ExclusionProcs    = NULL;
-	indexInfo->ii_ExclusionStrats   = NULL;
-
-	/* create index for every list entry */
-	/* TODO: simplify the check condition of the loop; it is basically
-	 * advancing the 'next' pointer, so maybe this will work
-	 * (next=lnext(), cell()); Also, advance the 'prev' pointer in the loop
-	 */
 	elog( DEBUG1, "IND ADV: create_virtual_indexes: number of cand: %d", list_length(candidates) );
 
-	for( prev = NULL, cell = list_head(candidates);
-			(cell && (next = lnext(cell))) || cell != NULL;
-			cell = next)
+	for( prev = NULL, cell = list_head(candidates); cell != NULL; cell = next )
 	{
 		int			i;
-
 		IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
-		List *colNames=NIL;
 
-		indexInfo->ii_NumIndexAttrs = cand->ncols;
-		elog( DEBUG3, "IND ADV: create_virtual_indexes: pre predicate %d, %s, %s", cand->reloid,cand->erefAlias,cand->varname[0]);
-
-		indexInfo->ii_Predicate	    = get_rel_clauses(table_clauses, cand->reloid,cand->erefAlias); /* use the clause found for the relevant relation. */
-		elog_node_display( DEBUG4 , "index_create", (Node*)indexInfo->ii_Predicate,true);
-		//  indexInfo->ii_Predicate	    = NIL;
-		//	indexInfo->ii_KeyAttrNumbers[attn] = 0; /* marks expression */
-		elog( DEBUG4, "IND ADV: create_virtual_indexes: add the predicate list to the index, length %d, ncols: %d", list_length(cand->attList),cand->ncols);
-
-		indexInfo->ii_Expressions = list_concat_unique(indexInfo->ii_Expressions, cand->attList);
-
-		//elog_node_display( DEBUG2 , "index_create - func: ", (Node*)indexInfo->ii_Expressions,true);
+		next = lnext( cell );
 
-		for( i = 0; i < cand->ncols; ++i )
+		for( i = 0; i < cand->cols->ncols; ++i )
 		{
-			elog( DEBUG4, "IND ADV: create_virtual_indexes: prepare op_class[] vartype: %d", cand->vartype[ i ]);
+			elog( DEBUG4, "IND ADV: create_virtual_indexes: prepare op_class[] vartype: %d", cand->cols->vartype[ i ]);
 			/* prepare op_class[] */
-			collationObjectId[i] = 0;
-			op_class[i] = GetDefaultOpClass( cand->vartype[ i ], cand->amOid );
+			cand->cols->collationObjectId[i] = InvalidOid;
+			cand->cols->op_class[i] = GetDefaultOpClass( cand->cols->vartype[ i ], cand->amOid );
 			/* Replace text_ops with text_pattern_ops */
-			if (op_class[i]==3126){
-				idxadv_text_pattern_ops?op_class[i] = 10049:NULL;
-                                //  see pg_opclass.oid - this actually works, changes to text_pattern_ops instead of pattern ops (in te strangest way ever... see: http://doxygen.postgresql.org/indxpath_8c_source.html#l03403)
+			if (cand->cols->op_class[i]==3126){
+				if (idxadv_text_pattern_ops)
+					cand->cols->op_class[i] = 10049;
+				//  see pg_opclass.oid - this actually works, changes to text_pattern_ops instead of pattern ops (in te strangest way ever... see: http://doxygen.postgresql.org/indxpath_8c_source.html#l03403)
 				// TODO: find a way to get this via SYSCACHE instead of fixed numbers (or at least make CONSTS)
-				collationObjectId[i] = DEFAULT_COLLATION_OID ; //100; // need to figure this out - 100 is the default but doesn't pass for some reason...
+				cand->cols->collationObjectId[i] = DEFAULT_COLLATION_OID;
 			}
 
-
-			if( op_class[i] == InvalidOid )
+			if( cand->cols->op_class[i] == InvalidOid )
 				/* don't create this index if couldn't find a default operator*/
 				break;
-
-			/* ... and set indexed attribute number */
-			indexInfo->ii_KeyAttrNumbers[i] = cand->varattno[i];
-			colNames = lappend(colNames,cand->varname[i]);
-			elog( DEBUG3, "col: %d, attrno: %d, opclass: %d", cand->varname[i],cand->varattno[i],op_class[i]);
 		}
-		elog( DEBUG4, "IND ADV: create_virtual_indexes: pre create" );
 
 		/* if we decided not to create the index above, try next candidate */
-		if( i < cand->ncols )
+		if( i < cand->cols->ncols )
 		{
 			candidates = list_delete_cell( candidates, cell, prev );
 			continue;
 		}
 
-		/* generate indexname */
-		/* FIXME: This index name can very easily collide with any other index
-		 * being created simultaneously by other backend running index adviser.
-		*/
-		sprintf( idx_name, "idx_adv_%d", idx_count );
-        elog( DEBUG4, "IND ADV: create_virtual_indexes: pre create" );
-        elog( DEBUG4, "idxx name: %s", idx_name );
-
-        elog( DEBUG4, "IND ADV: create_virtual_indexes: open relation" );
-		// CHECK: get Relation from  cand->reloid
-		Relation relation = heap_open( cand->reloid, AccessShareLock );
-        elog( DEBUG4, "IND ADV: create_virtual_indexes: create the index" );
-
-		/* create the index without data */
-		cand->idxoid = index_create( relation
-					, idx_name
-					, InvalidOid
-					, InvalidOid
-					, indexInfo
-					, colNames
-					, cand->amOid //, BTREE_AM_OID
-					, InvalidOid
-					, collationObjectId
-					, op_class
-					, NULL
-					, (Datum)0 //reloptions
-					, false //isprimary
-					, false //isconstraint
-					, false // deferrable
-					, false //initdeferred
-					, false // allow_system_table_mods
-					,true // skip build
-#if PG_VERSION_NUM >= 90300
-					,true	// 	concurrent
-#endif
-					,false //is_internal true/false?
-#if PG_VERSION_NUM >= 90500
-					,false // if_not_exists
-#endif
-					);
-
-		// TODO: update candidate fields:
-		for( i = 0; i < cand->ncols; ++i )
-		{
-			cand->op_class[i] = op_class[i];
-			cand->collationObjectId[i] = collationObjectId[i];
-		}
-
+		/*
+		 * Skip oids which are taken by a real relation; this keeps the
+		 * planner's pg_statistic lookups (done by index oid for expression
+		 * columns) from picking up somebody else's stats.
+		 */
+		while( SearchSysCacheExists1( RELOID, ObjectIdGetDatum( idxoid ) ) )
+			--idxoid;
 
-		elog( DEBUG4, "IND ADV: virtual index created: oid=%d name=%s size=%d",
-					cand->idxoid, idx_name, cand->pages );
+		cand->idxoid = idxoid--;
+		cand->active = true;
 
-		/* close the heap */
-        heap_close(relation, AccessShareLock);
-		elog( DEBUG4, "IND ADV: create_virtual_indexes: numindex %d",list_length( RelationGetIndexList(relation)));
+		elog( DEBUG4, "IND ADV: virtual index created: oid=%d", cand->idxoid );
 
-		/* increase count for the next index */
-		++idx_count;
 		prev = cell;
 	}
 
-	pfree( indexInfo );
+	/* index the candidates by their virtual oid; the planner hooks look them up */
+	if( candidates != NIL )
+	{
+		HASHCTL		ctl;
+
+		memset( &ctl, 0, sizeof(ctl) );
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(VirtualIndexEntry);
+		ctl.hash = oid_hash;
+		ctl.hcxt = CurrentMemoryContext;
+		virtual_indexes = hash_create( "index_adviser virtual indexes",
+									   list_length( candidates ), &ctl,
+									   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+
+		foreach( cell, candidates )
+		{
+			IndexCandidate* const cand = (IndexCandidate*)lfirst( cell );
+			VirtualIndexEntry *entry;
 
-	/* do CCI to make the new metadata changes "visible" */
-	CommandCounterIncrement();
+			entry = (VirtualIndexEntry*) hash_search( virtual_indexes, &cand->idxoid,
+													  HASH_ENTER, NULL );
+			entry->cand = cand;
+		}
+	}
 
 	elog( DEBUG1, "IND ADV: create_virtual_indexes: EXIT" );
 
 	return candidates;
 }
+
 /**
- * drop_virtual_indexes
- *    drops all virtual-indexes
+ * estimate_index_pages
+ *    the size of the index a candidate would make, in pages.
+ *
+ *     The average width of the key is the sum of the columns' stawidth (their
+ * type's width if not analyzed, or for expressions), discounted by their
+ * stanullfrac - a NULL takes just its bit in the null bitmap. The heap tuples
+ * and pages are those estimate_rel_size() has already given the RelOptInfo,
+ * so there is no lseek per candidate; tuples is the number of heap tuples the
+ * index covers (fewer for a partial index). Then, per access method:
+ *
+ * - btree: a tuple per heap tuple, leaves filled up to the default
+ *   fillfactor; over them levels of internal pages (filled up to
+ *   BTREE_NONLEAF_FILLFACTOR) up to the root, and the meta page. The number of
+ *   internal levels is the tree height, as _bt_getrootheight() would report.
+ * - GiST: a tuple per heap tuple, leaves filled up to the default fillfactor,
+ *   plus the root page.
+ * - hash: a 4-byte hash code per heap tuple, plus the meta and bitmap pages.
+ * - GIN: every distinct key (array element) once, followed by a posting list
+ *   of the TIDs holding it. The number of distinct elements of an array comes
+ *   from its most common elements statistics. A document type (jsonb,
+ *   tsvector) has no such statistics: its keys per row are guessed from its
+ *   average width. The entry and posting pages and the keys are kept in
+ *   cand->gin for index_adviser_gincostestimate().
+ * - BRIN: a summary (min and max) per range of heap pages, plus the range map.
  */
-static void drop_virtual_indexes( List* candidates )
+static BlockNumber estimate_index_pages( const RelOptInfo* rel, IndexCandidate* cand,
+				double tuples, int* tree_height )
 {
-	ListCell* cell;		/* a entry from the index-candidate-list */
+	Size		data_length = 0;	/* average width of the key */
+	bool		hasnulls = false;
+	double		keys = 0;			/* distinct keys, for GIN */
+	double		items = 1;			/* keys per heap tuple, for GIN */
+	double		tuple_size;
+	double		idx_pages;
+	ListCell	*indexpr_item = list_head( cand->attList );
+	int			i;
 
-	elog( DEBUG1, "IND ADV: drop_virtual_indexes: ENTER" );
+	elog( DEBUG3, "IDX_ADV: estimate_index_pages: rel_id: %d, pages: %d, tuples: %f",
+		  cand->reloid, rel->pages, tuples );
 
-	/* drop index for every list entry */
-	foreach( cell, candidates )
+	for( i = 0; i < cand->cols->ncols; ++i )
 	{
-		/* TODO: have a look at implementation of index_drop! citation:
-		 * "NOTE: this routine should now only be called through
-		 * performDeletion(), else associated dependencies won't be cleaned up."
-		 */
-
-		/* disabling index_drop() call, since it acquires AccessExclusiveLock
-		 * on the base table, and hence causing a deadlock when multiple
-		 * clients are running the same query
-		 */
-
-		IndexCandidate* cand = (IndexCandidate*)lfirst( cell );
-		elog( DEBUG1, "IND ADV: dropping virtual index: oid=%d", cand->idxoid );
-		//index_drop( cand->idxoid,true );
-		elog( DEBUG1, "IND ADV: virtual index dropped: oid=%d", cand->idxoid );
-	}
+		Oid			atttype;
+		Oid			elemtype;
+		int32		atttypmod;
+		int16		attlen;
+		bool		attbyval;
+		char		attalign;
+		ColumnStats	stats;
+		bool		analyzed = false;
+		double		width;
+
+		if( cand->cols->varattno[i] != 0 || indexpr_item == NULL )
+		{
+			atttype = cand->cols->vartype[i];
+			atttypmod = get_atttypmod( cand->reloid, cand->cols->varattno[i] );
+			analyzed = get_column_stats( cand->reloid, cand->cols->varattno[i], &stats );
+		}
+		else
+		{
+			/* expression column; a virtual index has no statistics */
+			Node *indexkey = (Node *) lfirst( indexpr_item );
 
-	/* do CCI to make the new metadata changes "visible" */
-	CommandCounterIncrement();
+			indexpr_item = lnext( indexpr_item );
+			atttype = exprType( indexkey );
+			atttypmod = exprTypmod( indexkey );
+		}
 
-	elog( DEBUG3, "IND ADV: drop_virtual_indexes: EXIT" );
-}
+		get_typlenbyvalalign( atttype, &attlen, &attbyval, &attalign );
 
-static 	BlockNumber estimate_index_pages(Oid rel_oid, Oid ind_oid )
-{
-	Size	data_length;
-	int		i;
-	int		natts;
-	int8	var_att_count;
-	BlockNumber rel_pages;						/* diskpages of heap relation */
-	float4	rel_tuples;						/* tupes in the heap relation */
-	double	idx_pages;					   /* diskpages in index relation */
+		if( attlen > 0 )
+			width = attlen;
+		else if( analyzed && stats.width > 0 )
+			width = stats.width;
+		else
+			width = get_typavgwidth( atttype, atttypmod );
 
-	TupleDesc			ind_tup_desc;
-	Relation			base_rel;
-	Relation			index_rel;
-	Form_pg_attribute	*atts;
+		if( analyzed && stats.nullfrac > 0 )
+		{
+			hasnulls = true;
+			width *= 1 - stats.nullfrac;
+		}
 
-	base_rel	= heap_open( rel_oid, AccessShareLock );
-	index_rel	= index_open( ind_oid, AccessShareLock );
+		data_length = att_align_nominal( data_length, attalign );
+		data_length += (Size) ceil( width );
 
-	// rel_pages = base_rel->rd_rel->relpages;
-	rel_tuples = base_rel->rd_rel->reltuples;
-        rel_pages = RelationGetNumberOfBlocks(base_rel);
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: rel_id: %d, pages: %d,, tuples: %f",rel_oid,rel_pages,rel_tuples);
+		/* GIN indexes the elements of an array, each distinct one once */
+		elemtype = get_element_type( atttype );
+		if( OidIsValid( elemtype ) )
+		{
+			int32	elemwidth = get_typavgwidth( elemtype, -1 );
+			double	elemkeys = 0;
 
-	ind_tup_desc = RelationGetDescr( index_rel );
+			items = Max( items, ( width - ARR_OVERHEAD_NONULLS( 1 ) ) / Max( elemwidth, 1 ) );
+#if PG_VERSION_NUM >= 90200
+			if( analyzed )
+				elemkeys = gin_column_keys( cand->reloid, cand->cols->varattno[i], tuples, &items );
+#endif
+			if( elemkeys > 0 )
+				keys += elemkeys;
+			else
+				keys += analyzed && stats.ndistinct > 0 ? stats.ndistinct * items : tuples * items;
+		}
+		else if( cand->amOid == GIN_AM_OID && attlen == -1 )
+		{
+			/*
+			 * a document (jsonb, tsvector, hstore...): its keys have no
+			 * statistics of their own, so tell their number from its width
+			 */
+			double	dockeys = Max( width / IDX_ADV_GIN_DOC_KEY_WIDTH, 1 );
 
-	atts = ind_tup_desc->attrs;
-	natts = ind_tup_desc->natts;
+			items = Max( items, dockeys );
+			keys += analyzed && stats.ndistinct > 0 ? stats.ndistinct * dockeys : tuples * dockeys;
+		}
+		else
+			keys += analyzed && stats.ndistinct > 0 ? stats.ndistinct : tuples;
+	}
 
+	elog( DEBUG3, "IDX_ADV: estimate_index_pages: data_length: %d", (int)data_length );
 
-	/*
-	 * These calculations are heavily borrowed from index_form_tuple(), and
-	 * heap_compute_data_size(). The only difference is that, that they have a
-	 * real tuple being inserted, and hence all the VALUES are available,
-	 * whereas, we don't have any of them available here.
-	 */
+	*tree_height = -1;
 
-	/*
-	 * First, let's calculate the contribution of fixed size columns to the size
-	 * of index tuple
-	 */
-	var_att_count = 0;
-	data_length = 0;
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: natts: %d",natts);
-	for( i = 0; i < natts; ++i)
+	switch( cand->amOid )
 	{
-		/* the following is based on att_addlength() macro */
-		if( atts[i]->attlen > 0 )
+		case HASH_AM_OID:
+			/* only the hash code is stored */
+			tuple_size = MAXALIGN( sizeof(IndexTupleData) + sizeof(uint32) )
+						+ sizeof(ItemIdData);
+			idx_pages = 2 + tuples * tuple_size
+							/ ( (BLCKSZ - SizeOfPageHeaderData - sizeof(HashPageOpaqueData))
+								* ((double)HASH_DEFAULT_FILLFACTOR/100) );
+			break;
+
+		case GIN_AM_OID:
 		{
-			/* No need to do +=; RHS is incrementing data_length by including it in the sum */
-			data_length = att_align_nominal(data_length, atts[i]->attalign);
-			data_length += atts[i]->attlen;
-                        elog(DEBUG3, "IDX_ADV: estimate_index_pages: data_length: %d",data_length);
+			const double usable = BLCKSZ - SizeOfPageHeaderData - sizeof(GinPageOpaqueData);
+
+			/* every key once; the TIDs of its rows in a posting list */
+			keys = Min( Max( keys, 1 ), Max( tuples * items, 1 ) );
+			tuple_size = MAXALIGN( IndexInfoFindDataOffset( 0 ) + data_length / items )
+						+ sizeof(ItemIdData);
+
+			cand->gin.nEntries = keys;
+			cand->gin.nEntryPages = Max( ceil( keys * tuple_size / usable ), 1 );
+			cand->gin.nDataPages = ceil( tuples * items * IDX_ADV_GIN_ITEM_SIZE / usable );
+			idx_pages = 1 + cand->gin.nEntryPages + cand->gin.nDataPages;
+
+			elog( DEBUG3, "IDX_ADV: estimate_index_pages: GIN entries: %.0f, entry pages: %.0f, data pages: %.0f",
+				  cand->gin.nEntries, cand->gin.nEntryPages, cand->gin.nDataPages );
 		}
-		else if( atts[i]->attlen == -1 )
+		break;
+
+		case GIST_AM_OID:
+			tuple_size = MAXALIGN( IndexInfoFindDataOffset( hasnulls ? INDEX_NULL_MASK : 0 )
+									+ data_length )
+						+ sizeof(ItemIdData);
+			idx_pages = 1 + tuples * tuple_size
+							/ ( (BLCKSZ - SizeOfPageHeaderData - sizeof(GISTPageOpaqueData))
+								* ((double)GIST_DEFAULT_FILLFACTOR/100) );
+			break;
+
+#if PG_VERSION_NUM >= 90500
+		case BRIN_AM_OID:
 		{
-			data_length += atts[i]->atttypmod + VARHDRSZ;
+			/* min and max of every column per range */
+			double ranges = ceil( (double)rel->pages / BRIN_DEFAULT_PAGES_PER_RANGE );
+
+			tuple_size = MAXALIGN( IndexInfoFindDataOffset( INDEX_NULL_MASK )
+									+ 2 * data_length )
+						+ sizeof(ItemIdData);
+			idx_pages = 1 + ceil( ranges / REVMAP_PAGE_MAXITEMS )
+						+ ranges * tuple_size
+							/ (BLCKSZ - SizeOfPageHeaderData - sizeof(BrinSpecialSpace));
 		}
-		else
-		{	/* null terminated data */
-			Assert( atts[i]->attlen == -2 );
-			++var_att_count;
+		break;
+#endif
+
+		default:
+		{
+			const double usable = BLCKSZ - SizeOfPageHeaderData - sizeof(BTPageOpaqueData);
+			double	level_pages;
+			double	fanout;
+			int		height = 0;
+
+			tuple_size = MAXALIGN( IndexInfoFindDataOffset( hasnulls ? INDEX_NULL_MASK : 0 )
+									+ data_length )
+						+ sizeof(ItemIdData);
+
+			/* the leaves, plus the meta page */
+			level_pages = Max( ceil( tuples * tuple_size
+									 / ( usable * ((double)BTREE_DEFAULT_FILLFACTOR/100) ) ), 1 );
+			idx_pages = 1 + level_pages;
+
+			/* the internal levels hold a downlink (a key) per page below */
+			fanout = Max( floor( usable * ((double)BTREE_NONLEAF_FILLFACTOR/100) / tuple_size ), 2 );
+			while( level_pages > 1 )
+			{
+				level_pages = ceil( level_pages / fanout );
+				idx_pages += level_pages;
+				++height;
+			}
+
+			/* other AMs are only sized like a btree; their height means nothing */
+			if( cand->amOid == BTREE_AM_OID )
+				*tree_height = height;
+
+			elog( DEBUG3, "IDX_ADV: estimate_index_pages: tree height: %d", height );
 		}
+		break;
 	}
 
-	/*
-	 * Now, estimate the average space occupied by variable-length columns, per
-	 * tuple. This is calculated as:
-	 *     Total 'available' space
-	 *       minus space consumed by ItemIdData
-	 *       minus space consumed by fixed-length columns
-	 *
-	 * This calculation is very version specific, so do it for every major release.
-	 * TODO: Analyze it for at least 1 major release and document it (perhaps
-	 * 			branch the code if it deviates to a later release).
-	 */
-	if( var_att_count )
-		data_length += (((float)rel_pages * (BLCKSZ - (sizeof(PageHeaderData)
-					- sizeof(ItemIdData)
-				)	)	)
-				- (rel_tuples * sizeof(ItemIdData))
-				- (data_length * rel_tuples)
-			)
-				/rel_tuples;
-
-	/* Take into account the possibility that we might have NULL values */
-	data_length += IndexInfoFindDataOffset( INDEX_NULL_MASK );
-
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: data_length: %d",data_length);
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: sizeof(ItemIdData): %d",sizeof(ItemIdData));
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: rel_tuples: %f",rel_tuples);
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: SizeOfPageHeaderData: %d",SizeOfPageHeaderData);
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: BLCKSZ: %d",BLCKSZ);
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: sizeof(BTPageOpaqueData: %d",sizeof(BTPageOpaqueData));
-
-	idx_pages = (rel_tuples * (data_length + sizeof(ItemIdData)))
-				/((BLCKSZ - SizeOfPageHeaderData
-						- sizeof(BTPageOpaqueData)
-					)
-					* ((float)BTREE_DEFAULT_FILLFACTOR/100));
-	//idx_pages = ceil( idx_pages );
-
-	heap_close( base_rel, AccessShareLock );
-	index_close( index_rel, AccessShareLock );
+	elog( DEBUG3, "IDX_ADV: estimate_index_pages: idx_pages: %.0f", idx_pages );
 
-        elog(DEBUG3, "IDX_ADV: estimate_index_pages: idx_pages: %d, %d",(int8)lrint(idx_pages), (BlockNumber)lround(idx_pages));
-	return (BlockNumber)lrint(idx_pages);
+	return (BlockNumber) ceil( idx_pages );
 }
 
 
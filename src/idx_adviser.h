@@ -12,12 +12,33 @@
 
 #include "postgres.h"
 
+#include "access/transam.h"
 #include "nodes/print.h"
 #include "parser/parsetree.h"
 #include "catalog/namespace.h"
 #include "executor/executor.h"
+#include "gin_cost.h"
+#include "nodes/bitmapset.h"
 #include "utils.h"
 
+/*! \struct IndexCandidateCols
+ * \brief the columns of an index candidate.
+ *
+ * All the per-column arrays live in one chunk sized for ncols (see
+ * make_candidate_cols()); the attnums are packed so candidates compare with a
+ * single memcmp(). Shared by the candidates of the children of an inherited
+ * table: only create_virtual_indexes() writes to it once it is built, and the
+ * opclasses it resolves are the same for all of them.
+ */
+typedef struct {
+	int			ncols;					/**< number of indexed columns */
+	Oid*		vartype;				/**< type of the column(s) */
+	Oid*		op_class;				/**< the field op class family */
+	Oid*		collationObjectId;		/**< the field collation */
+	AttrNumber*	varattno;				/**< attribute number of the column(s), 0 for expressions */
+	char		data[FLEXIBLE_ARRAY_MEMBER];	/**< the arrays above */
+} IndexCandidateCols;
+
 /*! \struct IndexCandidate
  * \brief A struct to represent an index candidate.
  * contains all the information needed to create the virtual index
@@ -26,19 +47,17 @@ typedef struct {
 
 	Index		varno;					/**< index into the rangetable */
 	Index		varlevelsup;			/**< points to the correct rangetable */
-	int8		ncols;					/**< number of indexed columns */
-	Oid		vartype[INDEX_MAX_KEYS];/**< type of the column(s) */
-	AttrNumber	varattno[INDEX_MAX_KEYS];/**< attribute number of the column(s) */
-	char*       	varname[INDEX_MAX_KEYS];/**< attribute name */
-	Oid		op_class[INDEX_MAX_KEYS];			/* the field op class family */
-	Oid		collationObjectId[INDEX_MAX_KEYS];	/* the field collation */
+	IndexCandidateCols*	cols;			/**< the indexed columns */
 	List *		attList;				/**< list of IndexElem's - describe each parameter */
 	Oid		reloid;					/**< the table oid */
 	char*       	erefAlias;              /**< hold rte->eref->aliasname */
-	Oid		idxoid;				    /**< the virtual index oid */
+	Oid		idxoid;				    /**< the virtual (catalog-free) index oid */
 	BlockNumber	pages;					/**< the estimated size of index */
 	double		tuples;					/**< number of index tuples in index */
+	int			tree_height;			/**< estimated btree height, -1 if unknown */
+	VirtualGinStats	gin;				/**< made up metapage statistics of a GIN candidate */
 	bool		idxused;				/**< was this used by the planner? */
+	bool		active;					/**< offered to the planner in the current re-plan? */
 	float4		benefit;				/**< benefit made by using this cand */
 	bool		inh;					/**< does the RTE allow inheritance */
 	Oid	 	parentOid;				/**< the parent table oid */
@@ -52,6 +71,8 @@ typedef struct {
     Oid         reloid;					/**< the table oid */
     char*       erefAlias;              /**< hold rte->eref->aliasname */
     List*       predicate;              /**< the predicates used for the partial indexs */
+    Selectivity selectivity;            /**< of the predicate, see predicate_selectivity() */
+    bool        selectivityValid;       /**< has selectivity been computed? */
 } RelClause;
 
 typedef struct {
@@ -59,10 +80,120 @@ typedef struct {
     List*   candidates;                 /**< list of candidates init to NIL; */
 } QueryContext;
 
+/*!
+ * \brief what ANALYZE knows about a column, see get_column_stats().
+ */
 typedef struct {
-    List*   opnos;                  /**< list of supported b-tree operations */
-    List*   ginopnos;                 /**< list of supported gin operations */
-    List*   gistopnos;                 /**< list of supported gist operations */
+    int32       width;                  /**< average stored width (stawidth) */
+    float4      nullfrac;               /**< fraction of NULLs (stanullfrac) */
+    double      ndistinct;              /**< distinct values, made absolute */
+} ColumnStats;
+
+/*!
+ * \brief a column of an AND expression, as input to build_composite_candidates().
+ */
+typedef struct {
+    IndexCandidate* cand;               /**< the single column btree candidate */
+    bool        equality;               /**< is it compared for equality? */
+    double      ndistinct;              /**< distinct values, 0 if unknown */
+} CompositeColumn;
+
+/*!
+ * \brief a column ordering considered by build_composite_candidates().
+ */
+typedef struct {
+    int         lead;                   /**< the column leading the ordering */
+    double      score;                  /**< how promising the ordering is */
+} CompositeOrdering;
+
+/*!
+ * \brief the cost saved for a bind value sample, see advise_on_param_samples().
+ */
+typedef struct {
+    int         sample;                 /**< index of the sample */
+    Cost        costSaved;              /**< total cost saved with its values */
+} SampleCost;
+
+/*!
+ * \brief a statement of the workload advised on by index_advise_workload().
+ */
+typedef struct {
+    int         queryNo;                /**< position of its text in the array, from 1 */
+    Query*      query;                  /**< the analyzed and rewritten statement */
+    Cost        actualCost;             /**< total cost without virtual indexes */
+} WorkloadQuery;
+
+/*!
+ * \brief identifies a candidate in unique_candidates(); hashed as raw bytes.
+ */
+typedef struct {
+    Oid         reloid;                 /**< the table oid */
+    Oid         amOid;                  /**< the access method */
+    uint32      aliasHash;              /**< hash of the table alias */
+    uint32      exprHash;               /**< hash of the index expressions */
+    int         ncols;                  /**< number of columns */
+    AttrNumber  attnos[INDEX_MAX_KEYS]; /**< the columns */
+} CandidateKey;
+
+typedef struct {
+    CandidateKey    key;                /**< hash key */
+    List*           cands;              /**< the distinct candidates seen with the key */
+} CandidateSetEntry;
+
+/*!
+ * \brief identifies an advised index whatever the alias of its relation, in
+ * index_advise_workload(); hashed as raw bytes.
+ */
+typedef struct {
+    Oid         reloid;                 /**< the table oid */
+    Oid         amOid;                  /**< the access method */
+    uint32      textHash;               /**< hash of the CREATE INDEX statement -
+                                             the expressions and the predicate */
+    int         ncols;                  /**< number of columns */
+    AttrNumber  attnos[INDEX_MAX_KEYS]; /**< the columns */
+    Oid         opclasses[INDEX_MAX_KEYS]; /**< the op classes of the columns */
+} AdvisedIndexKey;
+
+typedef struct {
+    AdvisedIndexKey key;                /**< hash key */
+    IndexCandidate* cand;               /**< the first candidate advising the index */
+    char*           recommendation;     /**< its CREATE INDEX statement */
+} AdvisedIndexEntry;
+
+/*!
+ * \brief maps a virtual index oid to its candidate.
+ */
+typedef struct {
+    Oid             idxoid;             /**< hash key - the virtual index oid */
+    IndexCandidate* cand;               /**< the candidate */
+} VirtualIndexEntry;
+
+/*!
+ * \brief index_adviser.cols as a list of names; the GUC "extra" of the setting.
+ */
+typedef struct {
+    int         ncols;                  /**< number of column names */
+    NameData    names[FLEXIBLE_ARRAY_MEMBER]; /**< the column names */
+} PartialColumns;
+
+/*!
+ * \brief the columns of index_adviser.cols found in a relation.
+ */
+typedef struct {
+    Oid         reloid;                 /**< hash key - the table oid */
+    Bitmapset*  attnums;                /**< attribute numbers of the columns */
+} PartialColumnsEntry;
+
+/*!
+ * \brief the supported operators, as sorted oid arrays (see operator_in_array()).
+ */
+typedef struct {
+    Oid*    opnos;                  /**< supported b-tree operations */
+    int     nopnos;
+    Oid*    ginopnos;                 /**< supported gin operations */
+    int     nginopnos;
+    Oid*    gistopnos;                 /**< supported gist operations */
+    int     ngistopnos;
 } OpnosContext;
 
 typedef struct
@@ -74,6 +205,7 @@ typedef struct
 
 extern void _PG_init(void);
 extern void _PG_fini(void);
+extern Datum index_advise_workload( PG_FUNCTION_ARGS );
 
 #define compile_assert(x)	extern int	_compile_assert_array[(x)?1:-1]
 
@@ -91,9 +223,35 @@ extern void _PG_fini(void);
 #define DEBUG_LEVEL_PROFILE	(log_min_messages >= DEBUG2)
 #define DEBUG_LEVEL_CANDS	(log_min_messages >= DEBUG3)
 
+/*
+ * Virtual indexes never reach the catalogs, so their oids are handed out
+ * downwards from here; initdb never gets this far and user objects start
+ * above it.
+ */
+#define IDX_ADV_FIRST_VIRTUAL_OID	(FirstNormalObjectId - 1)
+
+/* average bytes per TID in a GIN posting list; compressed since 9.4 */
+#if PG_VERSION_NUM >= 90400
+#define IDX_ADV_GIN_ITEM_SIZE	2
+#else
+#define IDX_ADV_GIN_ITEM_SIZE	sizeof(ItemPointerData)
+#endif
+
+/* average bytes a key takes in a document (jsonb, tsvector...): a JEntry and a short string */
+#define IDX_ADV_GIN_DOC_KEY_WIDTH	12
+
 /* Index Adviser output table */
 #define IDX_ADV_TABL "index_advisory"
 
+/* columns returned by index_advise_workload() */
+#define IDX_ADV_WORKLOAD_COLS	4
+
+/* number of parameters of the prepared IDX_ADV_TABL insert */
+#define IDX_ADV_INSERT_NARGS	17
+
+/* Index Adviser aggregated output; function upserting into index_advisory_summary */
+#define IDX_ADV_UPSERT "index_advisory_upsert"
+
 /* IDX_ADV_TABL does Not Exist */
 #define IDX_ADV_ERROR_NE	"relation \""IDX_ADV_TABL"\" does not exist."
 
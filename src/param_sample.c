@@ -0,0 +1,238 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file param_sample.c
+ * \brief per-backend reservoir samples of the bind values of statements.
+ *
+ * A generic plan is planned without parameter values, so the advice for it
+ * would be based on default selectivities and no partial index predicates.
+ * The planner hook only runs when a plan is built, so it offers the values of
+ * the custom plans of a parameterized statement - identified by the
+ * fingerprint of its query tree - to a reservoir (Algorithm R) of
+ * index_adviser.param_samples value sets: the first few plans of a prepared
+ * statement, and every later execution the plan cache plans anew. The
+ * generic plan is then advised on with each sampled set bound in turn.
+ *
+ * The samples are kept in a memory context of their own; when too many
+ * statements are sampled they are all flushed.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * includes (ordered alphabetically)
+ * ------------------------------------------------------------------------
+ */
+#include "param_sample.h"
+
+#include "access/hash.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+/*! the samples; created on first use */
+static HTAB* paramSamples = NULL;
+
+/*! holds the entries and the copied bind values */
+static MemoryContext paramSampleContext = NULL;
+
+static void param_sample_free( ParamListInfo params );
+static void param_sample_flush( void );
+static Node* bind_param_values_mutator( Node* node, ParamListInfo params );
+
+/**
+ * param_sample_add
+ *    offers the bind values of a custom plan of the fingerprinted statement to
+ * its reservoir of (at most) size samples.
+ */
+void param_sample_add( uint32 fingerprint, ParamListInfo params, int size )
+{
+	ParamSampleEntry*	entry;
+	MemoryContext		oldcontext;
+	bool				found;
+	int					slot;
+
+	if( params == NULL || params->numParams == 0 || size <= 0 )
+		return;
+
+	size = Min( size, PARAM_SAMPLE_MAX );
+
+	if( paramSamples == NULL )
+	{
+		HASHCTL ctl;
+
+		paramSampleContext = AllocSetContextCreate( TopMemoryContext,
+													"index_adviser param samples",
+													ALLOCSET_DEFAULT_MINSIZE,
+													ALLOCSET_DEFAULT_INITSIZE,
+													ALLOCSET_DEFAULT_MAXSIZE );
+
+		memset( &ctl, 0, sizeof( ctl ) );
+		ctl.keysize = sizeof( uint32 );
+		ctl.entrysize = sizeof( ParamSampleEntry );
+		ctl.hash = oid_hash;
+		ctl.hcxt = paramSampleContext;
+
+		paramSamples = hash_create( "index_adviser param samples",
+									PARAM_SAMPLE_STATEMENTS, &ctl,
+									HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+	}
+	else if( hash_get_num_entries( paramSamples ) >= PARAM_SAMPLE_STATEMENTS
+			 && hash_search( paramSamples, &fingerprint, HASH_FIND, NULL ) == NULL )
+	{
+		/* keep it simple: start over */
+		param_sample_flush();
+		param_sample_add( fingerprint, params, size );
+		return;
+	}
+
+	entry = (ParamSampleEntry*) hash_search( paramSamples, &fingerprint,
+											 HASH_ENTER, &found );
+	if( !found )
+	{
+		entry->seen = 0;
+		entry->nsamples = 0;
+	}
+
+	++entry->seen;
+
+	/* fill the reservoir, then replace a sample with probability size/seen */
+	if( entry->nsamples < size )
+		slot = entry->nsamples++;
+	else
+	{
+		slot = (int) (random() % entry->seen);
+		if( slot >= size )
+			return;
+		param_sample_free( entry->samples[slot] );
+	}
+
+	oldcontext = MemoryContextSwitchTo( paramSampleContext );
+	entry->samples[slot] = copyParamList( params );
+	MemoryContextSwitchTo( oldcontext );
+
+	elog( DEBUG3, "IND ADV: param_sample_add: %u: %d samples of " UINT64_FORMAT,
+		  fingerprint, entry->nsamples, entry->seen );
+}
+
+/**
+ * param_sample_get
+ *    returns the number of bind value samples of the fingerprinted statement,
+ * and a palloc'd array of them in samples. The samples themselves stay owned
+ * by the reservoir; they are valid until the next param_sample_add().
+ */
+int param_sample_get( uint32 fingerprint, ParamListInfo** samples )
+{
+	ParamSampleEntry* entry;
+
+	*samples = NULL;
+
+	if( paramSamples == NULL )
+		return 0;
+
+	entry = (ParamSampleEntry*) hash_search( paramSamples, &fingerprint,
+											 HASH_FIND, NULL );
+	if( entry == NULL || entry->nsamples == 0 )
+		return 0;
+
+	*samples = (ParamListInfo*) palloc( entry->nsamples * sizeof(ParamListInfo) );
+	memcpy( *samples, entry->samples, entry->nsamples * sizeof(ParamListInfo) );
+
+	return entry->nsamples;
+}
+
+/**
+ * bind_param_values
+ *    returns a copy of the query with the external parameters replaced by
+ * Consts of their values; so that the candidate generation (partial index
+ * predicates) and the selectivity estimates see the values.
+ */
+Query* bind_param_values( const Query* query, ParamListInfo params )
+{
+	return (Query*) bind_param_values_mutator( (Node*)query, params );
+}
+
+static Node* bind_param_values_mutator( Node* node, ParamListInfo params )
+{
+	if( node == NULL )
+		return NULL;
+
+	if( IsA( node, Param ) )
+	{
+		const Param* const param = (const Param*)node;
+
+		if( param->paramkind == PARAM_EXTERN
+			&& param->paramid > 0 && param->paramid <= params->numParams )
+		{
+			const ParamExternData* const prm = &params->params[param->paramid - 1];
+
+			/* same sanity check as eval_const_expressions() */
+			if( OidIsValid( prm->ptype ) && prm->ptype == param->paramtype )
+			{
+				int16	typLen;
+				bool	typByVal;
+
+				get_typlenbyval( param->paramtype, &typLen, &typByVal );
+
+				return (Node*) makeConst( param->paramtype,
+										  param->paramtypmod,
+										  param->paramcollid,
+										  (int) typLen,
+										  prm->isnull ? (Datum) 0 :
+											datumCopy( prm->value, typByVal, typLen ),
+										  prm->isnull,
+										  typByVal );
+			}
+		}
+
+		return (Node*) copyObject( node );
+	}
+
+	if( IsA( node, Query ) )
+		return (Node*) query_tree_mutator( (Query*)node, bind_param_values_mutator,
+										   (void*) params, 0 );
+
+	return expression_tree_mutator( node, bind_param_values_mutator, (void*) params );
+}
+
+/**
+ * param_sample_free
+ *    frees a sample made by copyParamList().
+ */
+static void param_sample_free( ParamListInfo params )
+{
+	int i;
+
+	for( i = 0; i < params->numParams; ++i )
+	{
+		const ParamExternData* const prm = &params->params[i];
+		int16	typLen;
+		bool	typByVal;
+
+		if( prm->isnull || !OidIsValid( prm->ptype ) )
+			continue;
+
+		get_typlenbyval( prm->ptype, &typLen, &typByVal );
+		if( !typByVal )
+			pfree( DatumGetPointer( prm->value ) );
+	}
+
+	pfree( params );
+}
+
+/**
+ * param_sample_flush
+ *    forgets all samples.
+ */
+static void param_sample_flush( void )
+{
+	if( paramSamples == NULL )
+		return;
+
+	/* the hash table lives in the context as well */
+	MemoryContextDelete( paramSampleContext );
+	paramSampleContext = NULL;
+	paramSamples = NULL;
+}
@@ -0,0 +1,37 @@
+/*!-------------------------------------------------------------------------
+ *
+ * \file param_sample.h
+ * \brief     Prototypes for param_sample.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARAM_SAMPLE_H
+#define PARAM_SAMPLE_H 1
+
+#include "postgres.h"
+
+#include "nodes/params.h"
+#include "nodes/parsenodes.h"
+
+/* max number of bind value sets kept per statement (index_adviser.param_samples) */
+#define PARAM_SAMPLE_MAX		32
+
+/* max number of statements sampled per backend; the samples are flushed when full */
+#define PARAM_SAMPLE_STATEMENTS	256
+
+/*! \struct ParamSampleEntry
+ * \brief the reservoir of bind values of a query fingerprint.
+ */
+typedef struct {
+	uint32			fingerprint;				/**< hash key - the query fingerprint */
+	uint64			seen;						/**< plans offered to the reservoir */
+	int				nsamples;					/**< number of samples kept */
+	ParamListInfo	samples[PARAM_SAMPLE_MAX];	/**< the bind values kept */
+} ParamSampleEntry;
+
+extern void param_sample_add( uint32 fingerprint, ParamListInfo params, int size );
+extern int param_sample_get( uint32 fingerprint, ParamListInfo** samples );
+extern Query* bind_param_values( const Query* query, ParamListInfo params );
+
+#endif   /* PARAM_SAMPLE_H */
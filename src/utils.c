@@ -18,164 +18,6 @@
  * ------------------------------------------------------------------------
  */
 #include "utils.h"
-/*
- * var_eq_const --- eqsel for var = const case
- *
- * This is split out so that some other estimation functions can use it.
- */
-
-/**
-* \brief this function computes the selectivity of 'var=const' clause.
-* Note: this code was taken from PostgreeSQL source code to by pass the verifications made in the code.
-*/
-extern double var_eq_cons(VariableStatData *vardata, Oid operator, Datum constval, bool constisnull, bool varonleft)
-{
-        double          selec;
-        bool            isdefault;
-
-		elog(DEBUG4, "IND ADV: var_eq_cons: Enter");
-		
-        /*
-         * If the constant is NULL, assume operator is strict and return zero, ie,
-         * operator will never return TRUE.
-         */
-        if (constisnull)
-                return 0.0;
-
-        /*
-         * If we matched the var to a unique index or DISTINCT clause, assume
-         * there is exactly one match regardless of anything else.      (This is
-         * slightly bogus, since the index or clause's equality operator might be
-         * different from ours, but it's much more likely to be right than
-         * ignoring the information.)
-         */
-        if (vardata->isunique && vardata->rel && vardata->rel->tuples >= 1.0)
-                return 1.0 / vardata->rel->tuples;
-
-		elog(DEBUG4, "IND ADV: var_eq_cons: non unique - look at stats");		
-        if (HeapTupleIsValid(vardata->statsTuple))
-        {
-                Form_pg_statistic stats;
-                Datum      *values;
-                int                     nvalues;
-                float4     *numbers;
-                int                     nnumbers;
-                bool            match = false;
-                int                     i;
-
-				elog(DEBUG4, "IND ADV: var_eq_cons: get stats tuple struct");
-                stats = (Form_pg_statistic) GETSTRUCT(vardata->statsTuple);
-
-				elog(DEBUG4, "IND ADV: var_eq_cons: check for common values");
-                /*
-                 * Is the constant "=" to any of the column's most common values?
-                 * (Although the given operator may not really be "=", we will assume
-                 * that seeing whether it returns TRUE is an appropriate test.  If you
-                 * don't like this, maybe you shouldn't be using eqsel for your
-                 * operator...)
-                 */
-                if (get_attstatsslot(vardata->statsTuple,
-                                    vardata->atttype, vardata->atttypmod,
-                                    STATISTIC_KIND_MCV, InvalidOid,
-                                    NULL,
-                                    &values, &nvalues,
-                                    &numbers, &nnumbers))
-                {
-                       FmgrInfo        eqproc;
-
-					   elog(DEBUG4, "IND ADV: var_eq_cons: check common - get context for operator: %d",operator);
-					   elog(DEBUG4, "IND ADV: var_eq_cons: check common - get context for opcode: %d",get_opcode(operator));
-                        fmgr_info(get_opcode(operator), &eqproc);
-
-						elog(DEBUG4, "IND ADV: var_eq_cons: loop over vals, var on left? %s",BOOL_FMT(varonleft));
-                        for (i = 0; i < nvalues; i++)
-                        {
-                                /* be careful to apply operator right way 'round */
-                                if (varonleft)
-                                        match = DatumGetBool(FunctionCall2Coll(&eqproc,
-                                                                                DEFAULT_COLLATION_OID,
-                                                                                        values[i],
-                                                                                        constval));
-                                else
-                                        match = DatumGetBool(FunctionCall2Coll(&eqproc,
-                                                                                DEFAULT_COLLATION_OID,
-                                                                                        constval,
-                                                                                        values[i]));
-                                if (match)
-                                        break;
-                        }
-                }
-                else
-                {
-						elog(DEBUG4, "IND ADV: var_eq_cons: no most-common-value info available");
-                        /* no most-common-value info available */
-                        values = NULL;
-                        numbers = NULL;
-                        i = nvalues = nnumbers = 0;
-                }
-
-                if (match)
-                {
-                        /*
-                         * Constant is "=" to this common value.  We know selectivity
-                         * exactly (or as exactly as ANALYZE could calculate it, anyway).
-                         */
-                        selec = numbers[i];
-						elog(DEBUG4, "IND ADV: var_eq_cons: Constant is \"=\" to this common value");
-                }
-                else
-                {
-                        /*
-                         * Comparison is against a constant that is neither NULL nor any
-                         * of the common values.  Its selectivity cannot be more than
-                         * this:
-                         */
-                        double          sumcommon = 0.0;
-                        double          otherdistinct;
-
-						elog(DEBUG4, "IND ADV: var_eq_cons: Comparison is against a constant that is neither NULL nor common value");
-                        for (i = 0; i < nnumbers; i++)
-                                sumcommon += numbers[i];
-                        selec = 1.0 - sumcommon - stats->stanullfrac;
-                        CLAMP_PROBABILITY(selec);
-
-                        /*
-                         * and in fact it's probably a good deal less. We approximate that
-                         * all the not-common values share this remaining fraction
-                         * equally, so we divide by the number of other distinct values.
-                         */
-                        otherdistinct = get_variable_numdistinct(vardata, &isdefault) - nnumbers;
-                        if (otherdistinct > 1)
-                                selec /= otherdistinct;
-
-                        /*
-                         * Another cross-check: selectivity shouldn't be estimated as more
-                         * than the least common "most common value".
-                         */
-                        if (nnumbers > 0 && selec > numbers[nnumbers - 1])
-                                selec = numbers[nnumbers - 1];
-                }
-				elog(DEBUG4, "IND ADV: var_eq_cons: free the stats");
-                free_attstatsslot(vardata->atttype, values, nvalues,
-                                                  numbers, nnumbers);
-        }
-        else
-        {
-				elog(DEBUG4, "IND ADV: var_eq_cons: No ANALYZE stats available, so make a guess using estimated number.");
-                /*
-                 * No ANALYZE stats available, so make a guess using estimated number
-                 * of distinct values and assuming they are equally common. (The guess
-                 * is unlikely to be very good, but we do know a few special cases.)
-                 */
-                selec = 1.0 / get_variable_numdistinct(vardata, &isdefault);
-        }
-
-        /* result should be in range, but make sure... */
-        CLAMP_PROBABILITY(selec);
-		elog(DEBUG4, "IND ADV: var_eq_cons: END. retuning %.5f",selec);
-        return selec;
-}
-
 /*
 void dump_trace() {
 	void * buffer[255];
@@ -268,12 +110,29 @@ Configuration* parse_config_file(const char *filename, const char *cols, const b
 	 ReleaseSysCache(ht_opc);
  }
 
-List* create_operator_list(char *SupportedOps[], int numOps) 
+static int oid_compare(const void *a, const void *b)
 {
-	List*       opnos = NIL;
-        int i;
+	Oid		oa = *((const Oid *) a);
+	Oid		ob = *((const Oid *) b);
 
-        elog(DEBUG2, "IDX_ADV: create_operator_list: we have %d ops to scan.",lengthof(SupportedOps));
+	return (oa < ob) ? -1 : (oa > ob) ? 1 : 0;
+}
+
+/**
+* \brief collects the oids of all operators named in SupportedOps into a sorted
+* array allocated in context; the number of oids is returned in nOpnos.
+* The array can be probed with operator_in_array().
+*/
+Oid* create_operator_array(char *SupportedOps[], int numOps, int *nOpnos, MemoryContext context)
+{
+	Oid*        opnos;
+	int         nopnos = 0;
+	int         maxopnos = 16;
+	int         i;
+	int         j;
+
+	elog(DEBUG2, "IDX_ADV: create_operator_array: we have %d ops to scan.",numOps);
+	opnos = (Oid *) MemoryContextAlloc(context, maxopnos * sizeof(Oid));
 	for( i=0; i < numOps; i++ )
 	{
 		FuncCandidateList   opnosResult;
@@ -289,15 +148,37 @@ List* create_operator_list(char *SupportedOps[], int numOps)
 #endif
 							   );
 			opnosResult != NULL;
-			opnosResult = lnext(opnosResult) )
+			opnosResult = opnosResult->next )
 		{
 			elog(DEBUG2, "opno: %d, %s",opnosResult->oid ,SupportedOps[i]);
-			opnos = lappend_oid( opnos, opnosResult->oid );
+			if (nopnos == maxopnos)
+			{
+				maxopnos *= 2;
+				opnos = (Oid *) repalloc(opnos, maxopnos * sizeof(Oid));
+			}
+			opnos[nopnos++] = opnosResult->oid;
 		}
 
 		/* free the Value* (T_String) and the list */
 		pfree( linitial( supop ) );
 		list_free( supop );
 	}
+
+	/* sort and remove duplicates (eg. "=" is both a btree and a gin op) */
+	qsort(opnos, nopnos, sizeof(Oid), oid_compare);
+	for( i = 0, j = 0; i < nopnos; i++ )
+		if( j == 0 || opnos[j - 1] != opnos[i] )
+			opnos[j++] = opnos[i];
+
+	*nOpnos = j;
 	return opnos;
 }
+
+/**
+* \brief binary search for opno in an array built by create_operator_array().
+*/
+bool operator_in_array(Oid opno, const Oid *opnos, int nopnos)
+{
+	return nopnos > 0 &&
+		bsearch(&opno, opnos, nopnos, sizeof(Oid), oid_compare) != NULL;
+}
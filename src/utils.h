@@ -79,9 +79,9 @@ Configuration* parse_config_file(const char *filename, const char *cols, const b
 
 
 void get_opclass_name(Oid opclass, Oid actual_datatype, StringInfo buf);
-extern double var_eq_cons(VariableStatData *vardata, Oid operator,Datum constval, bool constisnull,bool varonleft);
 //void dump_trace();
-List* create_operator_list(char *SupportedOps[], int numOps);
+Oid* create_operator_array(char *SupportedOps[], int numOps, int *nOpnos, MemoryContext context);
+bool operator_in_array(Oid opno, const Oid *opnos, int nopnos);
 #define BOOL_FMT(bool_expr) (bool_expr) ? "true" : "false"
 
 #endif   /* UTILS_H */
@@ -43,5 +43,7 @@ load 'pg_idx_advisor.so';
 -- we should get advices on both parent and cheild tables
 explain select max(unitsales) from measurement;
 \o
-select attrs,benefit,indclass,indoption,query,recommendation from index_advisory;
+-- the share of each index depends on the estimated index sizes; check which are advised
+select attrs,indclass,indoption,query,recommendation from index_advisory
+	where query = 'select max(unitsales) from measurement;' order by recommendation;
 
@@ -0,0 +1,16 @@
+-- the aggregated advisory keeps one row per recommended index
+load 'pg_idx_advisor.so';
+
+set index_adviser.aggregate = on;
+
+\o /tmp/pg_idx_tst.out
+
+explain select * from t where a = 100;
+
+explain select * from t where a = 200;
+
+explain select * from t where b = 100;
+
+\o
+select attrs,hits,indclass,recommendation from index_advisory_summary order by attrs;
+select count(*) from index_advisory_queries;